@@ -0,0 +1,217 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+// benchmark for the rectangle packer of the glyph atlas, it places a set of
+// glyph sized rectangles (50000 by default, the number can be given as argument)
+// with the current packer and with the previous one that scanned the whole
+// skyline for each rectangle and prints the utilisation of the atlas and the time
+
+#include <stll/internal/rectanglePacker.h>
+
+#include <vector>
+#include <array>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+// the previous packer: a skyline kept as a sorted list of sections, that is
+// completely scanned to find the lowest position for each rectangle
+class OldRectanglePacker_c
+{
+  private:
+    int width_, height_;
+
+    typedef struct
+    {
+      int x;
+      int y;
+    } skyline;
+
+    std::vector<skyline> skylines;
+    std::vector<skyline> skylines_shadow;
+
+    int checkFit(size_t index, int w)
+    {
+      int xend = skylines[index].x+w;
+      int y = skylines[index].y;
+      index++;
+
+      while (index < skylines.size() && skylines[index].x < xend)
+      {
+        y = std::max(y, skylines[index].y);
+        index++;
+      }
+
+      return y;
+    }
+
+  public:
+
+    OldRectanglePacker_c(int width, int height) : width_(width), height_(height)
+    {
+      skylines.push_back(skyline {1, 1});
+      skylines.push_back(skyline {width_-1, height_});
+    }
+
+    uint32_t width(void) const { return width_; }
+    uint32_t height(void) const { return height_; }
+
+    std::experimental::optional<std::array<uint32_t, 2>> allocate(uint32_t w, uint32_t h)
+    {
+      size_t bestI = 0;
+      int bestY = checkFit(bestI, w);
+
+      for (size_t i = 1; skylines[i].x+(int)w+1 < width_; i++)
+      {
+        int y = checkFit(i, w);
+        if (y < bestY)
+        {
+          bestY = y;
+          bestI = i;
+        }
+      }
+
+      int bestX = skylines[bestI].x;
+      int nextY = bestY + h;
+
+      if (nextY+1 >= height_)
+        return std::experimental::optional<std::array<uint32_t, 2>>();
+
+      skylines_shadow.clear();
+      skylines_shadow.reserve(skylines.size()+2);
+
+      size_t i = 0;
+      while (i < bestI)
+      {
+        skylines_shadow.push_back(skylines[i]);
+        i++;
+      }
+
+      if (i == 0 || nextY != skylines[i-1].y)
+        skylines_shadow.push_back(skyline{skylines[i].x, nextY});
+
+      int xend = skylines[bestI].x+w;
+
+      while (skylines[i].x < xend)
+        i++;
+
+      if (skylines[i].x > xend && skylines[i-1].y != nextY)
+        skylines_shadow.push_back(skyline{xend, skylines[i-1].y});
+
+      while (i < skylines.size())
+      {
+        skylines_shadow.push_back(skylines[i]);
+        i++;
+      }
+
+      swap(skylines, skylines_shadow);
+
+      return std::array<uint32_t, 2>{(uint32_t)bestX, (uint32_t)bestY};
+    }
+
+    void doubleSize(void)
+    {
+      width_ *= 2;
+      height_ *= 2;
+
+      skylines.rbegin()->y = 1;
+      skylines.push_back(skyline {width_-1, height_});
+    }
+};
+
+typedef std::array<uint32_t, 2> Size_t;
+
+// place all rectangles, doubling the size of the packer whenever one
+// doesn't fit any more, just like the glyph atlas does it
+template <class P>
+void run(const char * name, const std::vector<Size_t> & rects, uint32_t w, uint32_t h)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  P p(w, h);
+  uint64_t area = 0;
+  uint32_t top = 0;
+  int grows = 0;
+
+  for (const auto & r : rects)
+  {
+    auto a = p.allocate(r[0], r[1]);
+
+    while (!a)
+    {
+      p.doubleSize();
+      grows++;
+      a = p.allocate(r[0], r[1]);
+    }
+
+    top = std::max(top, a.value()[1] + r[1]);
+    area += r[0]*r[1];
+  }
+
+  double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-4s %6u x %7u  grown %2i times  utilisation %.3f  used height %7u  filled %.3f  time %.3f s\n",
+         name, p.width(), p.height(), grows,
+         (double)area / ((double)p.width()*p.height()), top,
+         (double)area / ((double)p.width()*top), t);
+}
+
+int main(int argc, char ** argv)
+{
+  int n = argc > 1 ? atoi(argv[1]) : 50000;
+
+  // sizes of glyph images of fonts between 8 and 80 pixels including the
+  // one pixel border, some of them blurred
+  std::mt19937 rnd(1);
+  std::vector<Size_t> rects;
+
+  for (int i = 0; i < n; i++)
+  {
+    int size = 8 + rnd()%40 + (rnd()%10 == 0 ? rnd()%32 : 0);
+    uint32_t w = std::max(2, (int)(size * (0.3 + (rnd()%70)/100.0))) + 2;
+    uint32_t h = std::max(2, (int)(size * (0.5 + (rnd()%60)/100.0))) + 2;
+
+    if (rnd()%8 == 0)
+    {
+      w += 8;
+      h += 8;
+    }
+
+    rects.push_back(Size_t{w, h});
+  }
+
+  printf("%i rectangles, starting with a 256 x 256 atlas\n", n);
+  run<STLL::internal::RectanglePacker_c>("new", rects, 256, 256);
+  run<OldRectanglePacker_c>("old", rects, 256, 256);
+
+  // wide atlases that never grow, here the old packer has to scan a long skyline
+  for (uint32_t w : { 4096, 16384, 65536 })
+  {
+    printf("%i rectangles, fixed width %u\n", n, w);
+    run<STLL::internal::RectanglePacker_c>("new", rects, w, 1 << 20);
+    run<OldRectanglePacker_c>("old", rects, w, 1 << 20);
+  }
+
+  return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef STLL_FONT_INDEX_H
+#define STLL_FONT_INDEX_H
+
+/** \file
+ *  \brief an index of the fonts available within some directories
+ */
+
+#include "layouterFont.h"
+
+#include <string>
+#include <memory>
+#include <map>
+#include <vector>
+
+#include <stdint.h>
+
+namespace STLL {
+
+class TextStyleSheet_c;
+
+/** \brief the information the font index keeps about one font file
+ */
+class FontIndexEntry_c
+{
+  public:
+    std::string path;     ///< full path of the font file
+    uint64_t fileSize;    ///< size of the file when it was indexed
+    int64_t mtime;        ///< modification time of the file when it was indexed
+
+    std::string family;   ///< family name, empty when the file could not be opened as a font
+    std::string style;    ///< CSS font-style value: "normal", "italic" or "oblique"
+    std::string variant;  ///< CSS font-variant value: "normal" or "small-caps"
+    std::string weight;   ///< CSS font-weight value: "normal", "bold" or the numeric weight, e.g. "300"
+    std::string stretch;  ///< CSS font-stretch value: "normal", "condensed", "semi-expanded", ...
+
+    /** \brief the unicode blocks of 256 codepoints that the font has characters in
+     *
+     * Each pair is a range of blocks (first and last block). When a codepoint is
+     * within one of those blocks the font might contain it, otherwise it surely doesn't.
+     */
+    std::vector<std::pair<uint16_t, uint16_t>> coverage;
+
+    /** \brief check whether the font might contain the given character
+     *
+     * This is only a check against the coverage summary, when true is returned
+     * the font may still not have the character
+     */
+    bool mayContain(char32_t ch) const;
+
+    /** \brief true, when the file is a usable font */
+    bool isFont(void) const { return !family.empty(); }
+};
+
+/** \brief an index of font files
+ *
+ * Opening many font files just to find out about their family and style is slow. This
+ * class scans directories for font files and keeps the information about the found fonts.
+ * The index can be stored in a catalogue file and loaded from there. When a directory is
+ * scanned again only the files that are new or changed (different size or modification time)
+ * are opened, so keeping the catalogue around makes startup fast.
+ *
+ * The index can then be used to add the fonts to a FontFamily_c or a TextStyleSheet_c.
+ *
+ * \code
+ * FontIndex_c idx;
+ * idx.load("fonts.idx");
+ * if (idx.scan("/usr/share/fonts")) idx.save("fonts.idx");
+ * idx.addToStyleSheet(styleSheet);
+ * \endcode
+ *
+ * Only the first face of font collections (.ttc, .otc) is indexed, as font resources
+ * can not refer to the other faces within these files.
+ */
+class FontIndex_c
+{
+  public:
+
+    /** \brief create an empty index, using the given library to open fonts while scanning */
+    FontIndex_c(std::shared_ptr<FreeTypeLibrary_c> l) : lib(l) {}
+
+    /** \brief create an empty index with its own instance of the FreeType library */
+    FontIndex_c(void) : lib(std::make_shared<FreeTypeLibrary_c>()) {}
+
+    /** \brief scan a directory and all its subdirectories for font files
+     *
+     * Files that are already in the index with the same size and modification time are not
+     * opened again. Entries of files below the directory that don't exist anymore are removed.
+     *
+     * \param directory the directory to scan
+     * \return the number of entries that were added, updated or removed, so when this is not 0
+     *         you may want to save the catalogue
+     */
+    size_t scan(const std::string & directory);
+
+    /** \brief load the index from a catalogue file
+     *
+     * All entries currently in the index are replaced.
+     *
+     * \param catalogue the file to load
+     * \return true, when the file could be loaded, false when it doesn't exist or is not a valid
+     *         catalogue (e.g. created by an other version of the library). In that case the
+     *         index is empty afterwards
+     */
+    bool load(const std::string & catalogue);
+
+    /** \brief save the index into a catalogue file
+     *
+     * \param catalogue the file to write
+     * \return true on success
+     */
+    bool save(const std::string & catalogue) const;
+
+    /** \brief get all entries, sorted by path */
+    const std::map<std::string, FontIndexEntry_c> & getEntries(void) const { return entries; }
+
+    /** \brief get the names of all font families within the index */
+    std::vector<std::string> getFamilies(void) const;
+
+    /** \brief add all fonts of a family to a font family object
+     *
+     * \param family the name of the family to add
+     * \param f the font family object to add to
+     * \return number of fonts added
+     */
+    size_t addToFamily(const std::string & family, FontFamily_c & f) const;
+
+    /** \brief add all fonts of the index to a style sheet using their family names
+     *
+     * \param s the style sheet to add to
+     * \return number of fonts added
+     */
+    size_t addToStyleSheet(TextStyleSheet_c & s) const;
+
+  private:
+
+    // walk a directory, note all found font files in found, visited is used to not go into
+    // directories more than once (because of symbolic links)
+    void walk(const std::string & directory, std::map<std::string, std::pair<uint64_t, int64_t>> & found,
+              std::vector<std::pair<uint64_t, uint64_t>> & visited) const;
+
+    // open the font file and fill out the font information of the entry
+    void index(FontIndexEntry_c & e) const;
+
+    std::map<std::string, FontIndexEntry_c> entries;
+    std::shared_ptr<FreeTypeLibrary_c> lib;
+};
+
+}
+
+#endif
@@ -27,6 +27,9 @@
 #include "dividers.h"
 #include "glyphCache.h"
 
+#include <algorithm>
+#include <cstdint>
+
 // blitting routines to output the generated glyphs, template code, should be pretty good for
 // most purposes
 
@@ -105,7 +108,7 @@ void outputGlyph_NONE(int sx, int sy, const internal::PaintData_c & img, Color_c
                       int cx = 0, int cy = 0, int cw = std::numeric_limits<int>::max(), int ch = std::numeric_limits<int>::max())
 {
   if (cx <= 0) { cw += cx; } else { w -= cx; s += bbp*cx; sx -= 64*cx; }
-  if (cy <= 0) { ch += cx; } else { h -= cy; s += pitch*cy; sy -= 64*cy; }
+  if (cy <= 0) { ch += cy; } else { h -= cy; s += pitch*cy; sy -= 64*cy; }
   if (w > cw) { w = cw; }
   if (h > ch) { h = ch; }
 
@@ -130,47 +133,200 @@ void outputGlyph_NONE(int sx, int sy, const internal::PaintData_c & img, Color_c
     stx = 0;
   }
 
-  if (stx+stw >= w)
+  if (stx+stw > w)
   {
-    stw -= (stx+stw-w+1);
+    stw -= (stx+stw-w);
   }
 
   if (stw <= 0) return;
   if (sty >= h || sty+img.rows < 0) return;
 
+  auto pixel = [&](uint8_t * dst, int a, int aprev)
+  {
+    uint8_t r, g, b;
+    std::tie(r, g, b) = pxget(dst);
+
+    r = blend(r, c.r(), a, aprev, stb);
+    g = blend(g, c.g(), a, aprev, stb);
+    b = blend(b, c.b(), a, aprev, stb);
+
+    pxput(dst, r, g, b);
+  };
+
   for (int y = 0; y < img.rows; y++)
   {
     if (yp >= 0 && yp < h)
     {
-      int xp = stx;
-
       int a = 0;
       int aprev = 0;
 
-      uint8_t * dst = s + yp*pitch + bbp*xp;
-      const uint8_t * src = img.getBuffer() + y*img.pitch + sti;
+      uint8_t * dst = s + yp*pitch + bbp*stx;
+
+      // the image is read in runs, for images that are not encoded that is the whole line
+      RunReader_c src(img, y);
 
-      if (sti > 0) aprev = *(src-1) * c.a();
+      if (sti > 0)
+      {
+        src.skip(sti-1);
+        aprev = src.get() * c.a();
+      }
 
       int x = stw;
 
       while (x > 0)
       {
-        a = *src * c.a();
+        int v;
+        const uint8_t * values;
+        int n = src.next(x, v, values);
+
+        x -= n;
+
+        if (v < 0)
+        {
+          while (n > 0)
+          {
+            a = *values * c.a();
+            pixel(dst, a, aprev);
+
+            aprev = a;
+            dst += bbp;
+            values++;
+            n--;
+          }
+        }
+        else
+        {
+          // only the first pixel of a run of equal values blends between different values
+          a = v * c.a();
+          pixel(dst, a, aprev);
+          aprev = a;
+          dst += bbp;
+          n--;
+
+          if (a == 0)
+          {
+            // transparent pixels don't change the surface
+            dst += bbp*n;
+          }
+          else if (a == 255*255 && n > 0)
+          {
+            // fully covered pixels get the colour, independent of the surface
+            pixel(dst, a, a);
+
+            uint8_t r, g, b;
+            std::tie(r, g, b) = pxget(dst);
+
+            for (dst += bbp, n--; n > 0; n--, dst += bbp)
+              pxput(dst, r, g, b);
+          }
+          else
+          {
+            for (; n > 0; n--, dst += bbp)
+              pixel(dst, a, a);
+          }
+        }
+      }
+    }
+    yp++;
+  }
+}
+
+// the lines of outputGlyph_HorizontalRGB for run length encoded images, the position and clipping
+// are already done, runs of equal values that cover whole pixels are handled at once
+template <class P1, class P2, class B>
+void outputGlyph_HorizontalRGB_Runs(int stx, int sty, int stc, int stb, int sti, int stw,
+                                    const internal::PaintData_c & img, int sp1c, int sp2c, int sp3c, int alpha,
+                                    uint8_t * s, int pitch, int bbp, int h,
+                                    const P1 & pxget, const P2 & pxput, const B & blend)
+{
+  int yp = sty;
+
+  for (int y = 0; y < img.rows; y++)
+  {
+    if (yp >= 0 && yp < h)
+    {
+      int a = 0;
+      int aprev = 0;
+
+      uint8_t * dst = s + yp*pitch + bbp*stx;
+      RunReader_c src(img, y);
+
+      if (sti > 0)
+      {
+        src.skip(sti-1);
+        aprev = src.get() * alpha;
+      }
+
+      int x = stw;
+
+      uint8_t sp1, sp2, sp3;
+      std::tie(sp1, sp2, sp3) = pxget(dst);
+
+      switch (stc)
+      {
+        case 0: a = src.get()*alpha; sp1 = blend(sp1, sp1c, a, aprev, stb); aprev = a;
+        case 1: a = src.get()*alpha; sp2 = blend(sp2, sp2c, a, aprev, stb); aprev = a;
+        case 2: a = src.get()*alpha; sp3 = blend(sp3, sp3c, a, aprev, stb); aprev = a;
+      }
+
+      pxput(dst, sp1, sp2, sp3);
+      dst += bbp;
+      x--;
 
-        uint8_t r, g, b;
-        std::tie(r, g, b) = pxget(dst);
+      while (x > 0)
+      {
+        uint8_t v;
+        int n = src.uniform(v) / 3;
+
+        if (n > 0 && v*alpha == aprev)
+        {
+          // whole pixels within a run of equal values that continues the previous sub pixel
+          n = std::min(n, x);
+          src.skip(3*n);
+          x -= n;
+
+          if (aprev == 0)
+          {
+            // transparent pixels don't change the surface
+            dst += bbp*n;
+          }
+          else if (aprev == 255*255)
+          {
+            // fully covered pixels get the colour, independent of the surface
+            std::tie(sp1, sp2, sp3) = pxget(dst);
+
+            sp1 = blend(sp1, sp1c, aprev, aprev, stb);
+            sp2 = blend(sp2, sp2c, aprev, aprev, stb);
+            sp3 = blend(sp3, sp3c, aprev, aprev, stb);
+
+            for (; n > 0; n--, dst += bbp)
+              pxput(dst, sp1, sp2, sp3);
+          }
+          else
+          {
+            for (; n > 0; n--, dst += bbp)
+            {
+              std::tie(sp1, sp2, sp3) = pxget(dst);
+
+              sp1 = blend(sp1, sp1c, aprev, aprev, stb);
+              sp2 = blend(sp2, sp2c, aprev, aprev, stb);
+              sp3 = blend(sp3, sp3c, aprev, aprev, stb);
+
+              pxput(dst, sp1, sp2, sp3);
+            }
+          }
+
+          continue;
+        }
 
-        r = blend(r, c.r(), a, aprev, stb);
-        g = blend(g, c.g(), a, aprev, stb);
-        b = blend(b, c.b(), a, aprev, stb);
+        std::tie(sp1, sp2, sp3) = pxget(dst);
 
-        pxput(dst, r, g, b);
+        a = src.get()*alpha; sp1 = blend(sp1, sp1c, a, aprev, stb); aprev = a;
+        a = src.get()*alpha; sp2 = blend(sp2, sp2c, a, aprev, stb); aprev = a;
+        a = src.get()*alpha; sp3 = blend(sp3, sp3c, a, aprev, stb); aprev = a;
 
-        aprev = a;
-        xp++;
-        dst+=bbp;
-        src++;
+        pxput(dst, sp1, sp2, sp3);
+        dst += bbp;
         x--;
       }
     }
@@ -222,7 +378,7 @@ void outputGlyph_HorizontalRGB(int sx, int sy, const internal::PaintData_c & img
                                int ch = std::numeric_limits<int>::max())
 {
   if (cx <= 0) { cw += cx; } else { w -= cx; s += bbp*cx; sx -= 64*cx; }
-  if (cy <= 0) { ch += cx; } else { h -= cy; s += pitch*cy; sy -= 64*cy; }
+  if (cy <= 0) { ch += cy; } else { h -= cy; s += pitch*cy; sy -= 64*cy; }
   if (w > cw) { w = cw; }
   if (h > ch) { h = ch; }
 
@@ -253,14 +409,21 @@ void outputGlyph_HorizontalRGB(int sx, int sy, const internal::PaintData_c & img
     stx = 0;
   }
 
-  if (stx+stw >= w)                              // check how much of the image fits into clipping area
+  if (stx+stw > w)                              // check how much of the image fits into clipping area
   {
-    stw -= (stx+stw-w+1);
+    stw -= (stx+stw-w);
   }
 
   if (stw <= 0) return;                          // leave function when there is nothing to output
   if (sty >= h || sty+img.rows < 0) return;
 
+  if (img.isCompressed())
+  {
+    outputGlyph_HorizontalRGB_Runs(stx, sty, stc, stb, sti, stw, img, sp1c, sp2c, sp3c, alpha,
+                                   s, pitch, bbp, h, pxget, pxput, blend);
+    return;
+  }
+
   for (int y = 0; y < img.rows; y++)
   {
     if (yp >= 0 && yp < h)
@@ -305,6 +468,45 @@ void outputGlyph_HorizontalRGB(int sx, int sy, const internal::PaintData_c & img
   }
 }
 
+/**
+ * blending function for coverage masks, instead of blending towards a colour the coverage
+ * of the glyph is combined with the coverage already in the mask, so that overlapping glyphs
+ * don't get more coverage than each of them alone. The parameters are the same as for blend,
+ * the colour is ignored
+ */
+inline int blendCoverage(int a1, int, int b1, int b2, int c)
+{
+  int b = b1 + (b2-b1)*c/64;
+  return a1 + (255-a1)*b/(255*255);
+}
+
+/**
+ * fill an unblurred rectangle into a coverage mask, the edges are rounded to full pixels
+ * the same way the output drivers do it when they fill rectangles
+ *
+ * \param x x position of the rectangle relative to the mask in 1/64 pixels
+ * \param y y position of the rectangle relative to the mask in 1/64 pixels
+ * \param rw width of the rectangle in 1/64 pixels
+ * \param rh height of the rectangle in 1/64 pixels
+ * \param mask the coverage mask
+ * \param pitch number of bytes per row of the mask
+ * \param bpp number of bytes per pixel, 3 for masks with sub-pixels
+ * \param w width of the mask in pixels
+ * \param h height of the mask in pixels
+ */
+inline void fillCoverageRect(int64_t x, int64_t y, int64_t rw, int64_t rh, uint8_t * mask, int pitch, int bpp, int w, int h)
+{
+  int rx0 = std::max<int64_t>(div_inf<int64_t>(x + 32, 64), 0);
+  int ry0 = std::max<int64_t>(div_inf<int64_t>(y + 32, 64), 0);
+  int rx1 = std::min<int64_t>(div_inf<int64_t>(x + rw + 32, 64), w);
+  int ry1 = std::min<int64_t>(div_inf<int64_t>(y + rh + 32, 64), h);
+
+  if (rx1 <= rx0) return;
+
+  for (int yy = ry0; yy < ry1; yy++)
+    std::fill(mask + yy*pitch + bpp*rx0, mask + yy*pitch + bpp*rx1, 255);
+}
+
 } }
 
 #endif
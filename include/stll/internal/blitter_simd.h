@@ -0,0 +1,106 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef STLL_BLITTER_SIMD_H
+#define STLL_BLITTER_SIMD_H
+
+#include "../color.h"
+
+#include "glyphCache.h"
+
+#include <type_traits>
+#include <utility>
+#include <limits>
+
+// accelerated blitting routines for 32 bit surfaces with the byte order B, G, R, X (the
+// usual little endian XRGB8888 surface). They produce exactly the same output as the template
+// functions in blitter.h with the blend function from there, but process several pixels at a time
+// using SSE2 or AVX2 when the processor supports it
+
+namespace STLL { namespace internal {
+
+// the gamma lookup tables to use, see Gamma_c
+class GammaTables_c
+{
+  public:
+    const uint16_t * forward;  // 256 entries
+    const uint16_t * inverse;  // 256*scale entries
+    int scale;
+};
+
+// check, if a gamma class provides its lookup tables
+template <class G, class = void>
+class HasGammaTables_c : public std::false_type { };
+
+template <class G>
+class HasGammaTables_c<G, decltype((void)std::declval<const G &>().forwardTable(),
+                                   (void)std::declval<const G &>().inverseTable())> : public std::true_type { };
+
+// the instruction sets the blitters can use
+enum BlitterLevel
+{
+  BLIT_SCALAR,
+  BLIT_SSE2,
+  BLIT_AVX2
+};
+
+// the instruction set that is currently used, by default the best one the processor supports
+BlitterLevel getBlitterLevel(void);
+
+// select the instruction set to use, levels that the processor doesn't support are
+// lowered to the best supported level, returns the selected level
+BlitterLevel setBlitterLevel(BlitterLevel l);
+
+// the gamma lookups are still done one pixel at a time, the vector code speeds up the
+// pixels that are empty or fully covered, this only pays for long lines, for glyphs narrower
+// than this the template functions are faster. Doing the lookups with gathers is exact, but
+// about twice as slow as the template functions for text sizes
+const int minAcceleratedWidth = 32;
+
+// true, when the current instruction set can be used by the accelerated functions, that
+// is at least SSE2 (AVX2 for sub-pixel output)
+bool acceleratedBlitterAvailable(bool subpixel);
+
+// true, when the accelerated functions should be used for the glyph, that is when the glyph is
+// wide enough and the instruction set is available, the width is checked first, so that the
+// usual narrow glyphs go to the template functions without calling into the library
+inline bool useAcceleratedBlitter(const PaintData_c & img, bool subpixel)
+{
+  return img.width >= (subpixel ? 3 : 1) * minAcceleratedWidth && acceleratedBlitterAvailable(subpixel);
+}
+
+// same as outputGlyph_NONE with the pixel functions for the B, G, R, X byte order
+void outputGlyph_NONE_XRGB(int sx, int sy, const PaintData_c & img, Color_c c,
+                           uint8_t * s, int pitch, int w, int h, const GammaTables_c & g,
+                           int cx = 0, int cy = 0, int cw = std::numeric_limits<int>::max(),
+                           int ch = std::numeric_limits<int>::max());
+
+// same as outputGlyph_HorizontalRGB with the pixel functions for the B, G, R, X byte order, the
+// subpixel values are in R, G, B order when bgr is false, otherwise B, G, R
+void outputGlyph_HorizontalRGB_XRGB(int sx, int sy, const PaintData_c & img, int sp1c, int sp2c, int sp3c, int alpha,
+                                    bool bgr, uint8_t * s, int pitch, int w, int h, const GammaTables_c & g,
+                                    int cx = 0, int cy = 0, int cw = std::numeric_limits<int>::max(),
+                                    int ch = std::numeric_limits<int>::max());
+
+} }
+
+#endif
@@ -47,6 +47,51 @@ void gaussBlur (uint8_t * s, int pitch, int w, int h, double r, int sx, int sy);
  */
 int gaussBlurrDist(double r);
 
+/** \brief the number of pixels one pixel influences in each direction when applying gaussBlur
+ * with this radius, including the effects of the reduced resolution for big radii, this can be
+ * bigger than gaussBlurrDist
+ */
+int gaussBlurrReach(double r);
+
+/** \brief set the radius from which on the blurr is calculated at a reduced resolution
+ *
+ * Above the cutoff the image is downsampled, blurred with the accordingly smaller radius and
+ * scaled back up using bilinear interpolation. The resolution is chosen so that the radius at
+ * the reduced resolution is at least half the cutoff. With the default of 24 pixels
+ * the result stays within 6 (of 255) of the blurr at full resolution, the error grows
+ * when the cutoff is lowered. Use 0 to always blurr at full resolution.
+ *
+ * Images already in the glyph caches are not changed, so set this before output starts. Glyph
+ * cache files written with a different cutoff are not used.
+ *
+ * \param r the radius in pixels
+ */
+void setGaussBlurrCutoff(double r);
+
+/** \brief get the current cutoff radius, see setGaussBlurrCutoff
+ */
+double getGaussBlurrCutoff(void);
+
+/** \brief the factor by which the resolution is reduced for a blurr with radius r, 1 when
+ * the blurr is calculated at full resolution
+ */
+int gaussBlurrScale(double r);
+
+/** \brief apply a gaussian blurr and return the result at the reduced resolution
+ *
+ * The w x h image s is downsampled by gaussBlurrScale(r) in both directions and then blurred,
+ * the result, with the size w/scale x h/scale (rounded up), is written into d.
+ *
+ * \param s the source image
+ * \param spitch the number of bytes to get to the next line of the source image
+ * \param w the width of the source image
+ * \param h the height of the source image
+ * \param r the radius to spread the data over
+ * \param d the destination image
+ * \param dpitch the number of bytes to get to the next line of the destination image
+ */
+void gaussBlurDown(const uint8_t * s, int spitch, int w, int h, double r, uint8_t * d, int dpitch);
+
 } }
 
 
@@ -0,0 +1,88 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef STLL_COVERAGE_MASK_H
+#define STLL_COVERAGE_MASK_H
+
+#include "glyphCache.h"
+
+#include <memory>
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace STLL {
+
+class TextLayout_c;
+
+namespace internal {
+
+// the coverage of all glyphs and rectangles of a layout combined into one image, so that
+// a layout that doesn't change can be drawn as one glyph in any colour, see showSDL::renderMask
+//
+// The image has the format of the glyph images of the sub-pixel arrangement, it is positioned
+// relative to the origin of the layout. The coverage of a command is scaled by the alpha value
+// of its colour, the colour itself is not kept, and overlapping commands are combined, so that
+// they don't get more coverage than each of them alone. Images of the layout are not included.
+// The mask is immutable, copies share the image
+class CoverageMask_c
+{
+  public:
+    CoverageMask_c(void) { }
+
+    // render the mask of the layout, the glyphs are taken from cache
+    CoverageMask_c(const TextLayout_c & l, SubPixelArrangement sp, GlyphCache_c & cache);
+
+    // true, when the layout has nothing to draw
+    bool empty(void) const { return !data; }
+
+    const PaintData_c & getImage(void) const { return data->image; }
+    SubPixelArrangement getSubPixelArrangement(void) const { return sp; }
+
+    // the covered area in pixels relative to the origin of the layout
+    int32_t getLeft(void) const { return data ? data->image.left : 0; }
+    int32_t getTop(void) const { return data ? -data->image.top : 0; }
+    int32_t getWidth(void) const { return data ? data->image.width / (sp == SUBP_NONE ? 1 : 3) : 0; }
+    int32_t getHeight(void) const { return data ? data->image.rows : 0; }
+
+    // number of bytes used by the image
+    size_t memory(void) const { return data ? data->image.memory() : 0; }
+
+  private:
+
+    // the image with the allocator for its buffer, the allocator must be destroyed after the image
+    class Data_c
+    {
+      public:
+        SlabAllocator_c slab;
+        PaintData_c image;
+
+        Data_c(const GlyphCacheFile_c::Record_c & r, const uint8_t * d) : image(r, d, slab, true) { }
+    };
+
+    std::shared_ptr<const Data_c> data;
+    SubPixelArrangement sp = SUBP_NONE;
+};
+
+} }
+
+#endif
@@ -23,6 +23,8 @@
 #ifndef STLL_DIVIDERS_H
 #define STLL_DIVIDERS_H
 
+#include <utility>
+
 namespace STLL { namespace internal {
 
 template <class T>
@@ -0,0 +1,149 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef STLL_DRAW_LIST_H
+#define STLL_DRAW_LIST_H
+
+#include "glyphCache.h"
+
+#include "../color.h"
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <array>
+#include <utility>
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace STLL {
+
+class TextLayout_c;
+
+namespace internal {
+
+// a layout compiled for the software renderers, see showSDL::DrawList_c
+//
+// The images of all commands are looked up in the glyph cache, the colours are converted
+// with the gamma of the renderer and consecutive commands of the same kind and colour are
+// merged into runs, so that drawing the list again only needs to blend the images. The
+// positions stay in 1/64 pixels relative to the origin of the layout, as the pixel and the
+// sub-pixel phase depend on where the layout is drawn.
+//
+// The list refers to images within the glyph cache. It stays valid as long as the cache
+// removes none of the images it marked as listed in the shards the list uses, see
+// GlyphCache_c::getRemovals, valid checks that with one counter per shard. Evicting images that
+// no list uses doesn't invalidate lists, when the cache evicts an image of a list, that list and
+// the other lists using the same shard are simply compiled again. The cache must be held while
+// the list is compiled and drawn.
+// Images that are not admitted to the cache (bigger than the budget of a shard) count as
+// removals as well, they are freed when the cache is released, so a list that uses one of
+// them is not valid right after it was compiled and is compiled again each time it is drawn.
+class DrawList_c
+{
+  public:
+    enum RunKind
+    {
+      RUN_GLYPHS,   // glyphs and blurred rectangles, drawn from their images
+      RUN_RECTS,    // unblurred rectangles, filled
+      RUN_IMAGES    // images, drawn by the application
+    };
+
+    // one command of the list
+    class Item_c
+    {
+      public:
+        SlicedImage_c img;   // the image for RUN_GLYPHS
+        int32_t x, y;        // the position relative to the origin of the layout in 1/64 pixels
+        int32_t w, h;        // the size of rectangles and images
+        uint32_t url;        // the index of the url for images, see getURL
+    };
+
+    // consecutive items of one kind and colour
+    class Run_c
+    {
+      public:
+        RunKind kind;
+        Color_c c;           // the colour of the commands
+        Color_c fc;          // the colour converted with the gamma
+        uint32_t first;      // the items of the run
+        uint32_t last;
+    };
+
+    // true, when the list can be drawn with the cache, the sub-pixel arrangement and the gamma
+    bool valid(const std::shared_ptr<GlyphCache_c> & c, SubPixelArrangement s, uint8_t g) const;
+
+    // compile the layout, the cache must be held and stay held until the list is drawn for the first time.
+    // The missing images are rendered using the given number of threads before they are looked up
+    // and the colours of the runs are converted with the gamma g, gamma is the value g is set to.
+    // When commands is not nullptr only the commands with these indices are compiled, e.g. the ones
+    // visible at one position
+    template <class G>
+    void compile(const TextLayout_c & l, SubPixelArrangement s, const std::shared_ptr<GlyphCache_c> & c,
+                 size_t threads, const G & g, uint8_t gamma, const std::vector<size_t> * commands = nullptr)
+    {
+      compile(l, commands, s, c, threads);
+
+      for (auto & r : runs)
+        r.fc = g.forward(r.c);
+
+      this->gamma = gamma;
+    }
+
+    // forget the compiled layout, e.g. when the layout was changed
+    void clear(void);
+
+    const std::vector<Run_c> & getRuns(void) const { return runs; }
+    const std::vector<Item_c> & getItems(void) const { return items; }
+    const std::string & getURL(const Item_c & i) const { return urls[i.url]; }
+
+    // true, when the list contains images of the application
+    bool hasImages(void) const { return !urls.empty(); }
+
+    // the rows of the target an item of a run may draw into, when the layout is drawn at sy
+    static std::pair<int, int> rows(const Run_c & r, const Item_c & i, int sy);
+
+    // the rows an image at the vertical position y and a rectangle from y to y+h may draw
+    // into, these are also used by the output drivers for the commands of layouts
+    static std::pair<int, int> imageRows(int32_t y, const SlicedImage_c & img, int sy);
+    static std::pair<int, int> rectRows(int32_t y, int32_t h, int sy);
+
+  private:
+    void compile(const TextLayout_c & l, const std::vector<size_t> * commands, SubPixelArrangement s,
+                 const std::shared_ptr<GlyphCache_c> & c, size_t threads);
+
+    std::vector<Run_c> runs;
+    std::vector<Item_c> items;
+    std::vector<std::string> urls;
+
+    // what the list was compiled for, the shards are a bit mask of the shards the images come from
+    std::shared_ptr<GlyphCache_c> cache;
+    SubPixelArrangement sp = SUBP_NONE;
+    uint8_t gamma = 0;
+    uint32_t shards = 0;
+    std::array<uint64_t, GlyphCache_c::numShards> removals {{}};
+};
+
+} }
+
+#endif
@@ -25,6 +25,9 @@
 
 #include <stll/color.h>
 
+#include <array>
+#include <cmath>
+
 namespace STLL { namespace internal {
 
 // lookup tables for gamma correct output
@@ -73,6 +76,10 @@ class Gamma_c {
     uint16_t forward(uint8_t v) const { return gammaFor[v]; }
     uint8_t inverse(uint16_t v) const { return gammaInv[v]; }
     uint16_t scale(void) const { return S; }
+
+    // the lookup tables used by forward and inverse, for the accelerated blitters
+    const uint16_t * forwardTable(void) const { return gammaFor; }
+    const uint16_t * inverseTable(void) const { return gammaInv; }
 };
 
 class GammaNone_c {
@@ -88,6 +95,22 @@ class GammaNone_c {
     uint16_t forward(uint8_t v) const { return v; }
     uint8_t inverse(uint16_t v) const { return v; }
     uint16_t scale(void) const { return 1; }
+
+    const uint16_t * forwardTable(void) const { return identity(); }
+    const uint16_t * inverseTable(void) const { return identity(); }
+
+  private:
+
+    static const uint16_t * identity(void)
+    {
+      static const std::array<uint16_t, 256> t = []() {
+        std::array<uint16_t, 256> a;
+        for (int i = 0; i < 256; i++) a[i] = i;
+        return a;
+      }();
+
+      return t.data();
+    }
 };
 
 } }
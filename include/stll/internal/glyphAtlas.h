@@ -41,8 +41,17 @@ class FontAtlasData_c {
     int32_t left;   // where is the left of the image, when the base-point is known
     int32_t top;    // where is the top of the image, when the base-point is known
 
+    uint32_t scale; // the image is stored at a reduced resolution, it needs to be enlarged by this factor
+
+    // blurred rectangles: the middle column and row of the image (in the atlas resolution) and
+    // how many pixels they have to be stretched additionally to get the size that was asked
+    // for with getRect, see rectSliceKey
+    uint32_t midx, midy;
+    uint32_t extraw, extrah;
+
     FontAtlasData_c(uint32_t posx, uint32_t posy, uint32_t w, uint32_t height, uint32_t l, uint32_t t) :
-      pos_x(posx), pos_y(posy), rows(height), width(w), left(l), top(t) {}
+      pos_x(posx), pos_y(posy), rows(height), width(w), left(l), top(t), scale(1),
+      midx(0), midy(0), extraw(0), extrah(0) {}
 
     FontAtlasData_c(void) {}
 };
@@ -59,42 +68,54 @@ class GlyphAtlas_c : public TextureAtlas_c<internal::GlyphKey_c, FontAtlasData_c
       TextureAtlas_c<internal::GlyphKey_c, FontAtlasData_c, std::shared_ptr<FontFace_c>, 1>(width, height)
     {}
 
-    virtual typename std::unordered_map<internal::GlyphKey_c, FontAtlasData_c>::iterator addElement(const internal::GlyphKey_c & key, const std::shared_ptr<FontFace_c> & f)
+    virtual iterator addElement(const internal::GlyphKey_c & key, const std::shared_ptr<FontFace_c> & f)
     {
       if (f)
       {
         auto g = f->renderGlyph(key.glyphIndex, key.sp);
 
-        std::unordered_map<internal::GlyphKey_c, FontAtlasData_c>::iterator i;
+        iterator i;
+        bool valid = false;
 
-        glyphPrepare(g, key.blurr, key.sp, 1,
-          [this, key, &i](int w, int h, int l, int t) -> auto {
-            bool valid;
+        auto res = glyphPrepareScaled(g, key.blurr, key.sp, 1,
+          [this, key, &i, &valid](int w, int h, int l, int t) -> auto {
             std::tie(i, valid) = insert(key, w, h, l, t);
 
             if (valid)
-              return std::make_tuple(getData()+i->second.pos_y*width()+i->second.pos_x, width());
+              return std::make_tuple(getData()+i->second.data.pos_y*width()+i->second.data.pos_x, width());
             else
               return std::make_tuple<uint8_t*, uint32_t>(nullptr, 0);});
 
+        if (valid)
+          i->second.data.scale = std::get<4>(res);
+
         return i;
       }
       else
       {
         FontFace_c::GlyphSlot_c g(key.w, key.h);
 
-        std::unordered_map<internal::GlyphKey_c, FontAtlasData_c>::iterator i;
+        iterator i;
+        bool valid = false;
 
-        glyphPrepare(g, key.blurr, key.sp, 1,
-          [this, key, &i](int w, int h, int l, int t) -> auto {
-            bool valid;
+        auto res = glyphPrepareScaled(g, key.blurr, key.sp, 1,
+          [this, key, &i, &valid](int w, int h, int l, int t) -> auto {
             std::tie(i, valid) = insert(key, w, h, l, t);
 
             if (valid)
-              return std::make_tuple(getData()+i->second.pos_y*width()+i->second.pos_x, width());
+              return std::make_tuple(getData()+i->second.data.pos_y*width()+i->second.data.pos_x, width());
             else
               return std::make_tuple<uint8_t*, uint32_t>(0, 0);});
 
+        if (valid)
+        {
+          int d = gaussBlurrDist(key.blurr/64.0);
+
+          i->second.data.scale = std::get<4>(res);
+          i->second.data.midx = (key.w + 2*d) / 2 / i->second.data.scale;
+          i->second.data.midy = (key.h + 2*d) / 2 / i->second.data.scale;
+        }
+
         return i;
       }
     }
@@ -117,9 +138,20 @@ class GlyphAtlas_c : public TextureAtlas_c<internal::GlyphKey_c, FontAtlasData_c
 
     std::experimental::optional<FontAtlasData_c> getRect(int w, int h, SubPixelArrangement, uint16_t blurr)
     {
-      // rectangles are always without sub-pixel placement
-      internal::GlyphKey_c k(w, h, SUBP_NONE, blurr);
-      return find(k, std::shared_ptr<FontFace_c>());
+      // rectangles are always without sub-pixel placement, blurred ones are stretched
+      // from the image of a smaller rectangle
+      int ew, eh;
+      internal::GlyphKey_c k = rectSliceKey(internal::GlyphKey_c(w, h, SUBP_NONE, blurr), ew, eh);
+
+      auto res = find(k, std::shared_ptr<FontFace_c>());
+
+      if (res)
+      {
+        res->extraw = ew;
+        res->extrah = eh;
+      }
+
+      return res;
     }
 };
 
@@ -25,16 +25,81 @@
 
 #include <stll/layouterFont.h>
 #include <stll/internal/glyphKey.h>
+#include <stll/internal/glyphCacheFile.h>
+
+#include <boost/utility.hpp>
 
 #include <unordered_map>
+#include <vector>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <deque>
+#include <future>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <limits>
+
+
+namespace STLL {
+
+class TextLayout_c;
+
+namespace internal {
+
+// allocator for the bitmaps of the glyph cache
+//
+// Allocating each bitmap on its own from the heap is slow and fragments the memory,
+// so small bitmaps are carved out of big pages instead. Each allocation is rounded up to
+// one of a set of size classes (16 byte steps up to 256 bytes, then 4 classes per power of 2)
+// and freed blocks are kept in a free list per class, so allocation and release are
+// constant time. Bitmaps bigger than the biggest class are allocated from the heap directly.
+// When no block is in use anymore all pages are given back
+class SlabAllocator_c : boost::noncopyable
+{
+  public:
+    // allocate a block of at least n bytes, the block is aligned to 16 bytes
+    uint8_t * allocate(size_t n);
 
+    // release a block, n must be the same size as given to allocate
+    void release(uint8_t * p, size_t n);
 
-namespace STLL { namespace internal {
+    // number of bytes allocated from the heap for pages and big blocks
+    size_t memory(void) const { return pages.size()*pageSize + bigBytes; }
+
+  private:
+    static const size_t pageSize = 256*1024;
+    static const size_t maxSlab = 32*1024;
+    static const size_t numClasses = 44;
+
+    static size_t sizeClass(size_t n);
+    static size_t classBytes(size_t c);
+
+    std::vector<std::unique_ptr<uint8_t[]>> pages;
+    std::array<uint8_t *, numClasses> freeLists {{}};
+
+    // unused rest of the newest page
+    uint8_t * bump = nullptr;
+    size_t bumpLeft = 0;
+
+    size_t liveBlocks = 0;
+    size_t bigBytes = 0;
+};
 
 // encapsulation for an object to paint it contains the data for the alpha value
 // of an object to paint. It is used to store information about single glyphs or
 // single rectangles to draw
+//
+// Images can be run length encoded (see compress), mainly blurred glyphs consist of long runs
+// of transparent and opaque pixels. The buffer of an encoded image starts with the offsets
+// of the rows (one uint32_t per row) followed by the runs of all rows, each row covers pitch
+// columns. A run starts with a byte that contains the kind of the run in the upper 2 bits
+// (runZero: transparent, runFull: opaque, runValues: the values follow the byte) and the
+// length minus 1 in the lower 6 bits. Use RunReader_c to read the rows
 class PaintData_c
 {
   public:
@@ -43,33 +108,528 @@ class PaintData_c
     int32_t rows;  // hight of image
     int32_t width; // width of image
     int32_t pitch; // number of bytes per line of image, guaranteed to be at least 1 or 2 bigger than width
-    std::unique_ptr<uint8_t[]> buffer;
-    uint32_t lastUse;
 
     // create from Freetype glyph data
-    PaintData_c(const FontFace_c::GlyphSlot_c & ft, uint16_t blurr, SubPixelArrangement sp);
+    PaintData_c(const FontFace_c::GlyphSlot_c & ft, uint16_t blurr, SubPixelArrangement sp, SlabAllocator_c & a);
 
     // create rectangle data
-    PaintData_c(uint16_t width, uint16_t height, uint16_t blurr, SubPixelArrangement sp);
+    PaintData_c(uint16_t width, uint16_t height, uint16_t blurr, SubPixelArrangement sp, SlabAllocator_c & a);
+
+    // use an image of a cache file, when copy is false the data is used in place, otherwise
+    // it is copied
+    PaintData_c(const GlyphCacheFile_c::Record_c & r, const uint8_t * data, SlabAllocator_c & a, bool copy = false);
 
-    const uint8_t * getBuffer(void) const { return buffer.get(); }
+    PaintData_c(const PaintData_c &) = delete;
+    PaintData_c & operator=(const PaintData_c &) = delete;
+
+    PaintData_c(PaintData_c && p) : left(p.left), top(p.top), rows(p.rows), width(p.width), pitch(p.pitch),
+      slab(p.slab), buffer(p.buffer), bufferSize(p.bufferSize), owned(p.owned), compressed(p.compressed)
+    {
+      p.buffer = nullptr;
+      p.bufferSize = 0;
+    }
+
+    ~PaintData_c(void) { if (owned) slab.release(const_cast<uint8_t*>(buffer), bufferSize); }
+
+    const uint8_t * getBuffer(void) const { return buffer; }
+
+    // number of bytes used by the image, images of cache files don't use memory
+    size_t memory(void) const { return owned ? bufferSize : 0; }
+
+    // true, when the image was rendered, false when it is within a cache file
+    bool isOwned(void) const { return owned; }
+
+    // the kinds of runs of encoded images
+    enum { runZero = 0, runFull = 1, runValues = 2 };
+
+    // true, when the image is run length encoded, getBuffer then returns the encoded data
+    bool isCompressed(void) const { return compressed; }
+
+    // run length encode a rendered image, when that makes it smaller
+    void compress(void);
+
+    // write the pitch columns of row y into dst
+    void decodeRow(int y, uint8_t * dst) const;
+
+    // an image with the position and size of r that uses data in place, the data stays with the caller
+    PaintData_c view(const GlyphCacheFile_c::Record_c & r, const uint8_t * data) const
+    {
+      return PaintData_c(r, data, slab);
+    }
+
+  private:
+    uint8_t * allocate(int w, int h);
+
+    SlabAllocator_c & slab;
+    const uint8_t * buffer = nullptr;
+    size_t bufferSize = 0;
+    bool owned = true;
+    bool compressed = false;
 };
 
-class GlyphCache_c
+// reads the columns of one row of an image as runs, for images that are not encoded
+// the whole row is one run of values
+class RunReader_c
 {
+  public:
+    RunReader_c(const PaintData_c & img, int y)
+    {
+      if (img.isCompressed())
+      {
+        uint32_t o;
+        std::memcpy(&o, img.getBuffer() + sizeof(uint32_t)*y, sizeof(o));
+        p = img.getBuffer() + o;
+      }
+      else
+      {
+        kind = PaintData_c::runValues;
+        left = std::numeric_limits<int>::max();
+        values = img.getBuffer() + y*img.pitch;
+      }
+    }
+
+    // the next run of at most n columns, returns its length, v receives the value of all
+    // columns of the run, or -1 when the values differ, they are then in data
+    int next(int n, int & v, const uint8_t *& data)
+    {
+      load();
+
+      int k = std::min(n, left);
+      left -= k;
+
+      if (kind == PaintData_c::runValues)
+      {
+        v = -1;
+        data = values;
+        values += k;
+      }
+      else
+      {
+        v = (kind == PaintData_c::runZero) ? 0 : 255;
+      }
+
+      return k;
+    }
+
+    // the value of the next column
+    uint8_t get(void)
+    {
+      load();
+      left--;
+
+      if (kind == PaintData_c::runValues) return *values++;
+      return (kind == PaintData_c::runZero) ? 0 : 255;
+    }
+
+    // the number of following columns within the current run, when that run has the
+    // same value for all columns, v receives that value, 0 for runs of values
+    int uniform(uint8_t & v)
+    {
+      load();
+
+      if (kind == PaintData_c::runValues) return 0;
+
+      v = (kind == PaintData_c::runZero) ? 0 : 255;
+      return left;
+    }
+
+    void skip(int n)
+    {
+      int v;
+      const uint8_t * d;
+
+      while (n > 0)
+        n -= next(n, v, d);
+    }
+
   private:
-    // our glyph cache with all the rendered glyphs
-    std::unordered_map<GlyphKey_c, PaintData_c> glyphCache;
+    const uint8_t * p = nullptr;
+    const uint8_t * values = nullptr;
+    int kind = PaintData_c::runZero;
+    int left = 0;
+
+    void load(void)
+    {
+      if (left > 0) return;
 
-    // each time we access a glyph from the cache we increase this number
-    // and write the value into the lastUse field of the rendered glyph
-    // that is how we can find out glyphs that were not used the longest time
-    uint32_t useCounter = 0;
+      kind = *p >> 6;
+      left = (*p & 63) + 1;
+      p++;
 
+      if (kind == PaintData_c::runValues)
+      {
+        values = p;
+        p += left;
+      }
+    }
+};
+
+// an image that is drawn with its middle column (width/2) repeated extraW more times and its
+// middle row (rows/2) repeated extraH more times, that is how blurred rectangles of all sizes
+// are drawn from the images of a few small rectangles, see rectSliceKey
+class SlicedImage_c
+{
   public:
-    PaintData_c & getGlyph(std::shared_ptr<FontFace_c> face, glyphIndex_t glyph, SubPixelArrangement sp, uint16_t blurr);
-    PaintData_c & getRect(int w, int h, SubPixelArrangement sp, uint16_t blurr);
+    const PaintData_c * image = nullptr;
+    int32_t extraW = 0;
+    int32_t extraH = 0;
+
+    SlicedImage_c(void) { }
+    explicit SlicedImage_c(const PaintData_c & i, int32_t w = 0, int32_t h = 0) : image(&i), extraW(w), extraH(h) { }
+
+    bool stretched(void) const { return extraW > 0 || extraH > 0; }
+
+    int32_t width(void) const { return image->width + extraW; }
+    int32_t rows(void) const { return image->rows + extraH; }
+    int32_t pitch(void) const { return image->pitch + extraW; }
+
+    // write the rows y0 to y1 (excluding) of the stretched image into dst, including
+    // the additional columns up to pitch()
+    void render(int32_t y0, int32_t y1, uint8_t * dst, int32_t dpitch) const;
+
+    // call f with images of horizontal strips of the stretched image that together cover
+    // the rows y0 to y1 (excluding), the strips are kept in a buffer of the calling thread
+    // that is only valid during the call of f
+    template <class F>
+    void strips(int32_t y0, int32_t y1, F f) const
+    {
+      const int32_t stripBytes = 64*1024;
+
+      thread_local std::vector<uint8_t> buffer;
+
+      int32_t p = pitch();
+      int32_t n = std::max<int32_t>(1, stripBytes / p);
+
+      y0 = std::max(y0, 0);
+      y1 = std::min(y1, rows());
+
+      if (y0 >= y1) return;
+
+      buffer.resize((size_t)p * std::min(n, y1-y0));
+
+      for (int32_t y = y0; y < y1; y += n)
+      {
+        int32_t e = std::min(y+n, y1);
+
+        render(y, e, buffer.data(), p);
+
+        GlyphCacheFile_c::Record_c r;
+        r.left = image->left;
+        r.top = image->top - y;
+        r.width = width();
+        r.rows = e - y;
+        r.pitch = p;
+
+        f(image->view(r, buffer.data()));
+      }
+    }
+};
+
+// the glyph cache keeps the images of rendered glyphs and rectangles
+//
+// The cache keeps track of the number of bytes used by the images and removes the
+// images that were used the longest time ago as soon as the budget is exceeded.
+// Images that are bigger than the admission limit are not cached the first time they
+// are requested, so that a few huge glyphs (big sizes or big blur radii) don't throw
+// everything else out of the cache. Only when the same image is requested again
+// soon it is added to the cache.
+//
+// The cache can additionally use cache files with already rendered images. They are mapped into
+// memory and the images are used directly from there. Newly rendered images are kept in memory
+// only and can be written into a cache file with save. Several processes can share the
+// same cache file.
+//
+// Blurred rectangles are stored as the image of a small rectangle per blurr radius that
+// is stretched to the requested size when drawing, see SlicedImage_c.
+//
+// The cache can be used by several threads at the same time. It is split into shards
+// by the hash of the key, each with its own lock, its own part of the budget and its own
+// least recently used list, so that threads that use different images rarely wait for
+// each other, images bigger than the part of the budget of a shard are never cached. When several threads miss the same image at the same time only one of them
+// renders it, the others wait for the result.
+//
+// The returned references stay valid until the next call to getGlyph or getRect, when
+// the cache is used by several threads, they have to hold it, see hold
+class GlyphCache_c : boost::noncopyable
+{
+  public:
+    class Statistics_c
+    {
+      public:
+        size_t entries = 0;   ///< number of images within the cache
+        size_t bytes = 0;     ///< number of bytes accounted for the images within the cache
+        size_t budget = 0;    ///< the maximal number of bytes
+        size_t hits = 0;      ///< number of requests that were served from the cache
+        size_t misses = 0;    ///< number of requests that needed to render the image
+        size_t fileHits = 0;  ///< number of requests that were served from a cache file
+        size_t evictions = 0; ///< number of images removed to stay within the budget
+        size_t bypassed = 0;  ///< number of images that were rendered but not added to the cache because of their size
+    };
+
+    static const size_t defaultBudget = 32*1024*1024;
+
+    // the number of shards of the cache and the shard of an image
+    static const size_t numShards = 16;
+
+    static size_t shardIndex(const GlyphKey_c & k)
+    {
+      size_t h = std::hash<GlyphKey_c>()(k);
+      return (h ^ (h >> 17)) % numShards;
+    }
+
+  private:
+    // one entry of the cache, the entries are linked into a list sorted by the time of
+    // their last use, the most recently used one first
+    class Entry_c
+    {
+      public:
+        Entry_c(std::unique_ptr<PaintData_c> d) : data(std::move(d)) { }
+
+        // the image is kept separately, so that it can outlive the entry, see retire
+        std::unique_ptr<PaintData_c> data;
+        Entry_c * prev = nullptr;
+        Entry_c * next = nullptr;
+        const GlyphKey_c * key = nullptr; // the key of this entry within the map
+
+        // the font of the entry as identified in cache files
+        uint64_t fontHash = 0;
+        uint32_t fontSize = 0;
+
+        // the image was handed out for a draw list, so removing it counts, see getRemovals
+        bool listed = false;
+    };
+
+    // bytes accounted for the bookkeeping of one entry
+    static const size_t entryOverhead = sizeof(std::pair<const GlyphKey_c, Entry_c>) + sizeof(PaintData_c) + 2*sizeof(void*);
+
+    // an image that is currently rendered by one thread, the other threads that request
+    // the same image wait until it is finished
+    class Flight_c
+    {
+      public:
+        std::condition_variable cv;
+        bool done = false;
+    };
+
+    // a part of the cache, all members are protected by the mutex
+    class Shard_c
+    {
+      public:
+        std::mutex mutex;
+
+        // the bitmaps of the entries, must be declared before the map so that
+        // it is destroyed after the map
+        SlabAllocator_c slab;
+
+        std::unordered_map<GlyphKey_c, Entry_c> map;
+        std::unordered_map<GlyphKey_c, std::shared_ptr<Flight_c>> flights;
+
+        // both ends of the list of entries
+        Entry_c * newest = nullptr;
+        Entry_c * oldest = nullptr;
+
+        // the counters and bytes of this shard, the entries are taken from the map
+        Statistics_c stats;
+
+        // hashes of the last images that were not admitted to the cache
+        std::array<size_t, 16> rejected {{}};
+        size_t rejectedPos = 0;
+
+        // the last image that was not admitted to the cache while the cache was not held
+        std::unique_ptr<PaintData_c> uncached;
+
+        // the number of listed images that were removed or not admitted, see getRemovals
+        std::atomic<uint64_t> removals { 0 };
+    };
+
+    // the mapped cache files, the entries may point into them, so they
+    // also need to be declared before the shards
+    std::vector<std::unique_ptr<GlyphCacheFile_c>> files;
+
+    std::array<Shard_c, numShards> shards;
+
+    // when true, the font hash is noted for all entries so that they can be saved
+    std::atomic<bool> persistent { false };
+
+    // when true, newly rendered glyph images are run length encoded
+    std::atomic<bool> compression { false };
+
+    std::atomic<size_t> budget { defaultBudget };
+    std::atomic<size_t> admissionLimit { 0 };
+
+    // an image that was removed from the cache while the cache was held, it is freed
+    // when all holds that started before its removal are released
+    class Retired_c
+    {
+      public:
+        uint64_t epoch;
+        size_t shard;
+        std::unique_ptr<PaintData_c> image;
+    };
+
+    // see hold, each hold notes the epoch when it started and each removal of an
+    // image while holding starts a new epoch, protected by holdMutex
+    std::mutex holdMutex;
+    uint64_t epoch = 1;
+    std::multiset<uint64_t> holds;
+    std::deque<Retired_c> retired;
+
+    size_t shardBudget(void) const { return budget / numShards; }
+    size_t getAdmissionLimit(void) const
+    {
+      size_t a = admissionLimit;
+      return a ? a : budget / 64;
+    }
+
+    // the following functions must be called with the lock of the shard held
+    void unlink(Shard_c & s, Entry_c * e);
+    void pushFront(Shard_c & s, Entry_c * e);
+    void touch(Shard_c & s, Entry_c * e);
+    void erase(size_t s, Entry_c * e);
+    void shrink(size_t s, size_t bytes);
+
+    // get rid of an image of shard s that might still be used by someone holding the cache, when
+    // the cache is not held, the image is freed, or kept until the next image is not admitted
+    // when keep is true
+    void retire(size_t s, std::unique_ptr<PaintData_c> p, bool keep = false);
+
+    // add a newly rendered image to shard s, or keep it outside of the cache
+    // when it is too big and admit is false, listed see getGlyph
+    PaintData_c & insert(size_t s, const GlyphKey_c & k, std::unique_ptr<PaintData_c> d, uint64_t fontHash = 0,
+                         uint32_t fontSize = 0, bool admit = false, bool listed = false);
+
+    // an image that is rendered by prepare or on a miss
+    class PrepareJob_c
+    {
+      public:
+        GlyphKey_c key;
+        std::shared_ptr<FontFace_c> face;    // nullptr for rectangles
+        GlyphCacheFile_c::Record_c image;    // the file key and the size of the rendered image
+        std::vector<uint8_t> data;
+        bool done = false;
+
+        PrepareJob_c(const GlyphKey_c & k) : key(k) { }
+    };
+
+    // render the image of one job, this doesn't access the cache
+    static void render(PrepareJob_c & j);
+
+    // render the jobs using the given number of threads, this doesn't access the cache
+    static void render(std::vector<PrepareJob_c> & jobs, size_t threads);
+
+    // find the image with the key k, render it when it is neither in the cache nor in the
+    // cache files, setup fills the face and file key of the job and is only called on a miss
+    template <class S>
+    PaintData_c & get(const GlyphKey_c & k, S setup, bool listed);
+
+    // add rendered jobs to the cache
+    void add(std::vector<PrepareJob_c> & jobs);
+
+    // add the results of asynchronous prepares
+    void addPending(void);
+
+    // prepare the commands with the given indices, all commands when commands is nullptr
+    size_t prepare(const TextLayout_c & l, const std::vector<size_t> * commands, SubPixelArrangement sp,
+                   size_t threads, bool async);
+
+    // jobs finished by asynchronous prepares, waiting to be added to the cache
+    // and the running asynchronous prepares, all protected by pendingMutex
+    std::mutex pendingMutex;
+    std::vector<PrepareJob_c> pending;
+    std::atomic<bool> hasPending { false };
+    std::vector<std::future<void>> tasks;
+
+    // is the image with the key in the cache or being rendered
+    bool contains(const GlyphKey_c & k);
+
+    // search the cache files for an image, returns nullptr when not found
+    const uint8_t * findInFiles(const GlyphKey_c & k, uint64_t fontHash, uint32_t fontSize,
+                                const GlyphCacheFile_c::Record_c *& rec) const;
+
+  public:
+    ~GlyphCache_c(void);
+
+    // get the image of a glyph or a blurred rectangle, when listed is true the image is marked as
+    // used by a draw list, so that removing it from the cache later on counts, see getRemovals
+    PaintData_c & getGlyph(std::shared_ptr<FontFace_c> face, glyphIndex_t glyph, SubPixelArrangement sp, uint16_t blurr,
+                           bool listed = false);
+    SlicedImage_c getRect(int w, int h, SubPixelArrangement sp, uint16_t blurr, bool listed = false);
+
+    // remove the entries that were used the longest time ago until there are
+    // at most num entries left, 0 empties the cache
     void trim(size_t num);
+
+    // remove all glyphs of the given font face from the cache
+    void removeFont(const FontFace_c * face);
+
+    // while the cache is held the images removed from it (to stay within the budget, by trim or
+    // removeFont) and the images that are not admitted are kept, so all references returned by
+    // getGlyph and getRect stay valid until release is called. Holds can be nested and several
+    // threads can hold the cache at the same time, an image is kept until all holds that started
+    // before its removal are released. Returns the ticket to pass to release
+    uint64_t hold(void);
+
+    // stop holding the cache, frees the images that are no longer used by any hold
+    void release(uint64_t ticket);
+
+    // holds the cache for the lifetime of the object
+    class Hold_c
+    {
+      private:
+        GlyphCache_c & c;
+        uint64_t ticket;
+
+      public:
+        Hold_c(GlyphCache_c & cache) : c(cache), ticket(c.hold()) { }
+        ~Hold_c(void) { c.release(ticket); }
+    };
+
+    // set the maximal number of bytes for the images within the cache,
+    // entries are removed right away when the cache is bigger
+    void setBudget(size_t bytes);
+    size_t getBudget(void) const { return budget; }
+
+    // images bigger than this are only cached when they are requested a second time
+    // shortly after the first time, 0 selects 1/64 of the budget
+    void setAdmissionLimit(size_t bytes) { admissionLimit = bytes; }
+
+    // run length encode the glyph images that are added to the cache from now on, see
+    // PaintData_c::compress, the images already within the cache are kept as they are
+    void setCompression(bool on) { compression = on; }
+    bool getCompression(void) const { return compression; }
+
+    Statistics_c getStatistics(void);
+
+    // the number of listed images (see getGlyph) that left the shard s or were not admitted to it
+    // so far. Listed references to the images of the shard that were taken while the cache was held
+    // stay valid after the hold, as long as this number doesn't change, see DrawList_c. Removing
+    // images that were never listed doesn't count, so draw lists survive unrelated evictions
+    uint64_t getRemovals(size_t s) const { return shards[s].removals; }
+
+    // render all images required for the layout that are not yet in the cache using several
+    // threads, threads = 0 uses as many threads as there are processors. When async is true
+    // the function returns right away and the images are added to the cache by one of the
+    // next calls to getGlyph or getRect after they have been rendered. The font files are not opened
+    // more often for this, so the threads render the glyphs of one file after the other unless you
+    // allow more instances with FontCache_c::setMaxFaceInstances, the blurring is always parallel
+    // returns the number of images that are rendered
+    size_t prepare(const TextLayout_c & l, SubPixelArrangement sp, size_t threads = 0, bool async = false);
+
+    // the same as above, but only for the commands of the layout with the given indices
+    size_t prepare(const TextLayout_c & l, const std::vector<size_t> & commands, SubPixelArrangement sp,
+                   size_t threads = 0, bool async = false);
+
+    // map a cache file and use the images within it, files added first are searched first,
+    // even when the file can not be used (e.g. because it doesn't exist yet) the cache
+    // starts to note the fonts of the images so that they can be saved later on. The files
+    // must be added before the cache is used by several threads
+    bool addFile(const std::string & path);
+
+    // write the images into a cache file, when all is true the images of the cache files in use are
+    // included, otherwise only the images rendered by this cache are written
+    bool save(const std::string & path, bool all = true);
+
+    size_t size(void);
 };
 
 } }
@@ -0,0 +1,108 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#ifndef STLL_GLYPH_CACHE_FILE_H
+#define STLL_GLYPH_CACHE_FILE_H
+
+#include <boost/utility.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace STLL { namespace internal {
+
+// a read only file containing rendered glyph images that is mapped into memory
+//
+// The file starts with a header, followed by the records of all images sorted by their key
+// and then the images themselves. All values are stored in the byte order of the machine
+// that wrote the file, files with a different byte order or version are not used. The same goes
+// for files written with a different blurr cutoff (see setGaussBlurrCutoff) as their blurred
+// images look different.
+//
+// Fonts are identified by the hash of the file content (FontFile_c::getContentHash) and the size,
+// so the file can be used by other processes and after restarts. Rectangles use 0 for both.
+class GlyphCacheFile_c : boost::noncopyable
+{
+  public:
+
+    // the information stored for one image
+    class Record_c
+    {
+      public:
+        uint64_t font;    // content hash of the font file, 0 for rectangles
+        uint32_t size;    // size of the font
+        uint32_t glyph;   // glyph index
+        uint16_t sp;      // sub pixel arrangement
+        uint16_t blurr;   // blur radius
+        uint16_t w, h;    // size of rectangles
+        int32_t left, top, rows, width, pitch; // see PaintData_c
+        uint32_t reserved;
+        uint64_t offset;  // position of the image within the file
+
+        bool operator<(const Record_c & b) const
+        {
+          if (font != b.font) return font < b.font;
+          if (size != b.size) return size < b.size;
+          if (glyph != b.glyph) return glyph < b.glyph;
+          if (sp != b.sp) return sp < b.sp;
+          if (blurr != b.blurr) return blurr < b.blurr;
+          if (w != b.w) return w < b.w;
+          return h < b.h;
+        }
+
+        bool sameKey(const Record_c & b) const { return !(*this < b) && !(b < *this); }
+    };
+
+    GlyphCacheFile_c(void) {}
+    ~GlyphCacheFile_c(void);
+
+    // map the file into memory, returns false when the file can not be opened or is not
+    // a valid cache file
+    bool open(const std::string & path);
+
+    // find the record with the key given in the key fields of k, nullptr when not found
+    const Record_c * find(const Record_c & k) const;
+
+    // get the image of a record
+    const uint8_t * getData(const Record_c & r) const { return base + r.offset; }
+
+    const Record_c * begin(void) const { return records; }
+    const Record_c * end(void) const { return records + count; }
+
+    // write a cache file, the records are sorted and their offset set, data contains
+    // the images for the records, the file is replaced atomically so that processes that
+    // have the old file mapped can keep on using it
+    static bool write(const std::string & path, std::vector<Record_c> & records, const std::vector<const uint8_t *> & data);
+
+  private:
+    const uint8_t * base = nullptr;
+    size_t length = 0;
+    const Record_c * records = nullptr;
+    size_t count = 0;
+};
+
+} }
+
+#endif
@@ -76,15 +76,25 @@ namespace std {
   template <>
   class hash<STLL::internal::GlyphKey_c>
   {
+  private:
+    // finalizer of murmur hash 3, every bit of the input influences all bits of the output
+    static uint64_t mix(uint64_t h)
+    {
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 33;
+      return h;
+    }
+
   public :
     size_t operator()(const STLL::internal::GlyphKey_c & name ) const
     {
-      return (size_t)name.font
-           + (size_t)name.glyphIndex
-           + (size_t)name.sp
-           + (size_t)name.blurr
-           + (size_t)name.w
-           + (size_t)name.h;
+      uint64_t h = mix((uint64_t)name.font);
+      h = mix(h ^ ((uint64_t)name.glyphIndex | (uint64_t)name.blurr << 32 | (uint64_t)name.sp << 48));
+      h = mix(h ^ ((uint64_t)name.w | (uint64_t)name.h << 16));
+      return (size_t)h;
     }
   };
 
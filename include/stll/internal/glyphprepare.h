@@ -26,9 +26,12 @@
 
 #include "../layouterFont.h"
 
+#include "glyphKey.h"
+
 #include <tuple>
 
 #include <cstring>
+#include <vector>
 
 namespace STLL { namespace internal {
 
@@ -96,6 +99,106 @@ std::tuple<int, int, int, int, int> glyphPrepare(const FontFace_c::GlyphSlot_c &
   }
 }
 
+// the same as glyphPrepare, but for blurr radii above the cutoff of gaussBlurDown the image
+// is returned at the reduced resolution, the size given to m is the reduced size, the
+// returned tuple contains left, top, width, rows and the factor by which the image has
+// to be enlarged, left and top are always at full resolution. Only images without sub pixels
+// are reduced
+template <class M>
+std::tuple<int, int, int, int, int> glyphPrepareScaled(const FontFace_c::GlyphSlot_c & ft, uint16_t blurr, SubPixelArrangement sp, int frame, M m)
+{
+  int scale = internal::gaussBlurrScale(blurr/64.0);
+
+  if (blurr == 0 || scale == 1 || sp != SUBP_NONE)
+  {
+    int left, top, width, pitch, rows;
+    std::tie(left, top, width, pitch, rows) = glyphPrepare(ft, blurr, sp, frame, m);
+
+    return std::make_tuple(left, top, pitch, rows, 1);
+  }
+
+  // the full resolution image with the border for the blurr, as created by glyphPrepare
+  // but without frame, goes into a temporary buffer, it is then downsampled and blurred
+  // into the buffer provided by m, the frame is added at the reduced resolution
+  int blurrdist = internal::gaussBlurrDist(blurr/64.0);
+  int left = ft.left - blurrdist;
+  int top = ft.top + blurrdist;
+  int fullw = ft.w + 2*blurrdist + 1;
+  int fullh = ft.h + 2*blurrdist;
+
+  std::vector<uint8_t> full(fullw*fullh, 0);
+
+  for (int i = 0; i < ft.h; i++)
+  {
+    if (ft.data)
+      memcpy(full.data()+(i+blurrdist)*fullw+blurrdist, ft.data+i*(ft.pitch), ft.w);
+    else
+      memset(full.data()+(i+blurrdist)*fullw+blurrdist, 255, ft.w);
+  }
+
+  int lw = (fullw + scale - 1) / scale;
+  int lh = (fullh + scale - 1) / scale;
+
+  uint8_t * outbuf_dat;
+  uint32_t outbuf_pitch;
+
+  std::tie(outbuf_dat, outbuf_pitch) = m(lw+frame, lh+frame, left, top);
+
+  if (outbuf_dat)
+  {
+    internal::gaussBlurDown(full.data(), fullw, fullw, fullh, blurr/64.0, outbuf_dat, outbuf_pitch);
+
+    return std::make_tuple(left, top, lw+frame, lh+frame, scale);
+  }
+  else
+  {
+    return std::make_tuple(0, 0, 0, 0, 0);
+  }
+}
+
+// Blurred rectangles are drawn from the image of a smaller rectangle: the columns of the image
+// of a rectangle that are further away than the reach of the blurr from its left and right edge
+// are all equal, the same goes for the rows. So the image of a wider rectangle is the image
+// of a rectangle that is at least 2 reaches plus 1 pixel wide with its middle column (width/2)
+// repeated, and the same for the height and the middle row (rows/2). When the blurr works at a
+// reduced resolution the number of repeated columns and rows is a multiple of the reduction
+// factor, so that the blocks of the reduced image line up with both edges in the same way.
+// This returns the key for the image of the smaller rectangle, w and h receive how many
+// times the middle column and row have to be repeated additionally
+inline GlyphKey_c rectSliceKey(const GlyphKey_c & k, int & w, int & h)
+{
+  GlyphKey_c s = k;
+
+  w = h = 0;
+
+  if (k.blurr == 0) return s;
+
+  int reach = gaussBlurrReach(k.blurr/64.0);
+  int step = gaussBlurrScale(k.blurr/64.0);
+  int reachw = reach;
+  int stepw = step;
+
+  if (k.sp == SUBP_RGB || k.sp == SUBP_BGR)
+  {
+    reachw *= 3;
+    stepw *= 3;
+  }
+
+  if (k.w > 2*reachw+1)
+  {
+    w = (k.w - (2*reachw+1)) / stepw * stepw;
+    s.w = k.w - w;
+  }
+
+  if (k.h > 2*reach+1)
+  {
+    h = (k.h - (2*reach+1)) / step * step;
+    s.h = k.h - h;
+  }
+
+  return s;
+}
+
 } }
 
 #endif
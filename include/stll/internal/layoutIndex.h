@@ -0,0 +1,79 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef STLL_LAYOUT_INDEX_H
+#define STLL_LAYOUT_INDEX_H
+
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace STLL {
+
+class CommandData_c;
+
+namespace internal {
+
+// a box in 1/64 pixels from x0, y0 to x1, y1 (excluding x1, y1)
+class CommandBox_c
+{
+  public:
+    int64_t x0, y0, x1, y1;
+};
+
+// a box that surely contains everything a command draws, for glyphs that
+// is the bounding box of the font enlarged by the blur radius
+CommandBox_c commandBox(const CommandData_c & i);
+
+// a spatial index over the drawing commands of a layout, used by the output
+// drivers to find the commands that are visible without looking at all commands
+//
+// Each command gets its box (see commandBox). The layout
+// is split into horizontal buckets and each bucket lists the commands whose box
+// touches it. Commands that are higher than a few buckets are kept in a separate
+// list to keep the buckets small.
+class LayoutIndex_c
+{
+  public:
+
+    LayoutIndex_c(const std::vector<CommandData_c> & data);
+
+    // find all commands whose box intersects the rectangle from x0, y0 to x1, y1 (excluding
+    // x1, y1) in 1/64 pixels, the indices are returned in increasing order
+    std::vector<size_t> find(int64_t x0, int64_t y0, int64_t x1, int64_t y1) const;
+
+  private:
+
+    std::vector<CommandBox_c> boxes;
+
+    // the upper edge of the first bucket and the height of the buckets in bits
+    int64_t top;
+    int shift;
+
+    std::vector<std::vector<uint32_t>> buckets;
+    std::vector<uint32_t> tall;
+};
+
+} }
+
+#endif
@@ -24,11 +24,69 @@
 
 #include <string>
 #include <memory>
+#include <vector>
+#include <array>
 
 #include <stdint.h>
 
 namespace STLL { namespace internal {
 
+/** \brief a compact set of unicode codepoints, used to quickly find out which characters
+ * are available within a font
+ *
+ * This is a two level bitmap: the unicode range is split into blocks of 256 codepoints and
+ * only blocks that actually contain at least one codepoint get a 256 bit leaf. All empty
+ * blocks point to the shared empty leaf 0, so a lookup never needs to check anything and is
+ * just 2 array accesses and a bit test.
+ */
+class CodepointCoverage_c
+{
+  private:
+    static const uint32_t blockBits = 8;
+    static const uint32_t numCodepoints = 0x110000;
+    static const uint32_t numBlocks = numCodepoints >> blockBits;
+
+    // for each block the index into the leaves, 0 is the empty leaf
+    std::vector<uint16_t> blocks;
+    // the bitmaps of the blocks, 4 times 64 bit for the 256 codepoints
+    std::vector<std::array<uint64_t, 4>> leaves;
+
+  public:
+
+    /** \brief create an empty set */
+    CodepointCoverage_c(void) : blocks(numBlocks, 0), leaves(1, std::array<uint64_t, 4>{{0, 0, 0, 0}}) {}
+
+    /** \brief add a codepoint to the set, codepoints outside of the unicode range are ignored */
+    void add(char32_t c)
+    {
+      if (c >= numCodepoints) return;
+
+      uint16_t & b = blocks[c >> blockBits];
+
+      if (b == 0)
+      {
+        b = leaves.size();
+        leaves.push_back(std::array<uint64_t, 4>{{0, 0, 0, 0}});
+      }
+
+      leaves[b][(c >> 6) & 3] |= (uint64_t)1 << (c & 63);
+    }
+
+    /** \brief check, if the codepoint is part of the set */
+    bool contains(char32_t c) const
+    {
+      if (c >= numCodepoints) return false;
+
+      return (leaves[blocks[c >> blockBits]][(c >> 6) & 3] >> (c & 63)) & 1;
+    }
+
+    /** \brief approximate number of bytes used by the set */
+    size_t memory(void) const
+    {
+      return blocks.size()*sizeof(uint16_t) + leaves.size()*sizeof(leaves[0]);
+    }
+};
+
 /** \brief encapsulate information for one font file
  */
 class FontFileResource_c
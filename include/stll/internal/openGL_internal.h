@@ -59,6 +59,40 @@ class openGL_internals
     void drawNormalGlyph(CreateInternal_c & vb, const CommandData_c & ii, const FontAtlasData_c & pos, Color_c c, int C) { }
 };
 
+// the pieces of a stretched blurred rectangle, see rectSliceKey: up to 3 columns and rows
+// with the middle one showing only the middle texel of the image, f is called for each piece
+// with its corners relative to the top left corner of the rectangle image in pixels and
+// its texture coordinates relative to the image in the atlas in texels
+template <class F>
+void smoothRectanglePieces(const FontAtlasData_c & pos, F f)
+{
+  // the borders of the pieces in one direction, the middle texel is sampled at its centre
+  // so that the filtering doesn't mix in its neighbours
+  auto split = [&pos](uint32_t size, uint32_t mid, uint32_t extra, float * p, float * t) -> int
+  {
+    if (extra == 0)
+    {
+      p[0] = 0; p[1] = size*pos.scale;
+      t[0] = 0; t[1] = size;
+      return 1;
+    }
+
+    p[0] = 0; p[1] = mid*pos.scale; p[2] = (mid+1)*pos.scale + extra; p[3] = size*pos.scale + extra;
+    t[0] = 0; t[1] = mid + 0.5;     t[2] = mid + 0.5;                 t[3] = size;
+    return 3;
+  };
+
+  float x[4], y[4], u[4], v[4];
+
+  int nx = split(pos.width, pos.midx, pos.extraw, x, u);
+  int ny = split(pos.rows, pos.midy, pos.extrah, y, v);
+
+  for (int j = 0; j < ny; j++)
+    for (int i = 0; i < nx; i++)
+      if (x[i] < x[i+1] && y[j] < y[j+1])
+        f(x[i], x[i+1], y[j], y[j+1], u[i], u[i+1], v[j], v[j+1]);
+}
+
 
 template <>
 class openGL_internals<1>
@@ -67,7 +101,8 @@ class openGL_internals<1>
     // Helper function to draw one glyph or one sub pixel color of one glyph
     void drawGlyph(const CommandData_c & i, int subpcol, const FontAtlasData_c & pos, Color_c c, int C)
     {
-      double w = pos.width-1;
+      double w = (pos.width-1)*pos.scale;
+      double h = (pos.rows-1)*pos.scale;
       double wo = 0;
 
       if (subpcol > 0)
@@ -78,10 +113,10 @@ class openGL_internals<1>
 
       glBegin(GL_QUADS);
       glColor3f(c.r()/255.0, c.g()/255.0, c.b()/255.0);
-      glTexCoord2f(1.0*(pos.pos_x+wo)/C,             1.0*(pos.pos_y)/C);            glVertex3f(i.x/64.0+pos.left,   (i.y+32)/64-pos.top,            0);
-      glTexCoord2f(1.0*(pos.pos_x+wo+pos.width-1)/C, 1.0*(pos.pos_y)/C);            glVertex3f(i.x/64.0+pos.left+w, (i.y+32)/64-pos.top,            0);
-      glTexCoord2f(1.0*(pos.pos_x+wo+pos.width-1)/C, 1.0*(pos.pos_y+pos.rows-1)/C); glVertex3f(i.x/64.0+pos.left+w, (i.y+32)/64-pos.top+pos.rows-1, 0);
-      glTexCoord2f(1.0*(pos.pos_x+wo)/C,             1.0*(pos.pos_y+pos.rows-1)/C); glVertex3f(i.x/64.0+pos.left,   (i.y+32)/64-pos.top+pos.rows-1, 0);
+      glTexCoord2f(1.0*(pos.pos_x+wo)/C,             1.0*(pos.pos_y)/C);            glVertex3f(i.x/64.0+pos.left,   (i.y+32)/64-pos.top,   0);
+      glTexCoord2f(1.0*(pos.pos_x+wo+pos.width-1)/C, 1.0*(pos.pos_y)/C);            glVertex3f(i.x/64.0+pos.left+w, (i.y+32)/64-pos.top,   0);
+      glTexCoord2f(1.0*(pos.pos_x+wo+pos.width-1)/C, 1.0*(pos.pos_y+pos.rows-1)/C); glVertex3f(i.x/64.0+pos.left+w, (i.y+32)/64-pos.top+h, 0);
+      glTexCoord2f(1.0*(pos.pos_x+wo)/C,             1.0*(pos.pos_y+pos.rows-1)/C); glVertex3f(i.x/64.0+pos.left,   (i.y+32)/64-pos.top+h, 0);
       glEnd();
     }
 
@@ -210,12 +245,32 @@ class openGL_internals<1>
 
     void drawSmoothRectangle(CreateInternal_c & /*vb*/, const CommandData_c & ii, const FontAtlasData_c & pos, Color_c c, int C)
     {
+      double w = (pos.width-1)*pos.scale;
+      double h = (pos.rows-1)*pos.scale;
+
       glBegin(GL_QUADS);
       glColor3f(c.r()/255.0, c.g()/255.0, c.b()/255.0);
-      glTexCoord2f(1.0*(pos.pos_x)/C,             1.0*(pos.pos_y)/C);            glVertex3f(ii.x/64.0+pos.left,             (ii.y+32)/64-pos.top,            0);
-      glTexCoord2f(1.0*(pos.pos_x+pos.width-1)/C, 1.0*(pos.pos_y)/C);            glVertex3f(ii.x/64.0+pos.left+pos.width-1, (ii.y+32)/64-pos.top,            0);
-      glTexCoord2f(1.0*(pos.pos_x+pos.width-1)/C, 1.0*(pos.pos_y+pos.rows-1)/C); glVertex3f(ii.x/64.0+pos.left+pos.width-1, (ii.y+32)/64-pos.top+pos.rows-1, 0);
-      glTexCoord2f(1.0*(pos.pos_x)/C,             1.0*(pos.pos_y+pos.rows-1)/C); glVertex3f(ii.x/64.0+pos.left,             (ii.y+32)/64-pos.top+pos.rows-1, 0);
+
+      if (pos.extraw || pos.extrah)
+      {
+        double x = ii.x/64.0+pos.left;
+        double y = (ii.y+32)/64-pos.top;
+
+        smoothRectanglePieces(pos, [&](float x0, float x1, float y0, float y1, float u0, float u1, float v0, float v1) {
+          glTexCoord2f((pos.pos_x+u0)/C, (pos.pos_y+v0)/C); glVertex3f(x+x0, y+y0, 0);
+          glTexCoord2f((pos.pos_x+u1)/C, (pos.pos_y+v0)/C); glVertex3f(x+x1, y+y0, 0);
+          glTexCoord2f((pos.pos_x+u1)/C, (pos.pos_y+v1)/C); glVertex3f(x+x1, y+y1, 0);
+          glTexCoord2f((pos.pos_x+u0)/C, (pos.pos_y+v1)/C); glVertex3f(x+x0, y+y1, 0);
+        });
+
+        glEnd();
+        return;
+      }
+
+      glTexCoord2f(1.0*(pos.pos_x)/C,             1.0*(pos.pos_y)/C);            glVertex3f(ii.x/64.0+pos.left,   (ii.y+32)/64-pos.top,   0);
+      glTexCoord2f(1.0*(pos.pos_x+pos.width-1)/C, 1.0*(pos.pos_y)/C);            glVertex3f(ii.x/64.0+pos.left+w, (ii.y+32)/64-pos.top,   0);
+      glTexCoord2f(1.0*(pos.pos_x+pos.width-1)/C, 1.0*(pos.pos_y+pos.rows-1)/C); glVertex3f(ii.x/64.0+pos.left+w, (ii.y+32)/64-pos.top+h, 0);
+      glTexCoord2f(1.0*(pos.pos_x)/C,             1.0*(pos.pos_y+pos.rows-1)/C); glVertex3f(ii.x/64.0+pos.left,   (ii.y+32)/64-pos.top+h, 0);
       glEnd();
     }
 
@@ -461,18 +516,39 @@ class openGL_internals<2>
 
     void drawSmoothRectangle(CreateInternal_c & vb, const CommandData_c & ii, const FontAtlasData_c & pos, Color_c c, int C)
     {
-      vb.vb.push_back(vertex((ii.x+32)/64+pos.left,           (ii.y+32)/64-pos.top,         1.0*(pos.pos_x)/C,           1.0*(pos.pos_y)/C,          c));
-      vb.vb.push_back(vertex((ii.x+32)/64+pos.left+pos.width, (ii.y+32)/64-pos.top,         1.0*(pos.pos_x+pos.width)/C, 1.0*(pos.pos_y)/C,          c));
-      vb.vb.push_back(vertex((ii.x+32)/64+pos.left+pos.width, (ii.y+32)/64-pos.top+pos.rows,1.0*(pos.pos_x+pos.width)/C, 1.0*(pos.pos_y+pos.rows)/C, c));
-      vb.vb.push_back(vertex((ii.x+32)/64+pos.left,           (ii.y+32)/64-pos.top+pos.rows,1.0*(pos.pos_x)/C,           1.0*(pos.pos_y+pos.rows)/C, c));
+      if (pos.extraw || pos.extrah)
+      {
+        int x = (ii.x+32)/64+pos.left;
+        int y = (ii.y+32)/64-pos.top;
+
+        smoothRectanglePieces(pos, [&](float x0, float x1, float y0, float y1, float u0, float u1, float v0, float v1) {
+          vb.vb.push_back(vertex(x+x0, y+y0, (pos.pos_x+u0)/C, (pos.pos_y+v0)/C, c));
+          vb.vb.push_back(vertex(x+x1, y+y0, (pos.pos_x+u1)/C, (pos.pos_y+v0)/C, c));
+          vb.vb.push_back(vertex(x+x1, y+y1, (pos.pos_x+u1)/C, (pos.pos_y+v1)/C, c));
+          vb.vb.push_back(vertex(x+x0, y+y1, (pos.pos_x+u0)/C, (pos.pos_y+v1)/C, c));
+        });
+
+        return;
+      }
+
+      int w = pos.width*pos.scale;
+      int h = pos.rows*pos.scale;
+
+      vb.vb.push_back(vertex((ii.x+32)/64+pos.left,   (ii.y+32)/64-pos.top,   1.0*(pos.pos_x)/C,           1.0*(pos.pos_y)/C,          c));
+      vb.vb.push_back(vertex((ii.x+32)/64+pos.left+w, (ii.y+32)/64-pos.top,   1.0*(pos.pos_x+pos.width)/C, 1.0*(pos.pos_y)/C,          c));
+      vb.vb.push_back(vertex((ii.x+32)/64+pos.left+w, (ii.y+32)/64-pos.top+h, 1.0*(pos.pos_x+pos.width)/C, 1.0*(pos.pos_y+pos.rows)/C, c));
+      vb.vb.push_back(vertex((ii.x+32)/64+pos.left,   (ii.y+32)/64-pos.top+h, 1.0*(pos.pos_x)/C,           1.0*(pos.pos_y+pos.rows)/C, c));
     }
 
     void drawNormalGlyph(CreateInternal_c & vb, const CommandData_c & ii, const FontAtlasData_c & pos, Color_c c, int C)
     {
-      vb.vb.push_back(vertex((ii.x)/64.0+pos.left,           (ii.y+32)/64-pos.top,         1.0*(pos.pos_x)/C,           1.0*(pos.pos_y)/C,          c));
-      vb.vb.push_back(vertex((ii.x)/64.0+pos.left+pos.width, (ii.y+32)/64-pos.top,         1.0*(pos.pos_x+pos.width)/C, 1.0*(pos.pos_y)/C,          c));
-      vb.vb.push_back(vertex((ii.x)/64.0+pos.left+pos.width, (ii.y+32)/64-pos.top+pos.rows,1.0*(pos.pos_x+pos.width)/C, 1.0*(pos.pos_y+pos.rows)/C, c));
-      vb.vb.push_back(vertex((ii.x)/64.0+pos.left,           (ii.y+32)/64-pos.top+pos.rows,1.0*(pos.pos_x)/C,           1.0*(pos.pos_y+pos.rows)/C, c));
+      int w = pos.width*pos.scale;
+      int h = pos.rows*pos.scale;
+
+      vb.vb.push_back(vertex((ii.x)/64.0+pos.left,   (ii.y+32)/64-pos.top,   1.0*(pos.pos_x)/C,           1.0*(pos.pos_y)/C,          c));
+      vb.vb.push_back(vertex((ii.x)/64.0+pos.left+w, (ii.y+32)/64-pos.top,   1.0*(pos.pos_x+pos.width)/C, 1.0*(pos.pos_y)/C,          c));
+      vb.vb.push_back(vertex((ii.x)/64.0+pos.left+w, (ii.y+32)/64-pos.top+h, 1.0*(pos.pos_x+pos.width)/C, 1.0*(pos.pos_y+pos.rows)/C, c));
+      vb.vb.push_back(vertex((ii.x)/64.0+pos.left,   (ii.y+32)/64-pos.top+h, 1.0*(pos.pos_x)/C,           1.0*(pos.pos_y+pos.rows)/C, c));
     }
 
     void drawSubpGlyph(CreateInternal_c & vb, SubPixelArrangement /*sp*/, const CommandData_c & ii, const FontAtlasData_c & pos, Color_c c, int C)
@@ -723,8 +799,26 @@ class openGL_internals<3>
     void drawSmoothRectangle(CreateInternal_c & vb, const CommandData_c & ii, const FontAtlasData_c & pos, Color_c c, int C)
     {
       std::array<float, 8> data;
-      data[0] = (ii.x+32)/64+pos.left; data[1] = (ii.x+32)/64+pos.left+pos.width;
-      data[2] = (ii.y+32)/64-pos.top;  data[3] = (ii.y+32)/64-pos.top+pos.rows;
+
+      if (pos.extraw || pos.extrah)
+      {
+        int x = (ii.x+32)/64+pos.left;
+        int y = (ii.y+32)/64-pos.top;
+
+        smoothRectanglePieces(pos, [&](float x0, float x1, float y0, float y1, float u0, float u1, float v0, float v1) {
+          data[0] = x+x0;                  data[1] = x+x1;
+          data[2] = y+y0;                  data[3] = y+y1;
+          data[4] = (pos.pos_x+u0)/C;      data[5] = (pos.pos_x+u1)/C;
+          data[6] = (pos.pos_y+v0)/C;      data[7] = (pos.pos_y+v1)/C;
+
+          addQuad(vb, data, c, 1);
+        });
+
+        return;
+      }
+
+      data[0] = (ii.x+32)/64+pos.left; data[1] = (ii.x+32)/64+pos.left+pos.width*pos.scale;
+      data[2] = (ii.y+32)/64-pos.top;  data[3] = (ii.y+32)/64-pos.top+pos.rows*pos.scale;
       data[4] = 1.0*(pos.pos_x)/C;     data[5] = 1.0*(pos.pos_x+pos.width)/C;
       data[6] = 1.0*(pos.pos_y)/C;     data[7] = 1.0*(pos.pos_y+pos.rows)/C;
 
@@ -734,8 +828,8 @@ class openGL_internals<3>
     void drawNormalGlyph(CreateInternal_c & vb, const CommandData_c & ii, const FontAtlasData_c & pos, Color_c c, int C)
     {
       std::array<float, 8> data;
-      data[0] = (ii.x)/64.0+pos.left; data[1] = (ii.x)/64.0+pos.left+pos.width;
-      data[2] = (ii.y+32)/64-pos.top; data[3] = (ii.y+32)/64-pos.top+pos.rows;
+      data[0] = (ii.x)/64.0+pos.left; data[1] = (ii.x)/64.0+pos.left+pos.width*pos.scale;
+      data[2] = (ii.y+32)/64-pos.top; data[3] = (ii.y+32)/64-pos.top+pos.rows*pos.scale;
       data[4] = 1.0*(pos.pos_x)/C;    data[5] = 1.0*(pos.pos_x+pos.width)/C;
       data[6] = 1.0*(pos.pos_y)/C;    data[7] = 1.0*(pos.pos_y+pos.rows)/C;
 
@@ -0,0 +1,132 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef STLL_PIXEL_FORMATS_H
+#define STLL_PIXEL_FORMATS_H
+
+#include <tuple>
+#include <utility>
+
+#include <stdint.h>
+
+// pixel accessors for the blitters in blitter.h. Each class provides the number of bytes per
+// pixel, a get function returning the red, green and blue value of a pixel and a put function
+// writing them. As they are template arguments of the output functions the accesses are inlined,
+// contrary to the generic functions of the output drivers that have to interpret a format description
+// for each pixel
+
+namespace STLL { namespace internal {
+
+// pixels of 3 or 4 bytes with one byte for each channel, R, G and B are the byte positions
+// of the channels within the pixel in memory, other bytes (e.g. alpha) are not touched
+template <int BPP, int R, int G, int B>
+class PixelBytes_c
+{
+  public:
+    static const int bytes = BPP;
+
+    std::tuple<uint8_t, uint8_t, uint8_t> get(const uint8_t * p) const
+    {
+      return std::make_tuple(p[R], p[G], p[B]);
+    }
+
+    void put(uint8_t * p, uint8_t r, uint8_t g, uint8_t b) const
+    {
+      p[R] = r;
+      p[G] = g;
+      p[B] = b;
+    }
+};
+
+// 16 bit pixels with 5 bits red, 6 bits green and 5 bits blue, from the most significant bit
+// down, in native byte order, when BGR is true red and blue are swapped, when reading the values
+// are expanded to the full 8 bit range
+template <bool BGR>
+class Pixel565_c
+{
+  public:
+    static const int bytes = 2;
+
+    std::tuple<uint8_t, uint8_t, uint8_t> get(const uint8_t * p) const
+    {
+      uint16_t v = *(const uint16_t *)p;
+
+      uint8_t hi = ((v >> 11) << 3) | (v >> 13);
+      uint8_t g = (((v >> 5) & 0x3F) << 2) | ((v >> 9) & 0x3);
+      uint8_t lo = ((v & 0x1F) << 3) | ((v >> 2) & 0x7);
+
+      if (BGR)
+        return std::make_tuple(lo, g, hi);
+      else
+        return std::make_tuple(hi, g, lo);
+    }
+
+    void put(uint8_t * p, uint8_t r, uint8_t g, uint8_t b) const
+    {
+      if (BGR) std::swap(r, b);
+
+      *(uint16_t *)p = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+    }
+};
+
+// pixels of 1 byte containing a coverage, the coverage is in all 3 channels when reading,
+// only the first one is written
+class PixelA8_c
+{
+  public:
+    static const int bytes = 1;
+
+    std::tuple<uint8_t, uint8_t, uint8_t> get(const uint8_t * p) const
+    {
+      return std::make_tuple(p[0], p[0], p[0]);
+    }
+
+    void put(uint8_t * p, uint8_t a, uint8_t, uint8_t) const
+    {
+      p[0] = a;
+    }
+};
+
+// the formats that the output drivers support directly, the names are those of the SDL pixel
+// formats, they give the order of the channels within the pixel value from the most significant
+// byte down, so the position in memory depends on the byte order
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+typedef PixelBytes_c<4, 1, 2, 3> PixelXRGB8888_t;
+typedef PixelBytes_c<4, 0, 1, 2> PixelRGBA8888_t;
+typedef PixelBytes_c<4, 3, 2, 1> PixelABGR8888_t;
+typedef PixelBytes_c<4, 2, 1, 0> PixelBGRA8888_t;
+typedef PixelBytes_c<3, 0, 1, 2> PixelRGB888_t;
+typedef PixelBytes_c<3, 2, 1, 0> PixelBGR888_t;
+#else
+typedef PixelBytes_c<4, 2, 1, 0> PixelXRGB8888_t;
+typedef PixelBytes_c<4, 3, 2, 1> PixelRGBA8888_t;
+typedef PixelBytes_c<4, 0, 1, 2> PixelABGR8888_t;
+typedef PixelBytes_c<4, 1, 2, 3> PixelBGRA8888_t;
+typedef PixelBytes_c<3, 2, 1, 0> PixelRGB888_t;
+typedef PixelBytes_c<3, 0, 1, 2> PixelBGR888_t;
+#endif
+typedef Pixel565_c<false> PixelRGB565_t;
+typedef Pixel565_c<true> PixelBGR565_t;
+
+} }
+
+#endif
@@ -23,31 +23,52 @@
 #define STLL_RECTANGLE_PACKER_H
 
 #include <vector>
+#include <set>
+#include <cstdint>
 #include <array>
 #include <experimental/optional>
 
 namespace STLL { namespace internal {
 
 // a class that handles free storage allocation on a two dimensional plane
+//
+// the occupied area is described by a skyline: a sequence of horizontal segments, each
+// one starting at x and going until the start of the next segment, below y everything
+// is free. The segments are kept in a list ordered by x to walk along the skyline and
+// in a set ordered by y to try the lowest segments first, a new rectangle goes to the
+// lowest position found, so the search stops as soon as the segments are not lower than that
 class RectanglePacker_c
 {
   private:
     // area to be filled
     int width_, height_;
 
+    // the skyline, a list of segments ordered by x, the last segment finalizes
+    // the list and blocks everything behind it, the segments are stored in a vector,
+    // prev and next are indices into it, so that the list can be changed in place
     typedef struct
     {
       int x; // x-position start of this skyline section
       int y; // y-position start of this skyline section
       // the end is defined by the start of the next section
-      // there is always a last section finalizing the list
+      uint32_t prev, next;
     } skyline;
 
-    // the skyline
+    static const uint32_t none = UINT32_MAX;
+
     std::vector<skyline> skylines;
-    std::vector<skyline> skylines_shadow;
+    std::vector<uint32_t> unused;
+
+    // the same segments ordered by y and then x, with their index
+    std::set<std::array<int, 3>> lowest;
 
-    int checkFit(size_t index, int w);
+    uint32_t addSegment(int x, int y, uint32_t after);
+    void removeSegment(uint32_t i);
+    void setHeight(uint32_t i, int y);
+
+    // the y position a rectangle of width w gets when placed at the start of
+    // segment i, or limit when it would be at limit or lower
+    int checkFit(uint32_t i, int w, int limit) const;
 
   public:
 
@@ -63,6 +84,10 @@ class RectanglePacker_c
     // release all occupied area
     void clear(void);
 
+    // enlarge the area to the given size, the occupied area stays where it is, the
+    // sizes must not be smaller than the current ones, so width or height alone can grow
+    void grow(int width, int height);
+
     void doubleSize(void);
 };
 
@@ -0,0 +1,143 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef STLL_SHADOW_LAYERS_H
+#define STLL_SHADOW_LAYERS_H
+
+#include "glyphCache.h"
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace STLL {
+
+class TextLayout_c;
+
+namespace internal {
+
+// a run of blurred commands with the same colour and blurr radius that directly follow
+// each other within the layout, the layouter creates such a run for each shadow of a line
+class ShadowGroup_c
+{
+  public:
+    size_t first, last;         // the positions within the list of commands to draw, excluding last
+    size_t dataFirst, dataLast; // the complete run within the layout, excluding dataLast
+    const PaintData_c * image;  // the blurred image, positioned at the command dataFirst
+};
+
+// the shadows of lines drawn as one image: all commands of a group are drawn without blurr
+// into a coverage mask, which is then blurred once. This is a lot faster than blurring
+// each glyph on its own and overlapping glyphs don't add up their shadows.
+//
+// The images are kept in a cache with a budget in bytes, the key is the content of the group
+// relative to its first command, so the same line at a different position uses the same image.
+// The images of the least recently used groups are removed by trim, the pointers returned by
+// getImage stay valid until then or until the font of one of the glyphs is removed.
+class ShadowLayers_c : boost::noncopyable
+{
+  public:
+
+    static const size_t defaultBudget = 8*1024*1024;
+
+    // groups with images bigger than this are drawn glyph by glyph
+    static const size_t maxPixels = 4*1024*1024;
+
+    // find the groups of at least 2 commands within the commands with the indices in cmds,
+    // the groups are extended to the commands of the layout that are not in cmds, so that
+    // a partially visible line gets the same group
+    static std::vector<ShadowGroup_c> findGroups(const TextLayout_c & l, const std::vector<size_t> & cmds);
+
+    // get the image for the commands dataFirst to dataLast of the layout, the glyphs are
+    // taken from cache, returns nullptr when the image would be too big
+    const PaintData_c * getImage(const TextLayout_c & l, size_t dataFirst, size_t dataLast, GlyphCache_c & cache);
+
+    // remove the least recently used images until the cache is within the budget
+    void trim(void);
+
+    // remove all images containing glyphs of the given font face, see showSDL::removeFontFace
+    void removeFont(const FontFace_c * face);
+
+    void setBudget(size_t bytes) { budget = bytes; trim(); }
+    size_t getBudget(void) const { return budget; }
+
+    // number of bytes used by the images
+    size_t memory(void) const { return bytes; }
+
+  private:
+
+    // one command of a group relative to the first command
+    class Item_c
+    {
+      public:
+        intptr_t font;
+        uint32_t glyph;
+        int32_t x, y, w, h;
+        uint8_t command;
+
+        bool operator==(const Item_c & b) const
+        {
+          return font == b.font && glyph == b.glyph && x == b.x && y == b.y && w == b.w && h == b.h && command == b.command;
+        }
+    };
+
+    class Key_c
+    {
+      public:
+        uint16_t blurr;
+        std::vector<Item_c> items;
+
+        bool operator==(const Key_c & b) const { return blurr == b.blurr && items == b.items; }
+    };
+
+    class KeyHash_c
+    {
+      public:
+        size_t operator()(const Key_c & k) const;
+    };
+
+    class Entry_c
+    {
+      public:
+        std::unique_ptr<PaintData_c> image;
+        std::list<const Key_c *>::iterator use;
+    };
+
+    // the images, must be destroyed after the map
+    SlabAllocator_c slab;
+
+    std::unordered_map<Key_c, Entry_c, KeyHash_c> images;
+
+    // the keys of the images, the most recently used first
+    std::list<const Key_c *> lru;
+
+    size_t budget = defaultBudget;
+    size_t bytes = 0;
+};
+
+} }
+
+#endif
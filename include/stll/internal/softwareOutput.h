@@ -0,0 +1,304 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#ifndef STLL_SOFTWARE_OUTPUT_H
+#define STLL_SOFTWARE_OUTPUT_H
+
+#include "drawList.h"
+#include "blitter.h"
+#include "blitter_simd.h"
+#include "pixelFormats.h"
+#include "dividers.h"
+
+#include "../color.h"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+
+#include <stdint.h>
+#include <stddef.h>
+
+// the parts of the software renderers (showSDL and showMemory) that don't depend on the
+// kind of target: the output of glyph images with a pixel accessor (see pixelFormats.h)
+// and the output of a draw list in horizontal bands using several threads
+
+namespace STLL { namespace internal {
+
+// a clip rectangle in pixels
+class Clip_c
+{
+  public:
+    int x, y, w, h;
+};
+
+// the pixels to draw into
+class Target_c
+{
+  public:
+    uint8_t * pixels; // the first byte of the top left pixel
+    int pitch;        // number of bytes from the start of one row to the start of the next
+    int bpp;          // number of bytes per pixel
+    int w, h;         // size in pixels
+};
+
+// the clip rectangle cl limited to the rows from top to bottom (excluding bottom)
+inline Clip_c bandClip(const Clip_c & cl, int top, int bottom)
+{
+  int64_t t = std::max<int64_t>(cl.y, top);
+  int64_t b = std::min<int64_t>((int64_t)cl.y + cl.h, bottom);
+
+  return Clip_c { cl.x, (int)t, cl.w, (int)std::max<int64_t>(0, b - t) };
+}
+
+// the height of the bands when a target with h rows is drawn by t threads, there are several
+// bands per thread, so that unevenly distributed text doesn't leave threads idle, but not too
+// thin ones, a single thread draws everything in one band
+inline int bandHeight(int h, size_t t)
+{
+  const int minBandHeight = 16;
+  return (t > 1) ? std::max<int>(minBandHeight, (h + 4*t - 1) / (4*t)) : h;
+}
+
+// call f with the index of each of the bands using up to t threads, including the calling one
+template <class F>
+void forBands(size_t bands, size_t t, const F & f)
+{
+  std::atomic<size_t> next(0);
+
+  auto worker = [&]()
+  {
+    size_t b;
+
+    while ((b = next++) < bands)
+      f(b);
+  };
+
+  std::vector<std::thread> th;
+
+  for (size_t i = 1; i < std::min(t, bands); i++)
+    th.emplace_back(worker);
+
+  worker();
+
+  for (auto & i : th)
+    i.join();
+}
+
+// accelerated output for targets with the byte order B, G, R, X, it is used when the
+// gamma class provides its lookup tables and the glyph is large enough
+template <class G>
+bool outputGlyphXRGB(int sx, int sy, const PaintData_c & img, SubPixelArrangement sp, Color_c c,
+                     const Target_c & s, const Clip_c & cl, const G & g, std::true_type)
+{
+  if (!useAcceleratedBlitter(img, sp != SUBP_NONE)) return false;
+
+  GammaTables_c t { g.forwardTable(), g.inverseTable(), g.scale() };
+
+  switch (sp)
+  {
+    default:
+    case SUBP_NONE:
+      outputGlyph_NONE_XRGB(sx, sy, img, c, s.pixels, s.pitch, s.w, s.h, t, cl.x, cl.y, cl.w, cl.h);
+      break;
+    case SUBP_RGB:
+      outputGlyph_HorizontalRGB_XRGB(sx, sy, img, c.r(), c.g(), c.b(), c.a(), false,
+                                     s.pixels, s.pitch, s.w, s.h, t, cl.x, cl.y, cl.w, cl.h);
+      break;
+    case SUBP_BGR:
+      outputGlyph_HorizontalRGB_XRGB(sx, sy, img, c.b(), c.g(), c.r(), c.a(), true,
+                                     s.pixels, s.pitch, s.w, s.h, t, cl.x, cl.y, cl.w, cl.h);
+      break;
+  }
+
+  return true;
+}
+
+template <class G>
+bool outputGlyphXRGB(int, int, const PaintData_c &, SubPixelArrangement, Color_c, const Target_c &,
+                     const Clip_c &, const G &, std::false_type)
+{
+  return false;
+}
+
+// output a glyph image with the colour c (already converted with the gamma g) using the pixel
+// accessor px for the target, clipped to cl
+template <class P, class G>
+void outputGlyph(int sx, int sy, const PaintData_c & img, SubPixelArrangement sp, Color_c c,
+                 const Target_c & s, const Clip_c & cl, const P & px, const G & g)
+{
+  auto get = [&px](const uint8_t * p) -> auto { return px.get(p); };
+  auto put = [&px](uint8_t * p, uint8_t r, uint8_t g, uint8_t b) -> void { px.put(p, r, g, b); };
+  auto bl = [&g](int a1, int a2, int b1, int b2, int c) -> auto { return blend(a1, a2, b1, b2, c, g); };
+
+  switch (sp)
+  {
+    default:
+    case SUBP_NONE:
+      outputGlyph_NONE(sx, sy, img, c, s.pixels, s.pitch, s.bpp, s.w, s.h, get, put, bl, cl.x, cl.y, cl.w, cl.h);
+      break;
+    case SUBP_RGB:
+      outputGlyph_HorizontalRGB(sx, sy, img, c.r(), c.g(), c.b(), c.a(), s.pixels, s.pitch, s.bpp, s.w, s.h,
+                                get, put, bl, cl.x, cl.y, cl.w, cl.h);
+      break;
+    case SUBP_BGR:
+      outputGlyph_HorizontalRGB(sx, sy, img, c.b(), c.g(), c.r(), c.a(), s.pixels, s.pitch, s.bpp, s.w, s.h,
+        [&px](const uint8_t * p) -> auto { auto t = px.get(p); return std::make_tuple(std::get<2>(t), std::get<1>(t), std::get<0>(t)); },
+        [&px](uint8_t * p, uint8_t sp1, uint8_t sp2, uint8_t sp3) -> void { px.put(p, sp3, sp2, sp1); },
+        bl, cl.x, cl.y, cl.w, cl.h);
+      break;
+  }
+}
+
+template <class G>
+void outputGlyph(int sx, int sy, const PaintData_c & img, SubPixelArrangement sp, Color_c c,
+                 const Target_c & s, const Clip_c & cl, const PixelXRGB8888_t & px, const G & g)
+{
+  if (!outputGlyphXRGB(sx, sy, img, sp, c, s, cl, g, HasGammaTables_c<G>()))
+    outputGlyph<PixelXRGB8888_t, G>(sx, sy, img, sp, c, s, cl, px, g);
+}
+
+// coverage is combined without gamma, like the coverage masks
+template <class G>
+void outputGlyph(int sx, int sy, const PaintData_c & img, SubPixelArrangement, Color_c c,
+                 const Target_c & s, const Clip_c & cl, const PixelA8_c & px, const G &)
+{
+  auto get = [&px](const uint8_t * p) -> auto { return px.get(p); };
+  auto put = [&px](uint8_t * p, uint8_t r, uint8_t g, uint8_t b) -> void { px.put(p, r, g, b); };
+  auto cover = [](int a1, int, int b1, int b2, int c) -> int
+  {
+    int b = b1 + (b2-b1)*c/64;
+    return a1 + (255-a1)*b/(255*255);
+  };
+
+  outputGlyph_NONE(sx, sy, img, c, s.pixels, s.pitch, 1, s.w, s.h, get, put, cover, cl.x, cl.y, cl.w, cl.h);
+}
+
+// output an image that may be stretched, the stretched image is created in strips
+// only for the rows within the clip rectangle
+template <class P, class G>
+void outputGlyph(int sx, int sy, const SlicedImage_c & img, SubPixelArrangement sp, Color_c c,
+                 const Target_c & s, const Clip_c & cl, const P & px, const G & g)
+{
+  if (!img.stretched())
+  {
+    outputGlyph(sx, sy, *img.image, sp, c, s, cl, px, g);
+    return;
+  }
+
+  int64_t y = div_inf(sy+32, 64) - img.image->top;
+  int64_t top = std::max(cl.y, 0);
+  int64_t bottom = std::min<int64_t>((int64_t)cl.y + cl.h, s.h);
+
+  img.strips(std::max<int64_t>(top - y, 0), std::min<int64_t>(bottom - y, img.rows()),
+    [&](const PaintData_c & strip) { outputGlyph(sx, sy, strip, sp, c, s, cl, px, g); });
+}
+
+// fill an unblurred rectangle of a draw list clipped to cl, the colour is written without blending
+template <class P>
+void fillRect(const DrawList_c::Item_c & i, Color_c c, int sx, int sy, const Target_c & s, const Clip_c & cl, const P & px)
+{
+  int64_t x0 = std::max<int64_t>({ ((int64_t)i.x+sx+32)/64, cl.x, 0 });
+  int64_t y0 = std::max<int64_t>({ ((int64_t)i.y+sy+32)/64, cl.y, 0 });
+  int64_t x1 = std::min<int64_t>({ ((int64_t)i.x+sx+i.w+32)/64, (int64_t)cl.x + cl.w, s.w });
+  int64_t y1 = std::min<int64_t>({ ((int64_t)i.y+sy+i.h+32)/64, (int64_t)cl.y + cl.h, s.h });
+
+  for (int64_t y = y0; y < y1; y++)
+    for (int64_t x = x0; x < x1; x++)
+      px.put(s.pixels + y*s.pitch + x*s.bpp, c.r(), c.g(), c.b());
+}
+
+// coverage targets are filled completely
+inline void fillRect(const DrawList_c::Item_c & i, Color_c, int sx, int sy, const Target_c & s, const Clip_c & cl, const PixelA8_c &)
+{
+  int64_t x0 = std::max<int64_t>({ ((int64_t)i.x+sx+32)/64, cl.x, 0 });
+  int64_t y0 = std::max<int64_t>({ ((int64_t)i.y+sy+32)/64, cl.y, 0 });
+  int64_t x1 = std::min<int64_t>({ ((int64_t)i.x+sx+i.w+32)/64, (int64_t)cl.x + cl.w, s.w });
+  int64_t y1 = std::min<int64_t>({ ((int64_t)i.y+sy+i.h+32)/64, (int64_t)cl.y + cl.h, s.h });
+
+  for (int64_t y = y0; y < y1 && x0 < x1; y++)
+    std::fill(s.pixels + y*s.pitch + x0, s.pixels + y*s.pitch + x1, 255);
+}
+
+// the colour to draw the glyphs of a run with, coverage doesn't use the gamma
+template <class P>
+Color_c runColour(const DrawList_c::Run_c & r, const P &) { return r.fc; }
+inline Color_c runColour(const DrawList_c::Run_c & r, const PixelA8_c &) { return r.c; }
+
+// the output of a draw list with the pixel accessor px using t threads: the target is split
+// into horizontal bands, each item is added to all bands it touches keeping the order of the
+// items and the bands are drawn in parallel, each with the clip rectangle limited to the band.
+// As a pixel only depends on the items that draw into it and their order the result is the
+// same as when drawing everything at once. The unblurred rectangles are drawn by calling
+// fill(item, colour, clip), the images of the application are not drawn
+template <class P, class G, class F>
+void showListBanded(const DrawList_c & dl, int sx, int sy, const Target_c & s, const Clip_c & clip,
+                    SubPixelArrangement sp, size_t t, const P & px, const G & g, const F & fill)
+{
+  auto & runs = dl.getRuns();
+  auto & items = dl.getItems();
+
+  int bh = bandHeight(s.h, t);
+
+  // the bands contain the indices of the runs and items
+  std::vector<std::vector<std::pair<uint32_t, uint32_t>>> bands((s.h + bh - 1) / bh);
+
+  for (uint32_t r = 0; r < runs.size(); r++)
+  {
+    if (runs[r].kind == DrawList_c::RUN_IMAGES) continue;
+
+    for (uint32_t n = runs[r].first; n < runs[r].last; n++)
+    {
+      auto rows = DrawList_c::rows(runs[r], items[n], sy);
+
+      int y0 = std::max(rows.first, 0);
+      int y1 = std::min(rows.second, s.h);
+
+      for (int b = y0 / bh; y0 < y1 && b <= (y1-1) / bh; b++)
+        bands[b].push_back(std::make_pair(r, n));
+    }
+  }
+
+  forBands(bands.size(), t, [&](size_t b)
+  {
+    Clip_c cl = bandClip(clip, b * bh, (b+1) * bh);
+
+    if (cl.h == 0) return;
+
+    for (auto & e : bands[b])
+    {
+      auto & r = runs[e.first];
+      auto & i = items[e.second];
+
+      if (r.kind == DrawList_c::RUN_GLYPHS)
+        outputGlyph(sx+i.x, sy+i.y, i.img, sp, runColour(r, px), s, cl, px, g);
+      else
+        fill(i, r.c, cl);
+    }
+  });
+}
+
+} }
+
+#endif
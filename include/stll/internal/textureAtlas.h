@@ -26,6 +26,8 @@
 
 #include <vector>
 #include <cstring>
+#include <algorithm>
+#include <tuple>
 #include <unordered_map>
 
 namespace STLL { namespace internal {
@@ -35,32 +37,142 @@ namespace STLL { namespace internal {
 // D is the data stored with each element, the stored texture will
 // P additional data sent to the add element function
 // use B bytes for each pixel
+//
+// The atlas is split into horizontal pages, each with its own rectangle packer. Each
+// find marks the element and its page as used, so that the page used the longest time
+// ago can be recycled (evictPage) when the atlas is full, or all elements still in use
+// can be packed anew (compact), clearing everything is only needed when even that
+// doesn't make enough room. Elements too high for one page get several empty pages
+// following each other, that are joined until the elements are gone. D must have the members pos_x and pos_y with the position
+// of the element on the texture, they are updated when the element is moved
 template <class K, class D, class P, int B>
 class TextureAtlas_c
 {
   private:
 
-    RectanglePacker_c r;
-    std::unordered_map<K, D> map;
+    class Element_c
+    {
+      public:
+        D data;
+        uint32_t w, h;
+        uint32_t page;
+        uint64_t used;
+
+        template <class... A>
+        Element_c(uint32_t x, uint32_t y, uint32_t w_, uint32_t h_, uint32_t p, uint64_t u, A... args) :
+          data(x, y, w_, h_, args...), w(w_), h(h_), page(p), used(u) { }
+    };
+
+    class Page_c
+    {
+      public:
+        RectanglePacker_c r;
+        uint32_t y;       // first row of the page on the texture
+        uint32_t span;    // number of pages joined to this one, 0 when it is joined to a page before
+        size_t elements;  // number of elements on the page
+        uint64_t used;    // when an element of the page was used the last time
+
+        Page_c(uint32_t width, uint32_t height, uint32_t top) : r(width, height), y(top), span(1), elements(0), used(0) { }
+    };
+
+  public:
+
+    typedef typename std::unordered_map<K, Element_c>::iterator iterator;
+
+  private:
+
+    uint32_t width_, height_;
+    std::vector<Page_c> pages;
+    std::unordered_map<K, Element_c> map;
     std::vector<uint8_t> data;
 
     // whenever the content of the texture is changed, this value is updated
     uint32_t version;
 
+    // counts the finds, used as time stamp for the last use of elements and pages
+    uint64_t stamp = 0;
+
+    uint32_t pageHeight(void) const { return height_ / pages.size(); }
+
+    // make page p of pgs an empty page covering span pages
+    void resetPage(std::vector<Page_c> & pgs, uint32_t p, uint32_t span)
+    {
+      for (uint32_t q = p+1; q < p + std::max(span, pgs[p].span); q++)
+        pgs[q].span = q < p+span ? 0 : 1;
+
+      pgs[p].r = RectanglePacker_c(width_, span*pageHeight());
+      pgs[p].span = span;
+      pgs[p].elements = 0;
+    }
+
+    // place a rectangle on one of the pages pgs, returns the page and the position
+    // on the texture, or pgs.size() when there is no space left
+    std::tuple<uint32_t, uint32_t, uint32_t> allocate(std::vector<Page_c> & pgs, uint32_t w, uint32_t h)
+    {
+      for (uint32_t p = 0; p < pgs.size(); p++)
+      {
+        if (pgs[p].span == 0) continue;
+
+        auto pos = pgs[p].r.allocate(w, h);
+
+        if (pos)
+          return std::make_tuple(p, pos.value()[0], pgs[p].y + pos.value()[1]);
+      }
+
+      // the packer keeps one pixel free on each side, so a rectangle too high for
+      // a page is placed on enough empty pages joined together
+      uint32_t span = (h + 3 + pageHeight() - 1) / pageHeight();
+
+      if (span > 1 && w + 2 <= width_)
+        for (uint32_t p = 0; p + span <= pgs.size(); p++)
+        {
+          bool empty = true;
+
+          for (uint32_t q = p; q < p+span; q++)
+            empty &= pgs[q].span == 1 && pgs[q].elements == 0;
+
+          if (empty)
+          {
+            resetPage(pgs, p, span);
+
+            auto pos = pgs[p].r.allocate(w, h);
+
+            if (pos)
+              return std::make_tuple(p, pos.value()[0], pgs[p].y + pos.value()[1]);
+
+            resetPage(pgs, p, 1);
+          }
+        }
+
+      return std::make_tuple((uint32_t)pgs.size(), 0u, 0u);
+    }
+
+    void clearPage(uint32_t p)
+    {
+      std::fill(data.begin() + (size_t)pages[p].y*width_*B, data.begin() + (size_t)(pages[p].y+pages[p].span*pageHeight())*width_*B, 0);
+      resetPage(pages, p, 1);
+    }
+
   protected:
 
+    // the iterator addElement returns, when it can not add the element
+    iterator notFound(void) { return map.end(); }
+
     template <class... A>
-    std::tuple<typename std::unordered_map<K, D>::iterator, bool> insert(const K & key, uint32_t w, uint32_t h, A... args)
+    std::tuple<iterator, bool> insert(const K & key, uint32_t w, uint32_t h, A... args)
     {
-      auto p = r.allocate(w, h);
+      uint32_t p, x, y;
+      std::tie(p, x, y) = allocate(pages, w, h);
 
-      if (p)
+      if (p < pages.size())
       {
-        auto pos = p.value();
-
         version++;
 
-        return std::make_tuple(map.insert(std::make_pair(key, D(pos[0], pos[1], w, h, args...))).first, true);
+        pages[p].elements++;
+        pages[p].used = stamp;
+
+        return std::make_tuple(map.emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                                           std::forward_as_tuple(x, y, w, h, p, stamp, args...)).first, true);
       }
       else
       {
@@ -70,7 +182,12 @@ class TextureAtlas_c
 
   public:
 
-    TextureAtlas_c(uint32_t width, uint32_t height) : r(width, height), data(width*height*B) { }
+    TextureAtlas_c(uint32_t width, uint32_t height, uint32_t pageCount = 4) :
+      width_(width), height_(height), data(width*height*B), version(0)
+    {
+      for (uint32_t p = 0; p < pageCount; p++)
+        pages.emplace_back(width, height / pageCount, p * (height / pageCount));
+    }
 
     // the find can not find the requested element in the atlas, it will call this function
     // to add another element, the function needs to return the iterator to the added element
@@ -80,7 +197,7 @@ class TextureAtlas_c
     // The function should create the image to add then then call insert to include
     // the image, the return of insert should be returned... e.g.
     // addElement(const Key & key) { auto i = loadImage(key.name); return insert(key, i.w, i.h, i.data); }
-    virtual typename std::unordered_map<K, D>::iterator addElement(const K & key, const P & a) = 0;
+    virtual iterator addElement(const K & key, const P & a) = 0;
 
     // get an element from the texture atlas, if the element is not on the atlas the
     // addElement function will be called to add it, when that function can not att
@@ -88,11 +205,15 @@ class TextureAtlas_c
     // the data for the element
     std::experimental::optional<D> find(const K & key, const P & a)
     {
+      stamp++;
+
       auto i = map.find(key);
       if (i != map.end())
       {
         // element was there
-        return i->second;
+        i->second.used = stamp;
+        pages[i->second.page].used = stamp;
+        return i->second.data;
       }
       else
       {
@@ -101,7 +222,7 @@ class TextureAtlas_c
         if (i != map.end())
         {
           // element was not there but insertion succeeded
-          return i->second;
+          return i->second.data;
         }
         else
         {
@@ -114,32 +235,177 @@ class TextureAtlas_c
     const uint8_t * getData(void) const { return data.data(); }
     uint8_t * getData(void) { return data.data(); }
 
-    uint32_t width(void) const { return r.width(); }
-    uint32_t height(void) const { return r.height(); }
+    uint32_t width(void) const { return width_; }
+    uint32_t height(void) const { return height_; }
 
     uint32_t getVersion(void) const { return version; }
 
+    // the time stamp the next find will use, all elements found from now on
+    // have at least this time stamp
+    uint64_t getStamp(void) const { return stamp + 1; }
+
     void clear(void) {
-      r.clear();
+      for (uint32_t p = 0; p < pages.size(); p++)
+        resetPage(pages, p, 1);
+
       map.clear();
       std::fill(data.begin(), data.end(), 0);
+      version++;
     }
 
-    void doubleSize(void)
+    // remove all elements for which the predicate returns true from the atlas, the
+    // space on the texture is freed once all elements of a page are removed or
+    // the page is recycled
+    template <class F>
+    void remove(F pred)
     {
-      int oldw = r.width();
-      int oldh = r.height();
-      r.doubleSize();
-      int neww = r.width();
+      for (auto i = map.begin(); i != map.end(); )
+      {
+        if (pred(i->first))
+        {
+          if (--pages[i->second.page].elements == 0)
+            clearPage(i->second.page);
 
-      std::vector<uint8_t> d(neww*r.height()*B, 0);
+          i = map.erase(i);
+        }
+        else
+          ++i;
+      }
+    }
+
+    // recycle the page with elements that was used the longest time ago, as long as
+    // that was before the given time stamp (see getStamp), all its elements are removed,
+    // returns false, when all such pages have been used since then
+    bool evictPage(uint64_t before)
+    {
+      auto pg = pages.end();
+
+      for (auto i = pages.begin(); i != pages.end(); ++i)
+        if (i->span > 0 && i->elements > 0 && i->used < before && (pg == pages.end() || i->used < pg->used))
+          pg = i;
+
+      if (pg == pages.end()) return false;
+
+      uint32_t p = pg - pages.begin();
 
-      for (int y = 0; y < oldh; y++)
+      for (auto i = map.begin(); i != map.end(); )
+        if (i->second.page == p)
+          i = map.erase(i);
+        else
+          ++i;
+
+      clearPage(p);
+      version++;
+
+      return true;
+    }
+
+    // pack all elements used since the given time stamp anew, starting with the highest
+    // ones, all others are removed. This closes the gaps left by removed elements. The
+    // result contains the old and new position (x, y, new x, new y) of each element that
+    // was moved. When the elements don't fit in the new order, the atlas stays unchanged
+    // and the result is empty
+    std::experimental::optional<std::unordered_map<K, std::array<uint32_t, 4>>> compact(uint64_t since = 0)
+    {
+      std::vector<iterator> live;
+
+      for (auto i = map.begin(); i != map.end(); i++)
+        if (i->second.used >= since)
+          live.push_back(i);
+
+      std::sort(live.begin(), live.end(), [](const iterator & a, const iterator & b)
+      {
+        return a->second.h > b->second.h || (a->second.h == b->second.h && a->second.w > b->second.w);
+      });
+
+      // place all elements on empty pages first, only when all of them fit the atlas is changed
+      std::vector<Page_c> pgs(pages);
+      std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> pos;
+
+      for (uint32_t p = 0; p < pgs.size(); p++)
+      {
+        resetPage(pgs, p, 1);
+        pgs[p].used = 0;
+      }
+
+      for (auto i : live)
       {
-        memcpy(d.data()+y*neww*B, data.data()+y*oldw*B, oldw*B);
+        pos.push_back(allocate(pgs, i->second.w, i->second.h));
+
+        if (std::get<0>(pos.back()) == pgs.size())
+          return std::experimental::optional<std::unordered_map<K, std::array<uint32_t, 4>>>();
       }
 
+      for (auto i = map.begin(); i != map.end(); )
+        if (i->second.used < since)
+          i = map.erase(i);
+        else
+          ++i;
+
+      std::vector<uint8_t> d(data.size(), 0);
+      std::unordered_map<K, std::array<uint32_t, 4>> moved;
+
+      for (size_t n = 0; n < live.size(); n++)
+      {
+        auto & e = live[n]->second;
+        uint32_t p, x, y;
+        std::tie(p, x, y) = pos[n];
+
+        for (uint32_t r = 0; r < e.h; r++)
+          memcpy(d.data() + ((y+r)*width_+x)*B, data.data() + ((e.data.pos_y+r)*width_+e.data.pos_x)*B, e.w*B);
+
+        if (x != e.data.pos_x || y != e.data.pos_y)
+          moved[live[n]->first] = std::array<uint32_t, 4>{e.data.pos_x, e.data.pos_y, x, y};
+
+        e.data.pos_x = x;
+        e.data.pos_y = y;
+        e.page = p;
+        pgs[p].elements++;
+        pgs[p].used = std::max(pgs[p].used, e.used);
+      }
+
+      pages.swap(pgs);
+      data.swap(d);
+      version++;
+
+      return moved;
+    }
+
+    // enlarge the texture to the given size, each page grows by the same factor
+    // and its content is moved to the new start of the page, so the positions
+    // of the elements change
+    void grow(uint32_t w, uint32_t h)
+    {
+      uint32_t oldw = width_;
+      uint32_t oldph = pageHeight();
+
+      width_ = w;
+      height_ = h;
+
+      uint32_t newph = pageHeight();
+
+      std::vector<uint8_t> d(width_*height_*B, 0);
+
+      for (uint32_t p = 0; p < pages.size(); p++)
+      {
+        // joined pages are moved together, the pages joined to another one are empty
+        for (uint32_t y = 0; y < pages[p].span*oldph; y++)
+          memcpy(d.data()+(p*newph+y)*width_*B, data.data()+(p*oldph+y)*oldw*B, oldw*B);
+
+        pages[p].r.grow(width_, std::max(pages[p].span, 1u)*newph);
+        pages[p].y = p*newph;
+      }
+
+      for (auto & i : map)
+        i.second.data.pos_y = pages[i.second.page].y + (i.second.data.pos_y - i.second.page*oldph);
+
       data.swap(d);
+      version++;
+    }
+
+    void doubleSize(void)
+    {
+      grow(2*width_, 2*height_);
     }
 };
 
@@ -36,6 +36,7 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
 
 #include <stdint.h>
 
@@ -44,6 +45,8 @@
  */
 namespace STLL {
 
+namespace internal { class LayoutIndex_c; }
+
 /** \brief This structure encapsulates a drawing command
  */
 class CommandData_c
@@ -113,12 +116,16 @@ class TextLayout_c
     int32_t firstBaseline;
     // the drawing commands that make up this layout
     std::vector<CommandData_c> data;
+    // spatial index of the commands, created by findCommands and removed
+    // whenever the commands change
+    mutable std::mutex indexMutex;
+    mutable std::shared_ptr<const internal::LayoutIndex_c> index;
 
   public:
 
     /** \brief get the command vector
      */
-    const std::vector<CommandData_c> getData(void) const { return data; }
+    const std::vector<CommandData_c> & getData(void) const { return data; }
 
     /** \brief a little structure to hold information for one rectangle */
     class Rectangle_c
@@ -151,6 +158,7 @@ class TextLayout_c
     template <class... Args>
     void addCommand(Args&&... args)
     {
+      index.reset();
       data.emplace_back(std::forward<Args>(args)...);
     }
 
@@ -162,6 +170,7 @@ class TextLayout_c
      */
     void addCommand(const CommandData_c & c)
     {
+      index.reset();
       data.push_back(c);
     }
 
@@ -175,6 +184,7 @@ class TextLayout_c
     template <class... Args>
     void addCommandStart(Args&&... args)
     {
+      index.reset();
       data.emplace(data.begin(), std::forward<Args>(args)...);
     }
 
@@ -186,6 +196,7 @@ class TextLayout_c
      */
     void addCommandStart(const CommandData_c & d)
     {
+      index.reset();
       data.insert(data.begin(), d);
     }
 
@@ -206,6 +217,7 @@ class TextLayout_c
     void operator=(TextLayout_c && l)
     {
       data.swap(l.data);
+      index.swap(l.index);
       height = l.height;
       left = l.left;
       right = l.right;
@@ -217,6 +229,7 @@ class TextLayout_c
      */
     void operator=(const TextLayout_c & l)
     {
+      index.reset();
       data = l.data;
       height = l.height;
       left = l.left;
@@ -246,6 +259,22 @@ class TextLayout_c
      */
     void shift(int32_t dx, int32_t dy);
 
+    /** \brief find the commands that might draw into a rectangle
+     *
+     * Output drivers use this function to only draw the commands that are visible, which
+     * makes the output of small parts of huge layouts fast. To find the commands an index is
+     * created on the first call, which takes about as long as looking at all commands once.
+     * The index is kept until the commands of the layout are changed.
+     *
+     * The function may return commands that don't draw into the rectangle, but it surely
+     * returns all commands that do.
+     *
+     * \param r the rectangle in 1/64th pixels, in the coordinates of the commands
+     * \return the indices of the commands within getData in increasing order, so drawing them
+     *         in that order gives the same result as drawing all commands
+     */
+    std::vector<size_t> findCommands(const Rectangle_c & r) const;
+
     /** \brief the height of the layout. This is supposed to be the vertical
      *  space that this layout takes up in 1/64th pixels
      */
@@ -280,6 +309,22 @@ class TextLayout_c
     int32_t getFirstBaseline(void) const { return firstBaseline; }
 };
 
+/** \brief find the areas in which two layouts look different
+ *
+ * Use this function to only repaint the changed parts of a layout, e.g. when a caret blinks or
+ * a number changes, see showSDL::showDamage. The commands of both layouts are compared in order,
+ * commands that are the same at the start and the end of both layouts and commands that are the
+ * same at the same position in between (when both layouts have the same number of commands
+ * there) are skipped. The areas of all other commands are merged into a few rectangles that
+ * don't overlap.
+ *
+ * \param a the old layout
+ * \param b the new layout
+ * \return the rectangles in 1/64th pixels, in the coordinates of the commands, outside of them
+ *         both layouts look the same when drawn at the same position
+ */
+std::vector<TextLayout_c::Rectangle_c> findDamage(const TextLayout_c & a, const TextLayout_c & b);
+
 /** \brief this structure contains all attributes that a single glyph can get assigned
  */
 class CodepointAttributes_c
@@ -79,7 +79,8 @@ class TextStyleSheet_c
      * If the given family doesn't exist, it will be created
      *
      * The class will use the same font cache and thus the same instance of the
-     * FreeType library for all the fonts. So you can only use it from one thread.
+     * FreeType library for all the fonts. Several threads may layout with the style
+     * sheet at the same time, but don't add fonts or rules while they do, see \ref threads_sec
      *
      * \param family The name of the font family that gets a new member
      * \param res The resource for the new family member
@@ -36,13 +36,23 @@
 #include <memory>
 #include <map>
 #include <vector>
+#include <list>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <array>
+#include <tuple>
 
 #include <stdint.h>
 #include <stdexcept>
 
 struct FT_FaceRec_;
+struct FT_SizeRec_;
 struct FT_LibraryRec_;
 struct FT_GlyphSlotRec_;
+struct FT_MemoryRec_;
+struct hb_font_t;
+struct hb_buffer_t;
 
 namespace STLL {
 
@@ -140,6 +150,155 @@ class FontResource_c
     }
 };
 
+/** \brief This class represents one opened font file.
+ *
+ * The file is opened only once and shared by all the FontFace_c instances that use it
+ * with different sizes. Each of those font faces has its own FreeType size object.
+ *
+ * FreeType faces must not be used by more than one thread at a time, so all access to
+ * a face goes through lockFace. To allow several threads to use the same font at the same
+ * time the file can be opened more than once, see setMaxInstances.
+ *
+ * You usually don't create this class, FontCache_c does this for you.
+ */
+class FontFile_c : boost::noncopyable
+{
+  public:
+
+    /** \brief maximal number of times a single file can be opened, see setMaxInstances */
+    static const size_t maxInstances = 16;
+
+    /** \brief gives exclusive access to one of the FreeType faces of a font file
+     *
+     * As long as this object exists no other thread can use the face.
+     */
+    class FaceLock_c
+    {
+      public:
+        FaceLock_c(void) : f(nullptr), idx(0) {}
+        FaceLock_c(FT_FaceRec_ * face, size_t i, std::unique_lock<std::mutex> l) : f(face), idx(i), lock(std::move(l)) {}
+
+        /** \brief get the locked face */
+        FT_FaceRec_ * getFace(void) const { return f; }
+
+        /** \brief get the index of the locked face within the file */
+        size_t getIndex(void) const { return idx; }
+
+      private:
+        FT_FaceRec_ * f;
+        size_t idx;
+        std::unique_lock<std::mutex> lock;
+    };
+
+    /** \brief open the font file
+     * \param l the library to use to open the file
+     * \param r the resource describing the file to open
+     * \param instances the maximal number of times the file may be opened, see setMaxInstances
+     */
+    FontFile_c(std::shared_ptr<FreeTypeLibrary_c> l, const internal::FontFileResource_c & r, size_t instances = 1);
+    ~FontFile_c();
+
+    /** \brief Get the FreeType structure for this file
+     *
+     * This is the first face opened for the file. The face is not locked, so only use it, when
+     * no other thread uses this font file. The size that is active on this face is the size of
+     * the font face that used it last, so you should normally rather use FontFace_c::getFace which
+     * will activate the right size.
+     */
+    FT_FaceRec_ * getFace(void) const { return faces[0]; }
+
+    /** \brief get exclusive access to one of the FreeType faces of this file
+     *
+     * When all faces are currently in use by other threads and the file may be opened
+     * another time, a new face will be opened, otherwise the function waits until one of
+     * the faces is released.
+     */
+    FaceLock_c lockFace(void);
+
+    /** \brief get exclusive access to a specific FreeType face of the file
+     * \param idx the index of the face, must be smaller than getNumInstances
+     */
+    FaceLock_c lockFace(size_t idx);
+
+    /** \brief set how often the file may be opened at most
+     *
+     * Each opened instance can be used by one thread at a time, so set this value to the number of
+     * threads that you expect to use the font at the same time. Each instance costs memory.
+     * Instances that are already open stay open.
+     *
+     * \param n the number of instances, it is clamped to 1..maxInstances
+     */
+    void setMaxInstances(size_t n);
+
+    /** \brief get how often the file may be opened at most, see setMaxInstances */
+    size_t getMaxInstances(void) const { return maxInst; }
+
+    /** \brief get the number of times the file is currently opened */
+    size_t getNumInstances(void) const { return numInstances; }
+
+    /** \brief get the font resource that was used to open this file
+     */
+    const internal::FontFileResource_c & getResource(void) const { return rec; }
+
+    /** \brief get the library that was used to open this file
+     */
+    const std::shared_ptr<FreeTypeLibrary_c> & getLibrary(void) const { return lib; }
+
+    /** \brief check if a given character is available within this font file
+     *
+     * The first call creates a coverage bitmap of the character map of the font, all
+     * further calls only check that bitmap and don't need FreeType any more
+     *
+     * \param ch the unicode character to check
+     * \return true, when the character is available within the font, false otherwise
+     */
+    bool containsGlyph(char32_t ch);
+
+    /** \brief get a hash value of the content of the font file
+     *
+     * The hash identifies the font independent of its path or the address of the object,
+     * so it can be used to refer to the font from outside of the process, e.g. in
+     * persistent glyph caches. The hash is calculated on the first call.
+     *
+     * \return the hash value, or 0 when the font data could not be read
+     */
+    uint64_t getContentHash(void);
+
+    /** \brief get the approximate number of bytes used by this file
+     *
+     * This contains the memory FreeType allocated when opening the file and the coverage
+     * bitmap. The font data itself is not included, it is either owned by you (fonts in memory)
+     * or mapped by the operating system (font files).
+     */
+    size_t memory(void) const;
+
+  private:
+    // all the opened faces of this file, the first numInstances are valid, each
+    // one is protected by the mutex with the same index
+    std::array<FT_FaceRec_ *, maxInstances> faces;
+    std::array<std::mutex, maxInstances> mutexes;
+    std::atomic<size_t> numInstances;
+    std::atomic<size_t> maxInst;
+
+    // serializes the opening of new instances
+    std::mutex openMutex;
+
+    std::shared_ptr<FreeTypeLibrary_c> lib;
+    internal::FontFileResource_c rec;
+
+    // bytes allocated by FreeType when opening the file
+    std::atomic<size_t> faceMemory;
+
+    // the characters available in this font, created on the first call to containsGlyph
+    std::once_flag coverageFlag;
+    std::unique_ptr<internal::CodepointCoverage_c> coverage;
+    std::atomic<size_t> coverageMemory;
+
+    // the hash of the content, calculated on the first call to getContentHash
+    std::once_flag hashFlag;
+    uint64_t contentHash;
+};
+
 /** \brief This class represents one font, made out of one font file resource with a certain size.
  */
 class FontFace_c : boost::noncopyable
@@ -154,18 +313,59 @@ class FontFace_c : boost::noncopyable
         int pitch;
         const uint8_t * data;
 
+        // copies the bitmap of the FreeType glyph slot, so that the face can be unlocked
+        // and used again while this object still exists
         GlyphSlot_c(const FT_GlyphSlotRec_ * g);
         GlyphSlot_c(int width, int height) : w(width), h(height), top(0), left(0), pitch(0), data(0) {}
+
+        GlyphSlot_c(const GlyphSlot_c &) = delete;
+        GlyphSlot_c & operator=(const GlyphSlot_c &) = delete;
+        GlyphSlot_c(GlyphSlot_c &&) = default;
+
+      private:
+        std::vector<uint8_t> buffer;
     };
 
+    /** \brief create a font face using an already opened font file
+     * \param file the font file to use
+     * \param size the size of the font in 1/64th pixels
+     */
+    FontFace_c(std::shared_ptr<FontFile_c> file, uint32_t size);
+
+    /** \brief create a font face, the font file is opened just for this face
+     *
+     * This is the way to go if you don't use a FontCache_c
+     */
     FontFace_c(std::shared_ptr<FreeTypeLibrary_c> l, const internal::FontFileResource_c & r, uint32_t size);
     ~FontFace_c();
 
     /** \brief Get the FreeType structure for this font
      *
-     * This is required for example for harfbuzz. You normally don't need this when using STLL
+     * You normally don't need this when using STLL.
+     * The face is shared between all sizes of a font file, so the size of this font face is
+     * activated on the face before it is returned. Use the face before any other font face
+     * of the same file is used. The size is activated while the face is locked, but the
+     * returned face is not locked anymore, so don't use it while other threads use the font,
+     * rather use lockFace then
+     */
+    FT_FaceRec_ * getFace(void) const;
+
+    /** \brief Get exclusive access to one of the FreeType faces of the font file with the
+     * size of this font face activated
+     *
+     * As long as the returned object exists no other thread can use the face, see
+     * FontFile_c::lockFace
+     */
+    FontFile_c::FaceLock_c lockFace(void);
+
+    /** \brief shape a HarfBuzz buffer using this font face
+     *
+     * The HarfBuzz font for each FreeType face is created on first use and kept until the
+     * font face is destroyed. This function may be called by several threads at the same time.
+     *
+     * \param buf the buffer to shape
      */
-    FT_FaceRec_ * getFace(void) const { return f; }
+    void shape(hb_buffer_t * buf);
 
     /** \name Functions to get font metrics
      *  @{ */
@@ -176,7 +376,11 @@ class FontFace_c : boost::noncopyable
 
     /** \brief get the font resource that was used to create this font
      */
-    const internal::FontFileResource_c & getResource(void) const { return rec; }
+    const internal::FontFileResource_c & getResource(void) const { return file->getResource(); }
+
+    /** \brief get the font file that this face uses
+     */
+    const std::shared_ptr<FontFile_c> & getFile(void) const { return file; }
 
     /** \brief Get the height of the font with multiplication factor of 64
      * \return height of font
@@ -202,12 +406,23 @@ class FontFace_c : boost::noncopyable
      * \return thickness around the underline position
      */
     int32_t getUnderlineThickness(void) const;
+
+    /** \brief Get a box that contains all glyphs of the font with multiplication factor of 64
+     *
+     * The box is relative to the origin of the glyphs and the y-axis points down, as in the layouts.
+     * \return left, top, right and bottom edge of the box
+     */
+    std::tuple<int32_t, int32_t, int32_t, int32_t> getBoundingBox(void) const
+    {
+      return std::make_tuple(bboxLeft, bboxTop, bboxRight, bboxBottom);
+    }
     /** @} */
 
     /** \brief render a glyph of this font
      * \param glyphIndex the index of the glyph to render (take it from the layout)
      * \param sp the requested sub-pixel arrangement to apply to the rendering
-     * \return a pointer to the FreeType glyph slot record, see FreeType documentation
+     * \return the rendered glyph, the bitmap is copied out of the FreeType face, so the
+     *         face is not locked any more and can be used while you hold the result
      * \note glyphs are always rendered unhinted 8-bit FreeType bitmaps
      */
     GlyphSlot_c renderGlyph(glyphIndex_t glyphIndex, SubPixelArrangement sp);
@@ -216,13 +431,40 @@ class FontFace_c : boost::noncopyable
      * \param ch the unicode character to check
      * \return true, when the character is available within the font, false otherwise
      */
-    bool containsGlyph(char32_t ch);
+    bool containsGlyph(char32_t ch) { return file->containsGlyph(ch); }
+
+    /** \brief get the approximate number of bytes used by this font face
+     *
+     * This contains the FreeType size object and the HarfBuzz font, if it has been created.
+     * The font file is not included as it is shared with other sizes, see FontFile_c::memory
+     */
+    size_t memory(void) const;
 
   private:
-    FT_FaceRec_ *f;
-    std::shared_ptr<FreeTypeLibrary_c> lib;
-    internal::FontFileResource_c rec;
+
+    // activate the size of this font face on a locked FreeType face of the file, the size
+    // object is created when the face doesn't have one yet
+    void activate(const FontFile_c::FaceLock_c & l);
+
+    std::shared_ptr<FontFile_c> file;
+
+    // the size objects and harfbuzz fonts for the faces of the file, they are
+    // protected by the lock of the corresponding face
+    std::array<FT_SizeRec_ *, FontFile_c::maxInstances> sizes;
+    std::array<hb_font_t *, FontFile_c::maxInstances> hb;
+
     uint32_t size;
+
+    // the metrics of the font, they are the same for all size objects
+    uint32_t height;
+    int32_t ascender;
+    int32_t descender;
+    int64_t yScale;
+    int32_t bboxLeft, bboxTop, bboxRight, bboxBottom;
+
+    // bytes allocated by FreeType for the size objects and estimated for the HarfBuzz fonts
+    std::atomic<size_t> sizeMemory;
+    std::atomic<size_t> hbMemory;
 };
 
 /** \brief contains all the FontFaces_c of one FontRessource_c
@@ -234,15 +476,23 @@ class Font_c
   public:
 
     Font_c(void) {}
+    Font_c(const Font_c & f) : fonts(f.fonts) {}
+    Font_c(Font_c && f) : fonts(std::move(f.fonts)) {}
+    Font_c & operator=(const Font_c & f) { fonts = f.fonts; last = invalidLast; return *this; }
+    Font_c & operator=(Font_c && f) { fonts = std::move(f.fonts); last = invalidLast; return *this; }
 
     /** add a font face to the font */
-    void add(std::shared_ptr<FontFace_c> f) { fonts.emplace_back(std::move(f)); }
+    void add(std::shared_ptr<FontFace_c> f) { fonts.emplace_back(std::move(f)); last = invalidLast; }
 
     /** iterators for for loops */
     auto begin(void) const { return fonts.begin(); }
     auto end(void) const { return fonts.end(); }
 
     /** \brief find the fontface that contains the codepoint
+     *
+     * The result of the last query is remembered, so asking for the same codepoint
+     * many times in a row is cheap. This function may be called from several threads
+     * at the same time.
      */
     std::shared_ptr<FontFace_c> get(char32_t codepoint) const;
 
@@ -262,6 +512,12 @@ class Font_c
 
   private:
     std::vector<std::shared_ptr<FontFace_c>> fonts;
+
+    // a small cache for get: the last requested codepoint in the upper 32 bit and the
+    // index of the font face that was returned for it in the lower 32 bit, both are
+    // kept in one atomic value so that concurrent calls always see a matching pair
+    static const uint64_t invalidLast = 0xFFFFFFFFFFFFFFFFull;
+    mutable std::atomic<uint64_t> last { invalidLast };
 };
 
 /** \brief This class encapsulates an instance of the FreeType library
@@ -269,6 +525,9 @@ class Font_c
  * The class exposes the functions of the FreeType library instance that are
  * required by STLL. You normally don't need to use this interface at all.
  *
+ * Faces may be created and destroyed from several threads at the same time, the
+ * class serializes these operations.
+ *
  * You may need to create an instance of this class though, when you use the
  * low level interface (see \ref tutorial_pg)
  */
@@ -291,6 +550,32 @@ class FreeTypeLibrary_c : boost::noncopyable
      */
     FT_FaceRec_ * newFace(const internal::FontFileResource_c & r, uint32_t size);
 
+    /** Make the library create a new font face using the given resource, no size is set
+     *
+     * Usually you don't use this function directly but you use the FontFile_c class
+     *
+     * \param res The resource to use to create the font
+     * \return The FT_Face value
+     */
+    FT_FaceRec_ * newFace(const internal::FontFileResource_c & r);
+
+    /** Create an additional size object for an opened font face and set it up for the given size
+     *
+     * Usually you don't use this function directly but you use the FontFace_c class
+     *
+     * \param f the face to create the size for
+     * \param size the requested font size
+     * \param descr description of the font, used for the exception message
+     * \return The FT_Size value
+     */
+    FT_SizeRec_ * newSize(FT_FaceRec_ * f, uint32_t size, const std::string & descr);
+
+    /** Make the library destroy a size object created with newSize
+     *
+     * \param s the size to destroy
+     */
+    void doneSize(FT_SizeRec_ * s);
+
     /** Make the library destroy a font
      *
      * Usually you don't use this function directly but you use the FontFace_c class
@@ -299,18 +584,63 @@ class FreeTypeLibrary_c : boost::noncopyable
      */
     void doneFace(FT_FaceRec_ * f);
 
+    /** Get the number of bytes currently allocated by this library instance
+     *
+     * This contains all memory FreeType requested for the faces, sizes and glyphs
+     * of this library.
+     */
+    size_t getAllocatedMemory(void) const { return allocated; }
+
   private:
 
     FT_LibraryRec_ *lib;
+
+    // FreeType requires that opening and closing faces is serialized
+    std::mutex faceMutex;
+
+    // the memory allocator given to FreeType, it counts the allocated bytes
+    FT_MemoryRec_ *mem;
+    std::atomic<size_t> allocated;
 };
 
 /** \brief this class encapsulates open fonts of a single library, it makes
  *  sure that each font is open only once
+ *
+ * Each font file is opened only once, all sizes of the same file share the
+ * FreeType face and only have their own size object.
+ *
+ * The cache can be given a memory budget. When the fonts in the cache use more memory
+ * than that, the font faces that were not used for the longest time are closed. Font faces
+ * that are still in use somewhere (e.g. in a layout, or in a Font_c) are never closed.
+ * The glyph caches of the output modules use the address of the font face to identify
+ * glyphs, so they need to know when a face is closed, register the removeFontFace function of
+ * your output class with addEvictionListener for that, e.g.
+ * \code
+ * cache->addEvictionListener([&sdl](const FontFace_c * f) { sdl.removeFontFace(f); });
+ * \endcode
+ *
+ * All functions of the cache may be called from several threads at the same time. The
+ * font faces are safe for concurrent use as well, but by default each font file is opened only
+ * once and all threads using the same file have to wait for each other. To let several threads
+ * really work at the same time use setMaxFaceInstances, see \ref threads_sec
  */
-class FontCache_c
+class FontCache_c : boost::noncopyable
 {
   public:
 
+    /** \brief statistics about the cache, see getStatistics */
+    class Statistics_c
+    {
+      public:
+        size_t faces = 0;     ///< number of font faces in the cache
+        size_t files = 0;     ///< number of font files that are open
+        size_t memory = 0;    ///< approximate number of bytes used by the faces and files
+        size_t budget = 0;    ///< the memory budget, 0 when there is none
+        size_t hits = 0;      ///< number of getFont calls that found the face in the cache
+        size_t misses = 0;    ///< number of getFont calls that needed to create a new face
+        size_t evictions = 0; ///< number of faces that were closed to stay within the budget
+    };
+
     /** \brief Create a cache using a specific library.
      *
      * I am not really sure where is might be useful to use multiple caches on one
@@ -343,20 +673,55 @@ class FontCache_c
     /** \brief remove all fonts from the cache, fonts that are still in use will be kept, but all others
      * are removed
      */
-    void clear(void)
-    {
-      for(auto it = fonts.begin(); it != fonts.end(); )
-      {
-        if(it->second.use_count() == 1)
-        {
-          it = fonts.erase(it);
-        }
-        else
-        {
-          ++it;
-        }
-      }
-    }
+    void clear(void);
+
+    /** \brief set the memory budget for the cache
+     *
+     * Whenever a new font face is opened and the fonts use more than the given
+     * number of bytes, unused font faces are closed, the ones that were
+     * not used for the longest time first. The memory use is only an approximation,
+     * see FontFace_c::memory and FontFile_c::memory
+     *
+     * \param bytes the budget in bytes, 0 (the default) means no limit
+     */
+    void setMemoryBudget(size_t bytes);
+
+    /** \brief get the current memory budget, 0 means no limit */
+    size_t getMemoryBudget(void) const { return budget; }
+
+    /** \brief set how many threads can use the same font file at the same time
+     *
+     * Each FreeType face can only be used by one thread at a time. With this function
+     * you allow the cache to open each font file up to the given number of times, so
+     * that many threads can layout and render text with the same font without waiting for
+     * each other. Additional instances are opened only when they are actually needed.
+     *
+     * \param n maximal number of instances per font file, default is 1, the maximum is
+     *          FontFile_c::maxInstances
+     */
+    void setMaxFaceInstances(size_t n);
+
+    /** \brief get the approximate number of bytes used by all fonts in the cache */
+    size_t memory(void) const;
+
+    /** \brief get some statistics about the cache */
+    Statistics_c getStatistics(void) const;
+
+    /** \brief register a function that is called whenever the cache closes a font face
+     *
+     * The function is called right before the face is destroyed with a pointer to the
+     * face. Use it to remove the glyphs of that face from your glyph caches. The function is
+     * called with the cache locked, so it must not call functions of the cache.
+     *
+     * \param f the function to call
+     * \return an id that can be used to remove the listener again
+     */
+    size_t addEvictionListener(std::function<void(const FontFace_c *)> f);
+
+    /** \brief remove a listener that was registered with addEvictionListener
+     * \param id the value returned by addEvictionListener
+     */
+    void removeEvictionListener(size_t id);
 
   private:
 
@@ -378,9 +743,48 @@ class FontCache_c
         }
     };
 
+    // an entry in the font map, containing the face and its position in the lru list
+    class FontFaceEntry_c
+    {
+      public:
+        std::shared_ptr<FontFace_c> face;
+        std::list<FontFaceParameter_c>::iterator lru;
+    };
+
+    // close unused font faces, the oldest first, until the memory use of all fonts
+    // is at most the given number of bytes, 0 closes all unused faces, the cache must be locked
+    void trim(size_t bytes);
+
+    // the memory function for an already locked cache
+    size_t memoryLocked(void) const;
+
+    // protects all the members below
+    mutable std::mutex mutex;
+
     // all open fonts, used to check whether they have all been released
     // on library destruction
-    std::map<FontFaceParameter_c, std::shared_ptr<FontFace_c> > fonts;
+    std::map<FontFaceParameter_c, FontFaceEntry_c> fonts;
+
+    // the keys of all fonts, the most recently used at the front
+    std::list<FontFaceParameter_c> lru;
+
+    // all open font files, they are kept alive by the font faces that use them
+    std::map<internal::FontFileResource_c, std::weak_ptr<FontFile_c> > files;
+
+    // the memory budget, 0 for none
+    std::atomic<size_t> budget { 0 };
+
+    // the maximal number of instances for each font file
+    size_t maxInstances = 1;
+
+    // counters for the statistics
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+
+    // the functions to call when a face is closed
+    std::vector<std::pair<size_t, std::function<void(const FontFace_c *)>>> listeners;
+    size_t listenerId = 0;
 
     // the library to use
     std::shared_ptr<FreeTypeLibrary_c> lib;
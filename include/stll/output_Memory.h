@@ -0,0 +1,301 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef STLL_LAYOUTER_MEMORY
+#define STLL_LAYOUTER_MEMORY
+
+/** \file
+ *  \brief output driver for plain memory buffers
+ */
+
+#include "layouterFont.h"
+#include "layouter.h"
+#include "color.h"
+
+#include "internal/glyphCache.h"
+#include "internal/drawList.h"
+#include "internal/softwareOutput.h"
+#include "internal/pixelFormats.h"
+#include "internal/gamma.h"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <numeric>
+#include <algorithm>
+
+namespace STLL {
+
+/** \brief a class to output layouts into buffers in memory
+ *
+ * This is the same software renderer as showSDL, but without SDL: the layouts are drawn into
+ * buffers that you provide, e.g. to create thumbnails or previews on a server. The output
+ * into a buffer is the same as the output of showSDL into a surface with the same format.
+ *
+ * The class is thread safe: several threads may output layouts at the same time, they then
+ * share the glyph cache, which is itself thread safe, see setGlyphCache. Each call can additionally
+ * use several threads itself, see setThreads.
+ *
+ * \tparam G the gamma calculation class to use... normally you don't need to change this, keep the default
+ */
+template <class G = internal::Gamma_c<>>
+class showMemory
+{
+  public:
+
+    /** \brief the supported pixel formats, the names give the order of the bytes in memory
+     */
+    enum PixelFormat
+    {
+      FMT_RGBA, ///< 4 bytes per pixel: red, green, blue and alpha, the alpha byte is not changed
+      FMT_BGRA, ///< 4 bytes per pixel: blue, green, red and alpha, the alpha byte is not changed
+      FMT_A8    ///< 1 byte per pixel containing the coverage, the colours of the layout are ignored
+    };
+
+    /** \brief a buffer to draw into
+     */
+    class Buffer_c
+    {
+      public:
+        uint8_t * pixels;   ///< the first byte of the top left pixel
+        int width;          ///< width in pixels
+        int height;         ///< height in pixels
+        int stride;         ///< number of bytes from the start of one row to the start of the next
+        PixelFormat format; ///< the pixel format
+    };
+
+  private:
+    G g;
+
+    // the gamma of the colour formats
+    static const uint8_t gamma = 22;
+
+    std::shared_ptr<internal::GlyphCache_c> cache { std::make_shared<internal::GlyphCache_c>() };
+
+    std::atomic<size_t> threads;
+
+    // byte orders of the colour formats
+    typedef internal::PixelBytes_c<4, 0, 1, 2> PixelRGBA_t;
+    typedef internal::PixelBytes_c<4, 2, 1, 0> PixelBGRA_t;
+
+    // layouts with at least this number of commands are culled to the buffer
+    // using the index of the layout
+    static const size_t minIndexedCommands = 256;
+
+    // the output of a layout with the pixel accessor px for the buffer, the visible commands
+    // are compiled into a draw list that is used once
+    template <class P>
+    void showLayout(const TextLayout_c & l, int sx, int sy, const Buffer_c & b, SubPixelArrangement sp, const P & px)
+    {
+      auto & data = l.getData();
+      std::vector<size_t> cmds;
+
+      if (data.size() >= minIndexedCommands)
+      {
+        TextLayout_c::Rectangle_c r;
+
+        r.x = -sx;
+        r.y = -sy;
+        r.w = 64*b.width;
+        r.h = 64*b.height;
+
+        cmds = l.findCommands(r);
+      }
+      else
+      {
+        cmds.resize(data.size());
+        std::iota(cmds.begin(), cmds.end(), 0);
+      }
+
+      size_t t = threads ? threads.load() : std::max(1u, std::thread::hardware_concurrency());
+
+      // the images stay valid until all bands are done, the missing glyphs are
+      // rendered in parallel before they are looked up
+      internal::GlyphCache_c::Hold_c hold(*cache);
+      internal::DrawList_c dl;
+
+      dl.compile(l, sp, cache, t, g, gamma, &cmds);
+      showList(dl, sx, sy, b, sp, t, px);
+    }
+
+    // the output of a draw list with the pixel accessor px for the buffer using t threads, the buffer
+    // is split into horizontal bands that are drawn in parallel, see internal::showListBanded
+    template <class P>
+    void showList(const internal::DrawList_c & dl, int sx, int sy, const Buffer_c & b, SubPixelArrangement sp, size_t t, const P & px)
+    {
+      internal::Target_c target { b.pixels, b.stride, P::bytes, b.width, b.height };
+      internal::Clip_c clip { 0, 0, b.width, b.height };
+
+      internal::showListBanded(dl, sx, sy, target, clip, sp, t, px, g,
+        [&](const internal::DrawList_c::Item_c & i, Color_c c, const internal::Clip_c & cl)
+        {
+          internal::fillRect(i, c, sx, sy, target, cl, px);
+        });
+    }
+
+  public:
+
+    showMemory(void) : threads(1)
+    {
+      g.setGamma(gamma);
+    }
+
+    /** \brief draw a layout into a buffer
+     *
+     * Images of the layout are not drawn. The colour formats are blended with a gamma of 2.2,
+     * like the surfaces of showSDL. Buffers of the format FMT_A8 receive the coverage of the layout,
+     * the coverage of the commands is scaled by the alpha value of their colour and combined with
+     * the coverage already within the buffer, sub-pixel output is not possible for them.
+     *
+     * \param l layout to draw
+     * \param sx x position within the buffer in 1/64th pixels
+     * \param sy y position within the buffer in 1/64th pixels
+     * \param b the buffer
+     * \param sp which kind of sub-pixel positioning do you want?
+     */
+    void showLayout(const TextLayout_c & l, int sx, int sy, const Buffer_c & b, SubPixelArrangement sp = SUBP_NONE)
+    {
+      if (b.width <= 0 || b.height <= 0) return;
+
+      switch (b.format)
+      {
+        case FMT_RGBA: showLayout(l, sx, sy, b, sp, PixelRGBA_t()); break;
+        case FMT_BGRA: showLayout(l, sx, sy, b, sp, PixelBGRA_t()); break;
+        case FMT_A8:   showLayout(l, sx, sy, b, SUBP_NONE, internal::PixelA8_c()); break;
+      }
+    }
+
+    /** \brief a layout compiled for repeated output, see showSDL::DrawList_c */
+    typedef internal::DrawList_c DrawList_c;
+
+    /** \brief draw a layout into a buffer using a draw list, see showSDL::showLayout
+     *
+     * The list is compiled, when it is not valid, and then drawn. The list is always compiled
+     * from the whole layout, for buffers of the format FMT_A8 it is compiled without sub-pixels.
+     * A list must not be used by several threads at the same time.
+     *
+     * \param l layout to draw, the layout the list belongs to
+     * \param sx x position within the buffer in 1/64th pixels
+     * \param sy y position within the buffer in 1/64th pixels
+     * \param b the buffer
+     * \param sp which kind of sub-pixel positioning do you want?
+     * \param dl the draw list of the layout
+     */
+    void showLayout(const TextLayout_c & l, int sx, int sy, const Buffer_c & b, SubPixelArrangement sp, DrawList_c & dl)
+    {
+      if (b.width <= 0 || b.height <= 0) return;
+
+      if (b.format == FMT_A8)
+        sp = SUBP_NONE;
+
+      size_t t = threads ? threads.load() : std::max(1u, std::thread::hardware_concurrency());
+
+      internal::GlyphCache_c::Hold_c hold(*cache);
+
+      if (!dl.valid(cache, sp, gamma))
+        dl.compile(l, sp, cache, t, g, gamma);
+
+      switch (b.format)
+      {
+        case FMT_RGBA: showList(dl, sx, sy, b, sp, t, PixelRGBA_t()); break;
+        case FMT_BGRA: showList(dl, sx, sy, b, sp, t, PixelBGRA_t()); break;
+        case FMT_A8:   showList(dl, sx, sy, b, sp, t, internal::PixelA8_c()); break;
+      }
+    }
+
+    /** \brief set the number of threads used by each call of showLayout
+     *
+     * With more than one thread showLayout splits the buffer into horizontal bands
+     * and draws the bands in parallel, the glyphs that are not yet in the cache are rendered
+     * in parallel as well. The output is exactly the same as with one thread.
+     *
+     * \param num number of threads, 0 uses one thread per processor, the default is 1
+     */
+    void setThreads(size_t num = 0)
+    {
+      threads = num;
+    }
+
+    /** \brief set the maximal amount of memory for the glyph cache, see showSDL::setCacheBudget
+     *
+     * \param bytes the maximal number of bytes for the cache
+     * \param admission images bigger than this number of bytes are only cached when they
+     *        are drawn repeatedly, 0 selects 1/64 of the budget
+     */
+    void setCacheBudget(size_t bytes, size_t admission = 0)
+    {
+      cache->setBudget(bytes);
+      cache->setAdmissionLimit(admission);
+    }
+
+    /** \brief store the glyph images within the cache run length encoded, see showSDL::setCacheCompression
+     */
+    void setCacheCompression(bool on)
+    {
+      cache->setCompression(on);
+    }
+
+    /** \brief statistics of the glyph cache, see internal::GlyphCache_c::Statistics_c */
+    typedef internal::GlyphCache_c::Statistics_c CacheStatistics_c;
+
+    /** \brief get information about the state of the glyph cache, like the number of bytes
+     * used and the number of evictions
+     */
+    CacheStatistics_c getCacheStatistics(void)
+    {
+      return cache->getStatistics();
+    }
+
+    /** \brief use a glyph cache file, see showSDL::loadCacheFile
+     */
+    bool loadCacheFile(const std::string & path)
+    {
+      return cache->addFile(path);
+    }
+
+    /** \brief the glyph cache, see showSDL::getGlyphCache */
+    std::shared_ptr<internal::GlyphCache_c> getGlyphCache(void) const
+    {
+      return cache;
+    }
+
+    /** \brief use another glyph cache, e.g. the one of another output object, see showSDL::setGlyphCache
+     *
+     * This must not be called while a layout is drawn
+     */
+    void setGlyphCache(std::shared_ptr<internal::GlyphCache_c> c)
+    {
+      cache = c;
+    }
+
+    /** \brief remove all glyphs of a font face from the glyph cache, see showSDL::removeFontFace
+     *
+     * This must not be called while a layout with the font face is drawn
+     */
+    void removeFontFace(const FontFace_c * face)
+    {
+      cache->removeFont(face);
+    }
+};
+
+}
+
+#endif
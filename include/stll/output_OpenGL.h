@@ -33,6 +33,9 @@
 #include "internal/gamma.h"
 #include "internal/openGL_internal.h"
 
+#include <vector>
+#include <limits>
+
 namespace STLL {
 
 /** \brief a class to output layouts using OpenGL
@@ -40,14 +43,19 @@ namespace STLL {
  * To output layouts using this class, create an object of it and then
  * use the showLayout Function to output the layout.
  *
- * The class contains a glyph cache in form of an texture atlas. Once this
- * atlas if full, things available will be output and then the atlas will be cleared
- * and repopulated for the next section of the output. This will slow down output
- * considerably, so choose the size wisely. The atlas will be destroyed once the
+ * The class contains a glyph cache in form of an texture atlas. The atlas is split into
+ * pages, once it is full and has reached its maximal size, the page used the longest time
+ * ago is recycled. When all pages are needed for the layout that is drawn, the glyphs it
+ * uses are packed anew. Only when that isn't enough either, things available will be output
+ * and then the atlas will be cleared and repopulated for the next section of the output.
+ * This will slow down output considerably, so choose the size wisely. Each of these steps
+ * invalidates the DrawCache_c objects. The atlas will be destroyed once the
  * class is destroyed. Things to consider:
  * - using sub pixel placement triples the space requirements for the glyphs
  * - blurring adds quite some amount of space around the glyphs, but as soon as you blurr the
  *   sub pixel placement will not be used as you will not see the difference anyways
+ * - blurrs with a radius above the cutoff of internal::setGaussBlurrCutoff are stored at a
+ *   reduced resolution and enlarged while drawing, so they need a lot less space
  * - normal rectangles will not go into the cache, but blurres ones will
  * - so in short avoid blurring
  *
@@ -75,6 +83,35 @@ class showOpenGL : internal::openGL_internals<V>
     uint32_t atlasId = 1;
     uint32_t cacheMax;
 
+    // the area to draw in pixels, see setClipRect
+    TextLayout_c::Rectangle_c clip { 0, 0, std::numeric_limits<int>::max(), std::numeric_limits<int>::max() };
+    bool clipped = false;
+
+    // layouts with at least this number of commands are culled to the clip rectangle
+    static const size_t minIndexedCommands = 256;
+
+    // find the commands of big layouts that are visible within the clip rectangle,
+    // returns false when all commands are to be drawn
+    bool findVisible(const TextLayout_c & l, int sx, int sy, std::vector<size_t> & visible) const
+    {
+      if (!clipped || l.getData().size() < minIndexedCommands) return false;
+
+      auto clamp = [](int64_t v) -> int
+      {
+        return std::min<int64_t>(std::max<int64_t>(v, std::numeric_limits<int>::min()), std::numeric_limits<int>::max());
+      };
+
+      TextLayout_c::Rectangle_c r;
+
+      r.x = clamp((int64_t)clip.x*64 - sx);
+      r.y = clamp((int64_t)clip.y*64 - sy);
+      r.w = clamp((int64_t)clip.w*64);
+      r.h = clamp((int64_t)clip.h*64);
+
+      visible = l.findCommands(r);
+      return true;
+    }
+
   public:
 
     /** \brief type to keep the caching information for redrawing layouts extra fast. You
@@ -147,21 +184,34 @@ class showOpenGL : internal::openGL_internals<V>
         return;
       }
 
-      const auto & dat = l.getData();
+      std::vector<size_t> visible;
+      bool culled = findVisible(l, sx, sy, visible);
+
+      // the cache must contain the complete layout
+      if (culled) dc = nullptr;
+
+      const auto & all = l.getData();
+      size_t count = culled ? visible.size() : all.size();
+      auto dat = [&](size_t n) -> const CommandData_c & { return culled ? all[visible[n]] : all[n]; };
+
       size_t i = 0;
       bool cleared = false;
 
-      while (i < dat.size())
+      while (i < count)
       {
         size_t j = i;
+        bool compacted = false;
+
+        // everything found from here on is used by this part of the layout
+        uint64_t batchStart = cache.getStamp();
 
         // make sure that there is a small completely filled rectangle
         // used for drawing filled rectangles
         cache.getRect(640, 640, SUBP_NONE, 0);
 
-        while (j < dat.size())
+        while (j < count)
         {
-          auto & ii = dat[j];
+          auto & ii = dat(j);
 
           bool found = true;
 
@@ -184,15 +234,23 @@ class showOpenGL : internal::openGL_internals<V>
           {
             // glyph not found means there was no space to include it inside
             // the current cache, so try to double its size, if the cache
-            // is already at least cacheMax size, we'll have to split the layout
+            // is already at least cacheMax size recycle the page used the longest
+            // time ago, when all pages are used by this part of the layout pack the
+            // used glyphs anew, only when that doesn't help either we'll have to
+            // split the layout, all of these move glyphs, so the draw caches
+            // become invalid
             if (cache.width() < cacheMax)
             {
               cache.doubleSize();
             }
-            else
+            else if (!cache.evictPage(batchStart))
             {
-              break;
+              if (compacted || !cache.compact(batchStart)) break;
+
+              compacted = true;
             }
+
+            atlasId++;
           }
           else
           {
@@ -200,6 +258,14 @@ class showOpenGL : internal::openGL_internals<V>
           }
         }
 
+        // the atlas was cleared for this part, so the command doesn't fit even into
+        // an empty atlas, skip it
+        if (j == i && cleared)
+        {
+          i++;
+          continue;
+        }
+
         // check, if the texture cache has been changed to include
         // glyphs from this layout, if so re-upload it to the graphics memory
         if (cache.getVersion() != uploadVersion)
@@ -208,14 +274,14 @@ class showOpenGL : internal::openGL_internals<V>
           internal::openGL_internals<V>::updateTexture(cache.getData(), cache.width());
         }
 
-        typename internal::openGL_internals<V>::CreateInternal_c vb(dat.size());
+        typename internal::openGL_internals<V>::CreateInternal_c vb(count);
 
         size_t k = i;
 
         // check if the user wants caching and if we are able to provide it
         // we can only use caching, if all the layout completely fits into
         // one drawing batch
-        if (dc && !cleared && j == dat.size())
+        if (dc && !cleared && j == count)
         {
           internal::openGL_internals<V>::startCachePreparation(*dc);
         }
@@ -226,7 +292,7 @@ class showOpenGL : internal::openGL_internals<V>
 
         while (k < j)
         {
-          auto & ii = dat[k];
+          auto & ii = dat(k);
 
           switch (ii.command)
           {
@@ -274,7 +340,7 @@ class showOpenGL : internal::openGL_internals<V>
         // depending on the drawing options finish the drawing either
         // by finishing the cache, drawing and leaving the function
         // or by just completing the drawing batch without cache
-        if (dc && !cleared && j == dat.size())
+        if (dc && !cleared && j == count)
         {
           internal::openGL_internals<V>::endCachePreparation(*dc, vb, sp, sx, sy, atlasId, cache.width());
         }
@@ -282,7 +348,7 @@ class showOpenGL : internal::openGL_internals<V>
         {
           internal::openGL_internals<V>::endPreparation(vb, sp, sx, sy, cache.width());
 
-          if (j < dat.size())
+          if (j < count)
           {
             // atlas is not big enough, it needs to be cleared
             // and will be repopulated for the next batch of the layout
@@ -316,6 +382,42 @@ class showOpenGL : internal::openGL_internals<V>
     uint32_t cacheWidth(void) const { return cache.width(); }
     uint32_t cacheHeight(void) const { return cache.height(); }
 
+    /** \brief remove all glyphs of a font face from the texture atlas
+     *
+     * The atlas identifies font faces by their address. When a font face is
+     * destroyed while there are still glyphs of it in the atlas, a new face might
+     * get the same address and would then use the wrong glyphs. Call this function
+     * before a font face is destroyed, e.g. by registering it with
+     * FontCache_c::addEvictionListener. The space of the glyphs on the texture is
+     * reused once all glyphs of their page are gone or the page is recycled.
+     *
+     * \param face the font face that will be destroyed
+     */
+    void removeFontFace(const FontFace_c * face)
+    {
+      cache.remove([face](const internal::GlyphKey_c & k) { return k.font == (intptr_t)face; });
+    }
+
+    /** \brief set the clip rectangle
+     *
+     * Commands of big layouts that are completely outside of this rectangle are not drawn,
+     * see TextLayout_c::findCommands, so when you show a small part of a huge layout, e.g.
+     * a page of a long document, set the clip rectangle to the visible area. The rectangle is
+     * only used to skip commands, the commands that are drawn are not clipped, use
+     * glScissor for that. Layouts that are culled are not put into a DrawCache_c.
+     * Calling the function without arguments clears the clip rectangle
+     *
+     * \param x x-coordinate of upper left corner in pixels
+     * \param y y-coordinate of upper left corner in pixels
+     * \param w width of the clip rectangle in pixels
+     * \param h height of clip rectangle in pixels
+     */
+    void setClipRect(int x = 0, int y = 0, int w = std::numeric_limits<int>::max(), int h = std::numeric_limits<int>::max())
+    {
+      clip = TextLayout_c::Rectangle_c { x, y, w, h };
+      clipped = x != 0 || y != 0 || w != std::numeric_limits<int>::max() || h != std::numeric_limits<int>::max();
+    }
+
     /** \brief update the gamma value used for output
      *
      * Default value for the class is 22, which is good for sRGB output, which
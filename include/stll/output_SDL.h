@@ -31,11 +31,23 @@
 #include "color.h"
 
 #include "internal/glyphCache.h"
-#include "internal/blitter.h"
+#include "internal/shadowLayers.h"
+#include "internal/coverageMask.h"
+#include "internal/drawList.h"
+#include "internal/softwareOutput.h"
+#include "internal/pixelFormats.h"
 #include "internal/gamma.h"
 
 #include <SDL.h>
 
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include <numeric>
+#include <cstring>
+#include <cstdlib>
+
 namespace STLL {
 
 /** \brief a class to output layouts using SDL
@@ -50,162 +62,166 @@ class showSDL
 {
   private:
     G g;
-    internal::GlyphCache_c cache;
-    int cx, cy, cw, ch;
+    std::shared_ptr<internal::GlyphCache_c> cache { std::make_shared<internal::GlyphCache_c>() };
+    size_t threads;
 
-    // a simple get pixel function for the fallback render methods
-    std::tuple<uint8_t, uint8_t, uint8_t> getpixel(const uint8_t * p, const SDL_PixelFormat * f)
-    {
-      uint32_t val;
+    // the images of the shadows of whole lines, when useLayers is true
+    internal::ShadowLayers_c layers;
+    bool useLayers;
 
-      switch(f->BytesPerPixel) {
-        case 1: val = *p;
-        break;
+    // the value g is set to, see setGamma
+    uint8_t gamma;
 
-        case 2: val = *(Uint16 *)p;
-        break;
+    typedef internal::Clip_c Clip_c;
 
-        case 3:
-          if(SDL_BYTEORDER == SDL_BIG_ENDIAN)
-            val = p[0] << 16 | p[1] << 8 | p[2];
-          else
-            val = p[0] | p[1] << 8 | p[2] << 16;
-          break;
-
-        case 4: val = *(Uint32 *)p;
-        break;
+    Clip_c clip;
 
-        default:
-          val = 0;       /* shouldn't happen, but avoids warnings */
-          break;
-      }
-
-      Uint8 r, g, b;
-      SDL_GetRGB(val, f, &r, &g, &b);
+    // the intersection of two clip rectangles, when it is empty w or h are 0
+    static Clip_c intersect(const Clip_c & a, const Clip_c & b)
+    {
+      int64_t x0 = std::max(a.x, b.x);
+      int64_t y0 = std::max(a.y, b.y);
+      int64_t x1 = std::min((int64_t)a.x + a.w, (int64_t)b.x + b.w);
+      int64_t y1 = std::min((int64_t)a.y + a.h, (int64_t)b.y + b.h);
 
-      return std::make_tuple(r, g, b);
+      return Clip_c { (int)x0, (int)y0, (int)std::max<int64_t>(0, x1 - x0), (int)std::max<int64_t>(0, y1 - y0) };
     }
 
-    // a simple put pixel function for the fallback render methods
-    void putpixel(uint8_t * p, uint8_t r, uint8_t g, uint8_t b, const SDL_PixelFormat * f)
+    // pixel accessor for all formats without a specialised accessor, it uses the format
+    // description of the surface, see internal/pixelFormats.h
+    class PixelSDL_c
     {
-      uint32_t pixel = SDL_MapRGB(f, r, g, b);
+      private:
+        const SDL_PixelFormat * f;
 
-      switch(f->BytesPerPixel) {
-        case 1:
-          *p = pixel;
-          break;
+      public:
+        PixelSDL_c(const SDL_PixelFormat * format) : f(format) {}
 
-        case 2:
-          *(Uint16 *)p = pixel;
-          break;
+        std::tuple<uint8_t, uint8_t, uint8_t> get(const uint8_t * p) const
+        {
+          uint32_t val;
 
-        case 3:
-          if(SDL_BYTEORDER == SDL_BIG_ENDIAN) {
-            p[0] = (pixel >> 16) & 0xff;
-            p[1] = (pixel >> 8) & 0xff;
-            p[2] = pixel & 0xff;
-          } else {
-            p[0] = pixel & 0xff;
-            p[1] = (pixel >> 8) & 0xff;
-            p[2] = (pixel >> 16) & 0xff;
+          switch(f->BytesPerPixel) {
+            case 1: val = *p;
+            break;
+
+            case 2: val = *(Uint16 *)p;
+            break;
+
+            case 3:
+              if(SDL_BYTEORDER == SDL_BIG_ENDIAN)
+                val = p[0] << 16 | p[1] << 8 | p[2];
+              else
+                val = p[0] | p[1] << 8 | p[2] << 16;
+              break;
+
+            case 4: val = *(Uint32 *)p;
+            break;
+
+            default:
+              val = 0;       /* shouldn't happen, but avoids warnings */
+              break;
           }
-          break;
 
-        case 4:
-          *(Uint32 *)p = pixel;
-          break;
-      }
-    }
+          Uint8 r, g, b;
+          SDL_GetRGB(val, f, &r, &g, &b);
 
-    constexpr static int calcFormatID(int format, SubPixelArrangement sp)
-    {
-      return (int)(sp)+format*8;
-    }
+          return std::make_tuple(r, g, b);
+        }
 
-    static int getSurfaceFormat(SDL_Surface * s)
-    {
-      auto f = s->format;
+        void put(uint8_t * p, uint8_t r, uint8_t g, uint8_t b) const
+        {
+          uint32_t pixel = SDL_MapRGB(f, r, g, b);
 
-      #if SDL_BYTEORDER == SDL_LIL_ENDIAN
-      if (f->Rmask == 0xFF0000 && f->Gmask == 0xFF00 && f->Bmask == 0xFF)
-        return 1;
-      #endif
+          switch(f->BytesPerPixel) {
+            case 1:
+              *p = pixel;
+              break;
 
-      // default format
-      return 0;
-    }
+            case 2:
+              *(Uint16 *)p = pixel;
+              break;
+
+            case 3:
+              if(SDL_BYTEORDER == SDL_BIG_ENDIAN) {
+                p[0] = (pixel >> 16) & 0xff;
+                p[1] = (pixel >> 8) & 0xff;
+                p[2] = pixel & 0xff;
+              } else {
+                p[0] = pixel & 0xff;
+                p[1] = (pixel >> 8) & 0xff;
+                p[2] = (pixel >> 16) & 0xff;
+              }
+              break;
 
-    void outputGlyph(int sx, int sy, const internal::PaintData_c & img, SubPixelArrangement sp, Color_c c, SDL_Surface * s)
+            case 4:
+              *(Uint32 *)p = pixel;
+              break;
+          }
+        }
+    };
+
+    // the surface formats with their own pixel accessor
+    enum SurfaceFormat
     {
-      // check for the right image format
+      FMT_OTHER,
+      FMT_XRGB8888,
+      FMT_RGBA8888,
+      FMT_ABGR8888,
+      FMT_BGRA8888,
+      FMT_RGB888,
+      FMT_BGR888,
+      FMT_RGB565,
+      FMT_BGR565
+    };
 
-      // hub code to decide which function to use for output, there are fast functions
-      // for some of the output functions and fallbacks that always work but use relatively slow
-      // pixel read and write routines
-      // if you need additional surface formats add them here (e.g other 3 or 4 Byte formats with
-      // a different byte order
-      // as I don't know what is a useful set to support I only add the one format I I know of: mine
+    static SurfaceFormat getSurfaceFormat(SDL_Surface * s)
+    {
+      auto f = s->format;
 
-      switch (calcFormatID(getSurfaceFormat(s), sp))
+      auto masks = [f](uint32_t r, uint32_t g, uint32_t b) -> bool
       {
-        default: // use no subpixel and no optimisation as default... should not happen though
-        case calcFormatID(0, SUBP_NONE):
-          outputGlyph_NONE(
-            sx, sy, img, c, (uint8_t*)s->pixels, s->pitch, s->format->BytesPerPixel, s->w, s->h,
-            [s, this](const uint8_t * p) -> auto { return getpixel(p, s->format); },
-            [s, this](uint8_t * p, uint8_t r, uint8_t g, uint8_t b) -> void { putpixel(p, r, g, b, s->format); },
-            [this](int a1, int a2, int b1, int b2, int c) -> auto { return internal::blend(a1, a2, b1, b2, c, g); },
-            cx, cy, cw, ch);
-          break;
-        case calcFormatID(1, SUBP_NONE):
-          outputGlyph_NONE(
-            sx, sy, img, c, (uint8_t*)s->pixels, s->pitch, s->format->BytesPerPixel, s->w, s->h,
-            [](const uint8_t * p) -> auto { return std::make_tuple(p[2], p[1], p[0]); },
-            [](uint8_t * p, uint8_t r, uint8_t g, uint8_t b) -> void { p[2] = r; p[1] = g; p[0] = b; },
-            [this](int a1, int a2, int b1, int b2, int c) -> auto { return internal::blend(a1, a2, b1, b2, c, g); },
-            cx, cy, cw, ch);
-          break;
-        case calcFormatID(0, SUBP_RGB):
-          outputGlyph_HorizontalRGB(
-            sx, sy, img, c.r(), c.g(), c.b(), c.a(), (uint8_t*)s->pixels, s->pitch, s->format->BytesPerPixel, s->w, s->h,
-            [s, this](const uint8_t * p) -> auto { return getpixel(p, s->format); },
-            [s, this](uint8_t * p, uint8_t r, uint8_t g, uint8_t b) -> void { putpixel(p, r, g, b, s->format); },
-            [this](int a1, int a2, int b1, int b2, int c) -> auto { return internal::blend(a1, a2, b1, b2, c, g); },
-            cx, cy, cw, ch);
-          break;
-        case calcFormatID(1, SUBP_RGB):
-          outputGlyph_HorizontalRGB(
-            sx, sy, img, c.r(), c.g(), c.b(), c.a(), (uint8_t*)s->pixels, s->pitch, s->format->BytesPerPixel, s->w, s->h,
-            [](const uint8_t * p) -> auto { return std::make_tuple(p[2], p[1], p[0]); },
-            [](uint8_t * p, uint8_t sp1, uint8_t sp2, uint8_t sp3) -> void { p[2] = sp1; p[1] = sp2; p[0] = sp3; },
-            [this](int a1, int a2, int b1, int b2, int c) -> auto { return internal::blend(a1, a2, b1, b2, c, g); },
-            cx, cy, cw, ch);
+        return f->Rmask == r && f->Gmask == g && f->Bmask == b;
+      };
+
+      switch (f->BytesPerPixel)
+      {
+        case 4:
+          if (masks(0xFF0000, 0xFF00, 0xFF)) return FMT_XRGB8888;
+          if (masks(0xFF000000, 0xFF0000, 0xFF00)) return FMT_RGBA8888;
+          if (masks(0xFF, 0xFF00, 0xFF0000)) return FMT_ABGR8888;
+          if (masks(0xFF00, 0xFF0000, 0xFF000000)) return FMT_BGRA8888;
           break;
-        case calcFormatID(0, SUBP_BGR):
-          outputGlyph_HorizontalRGB(
-            sx, sy, img, c.b(), c.g(), c.r(), c.a(), (uint8_t*)s->pixels, s->pitch, s->format->BytesPerPixel, s->w, s->h,
-            [s, this](const uint8_t * p) -> auto { auto t = getpixel(p, s->format); return std::make_tuple(std::get<2>(t), std::get<1>(t), std::get<0>(t)); },
-            [s, this](uint8_t * p, uint8_t sp1, uint8_t sp2, uint8_t sp3) -> void { putpixel(p, sp3, sp2, sp1, s->format); },
-            [this](int a1, int a2, int b1, int b2, int c) -> auto { return internal::blend(a1, a2, b1, b2, c, g); },
-            cx, cy, cw, ch);
+
+        case 3:
+          if (masks(0xFF0000, 0xFF00, 0xFF)) return FMT_RGB888;
+          if (masks(0xFF, 0xFF00, 0xFF0000)) return FMT_BGR888;
           break;
-        case calcFormatID(1, SUBP_BGR):
-          outputGlyph_HorizontalRGB(
-            sx, sy, img, c.b(), c.g(), c.r(), c.a(), (uint8_t*)s->pixels, s->pitch, s->format->BytesPerPixel, s->w, s->h,
-            [](const uint8_t * p) -> auto { return std::make_tuple(p[0], p[1], p[2]); },
-            [](uint8_t * p, uint8_t sp1, uint8_t sp2, uint8_t sp3) -> void { p[0] = sp1; p[1] = sp2; p[2] = sp3; },
-            [this](int a1, int a2, int b1, int b2, int c) -> auto { return internal::blend(a1, a2, b1, b2, c, g); },
-            cx, cy, cw, ch);
+
+        case 2:
+          if (masks(0xF800, 0x07E0, 0x001F)) return FMT_RGB565;
+          if (masks(0x001F, 0x07E0, 0xF800)) return FMT_BGR565;
           break;
       }
+
+      return FMT_OTHER;
+    }
+
+    // output a glyph image or a stretched image with the pixel accessor px for the surface,
+    // clipped to cl, see internal/softwareOutput.h
+    template <class I, class P>
+    void outputGlyph(int sx, int sy, const I & img, SubPixelArrangement sp, Color_c c,
+                     SDL_Surface * s, const Clip_c & cl, const P & px)
+    {
+      internal::Target_c t { (uint8_t*)s->pixels, s->pitch, s->format->BytesPerPixel, s->w, s->h };
+      internal::outputGlyph(sx, sy, img, sp, c, t, cl, px, g);
     }
 
   public:
 
-    showSDL(void) : cx(0), cy(0), cw(std::numeric_limits<int>::max()), ch(std::numeric_limits<int>::max())
+    showSDL(void) : threads(1), useLayers(false), gamma(22), clip { 0, 0, std::numeric_limits<int>::max(), std::numeric_limits<int>::max() }
     {
-      g.setGamma(22);
+      g.setGamma(gamma);
     }
 
     /** \brief class used to encapsulate image drawing
@@ -248,38 +264,236 @@ class showSDL
     void showLayout(const TextLayout_c & l, int sx, int sy, SDL_Surface * s,
                     SubPixelArrangement sp = SUBP_NONE, ImageDrawer_c * images = 0)
     {
-      SDL_Rect r;
+      // the pixel accessor is selected once here, so that the output of the glyphs
+      // uses inlined pixel accesses for all common formats
+      switch (getSurfaceFormat(s))
+      {
+        case FMT_XRGB8888: showLayout(l, sx, sy, s, sp, images, internal::PixelXRGB8888_t()); break;
+        case FMT_RGBA8888: showLayout(l, sx, sy, s, sp, images, internal::PixelRGBA8888_t()); break;
+        case FMT_ABGR8888: showLayout(l, sx, sy, s, sp, images, internal::PixelABGR8888_t()); break;
+        case FMT_BGRA8888: showLayout(l, sx, sy, s, sp, images, internal::PixelBGRA8888_t()); break;
+        case FMT_RGB888:   showLayout(l, sx, sy, s, sp, images, internal::PixelRGB888_t()); break;
+        case FMT_BGR888:   showLayout(l, sx, sy, s, sp, images, internal::PixelBGR888_t()); break;
+        case FMT_RGB565:   showLayout(l, sx, sy, s, sp, images, internal::PixelRGB565_t()); break;
+        case FMT_BGR565:   showLayout(l, sx, sy, s, sp, images, internal::PixelBGR565_t()); break;
+        default:           showLayout(l, sx, sy, s, sp, images, PixelSDL_c(s->format)); break;
+      }
+    }
 
-      /* render */
-      for (auto & i : l.getData())
+    /** \brief a layout compiled for repeated output
+     *
+     * showLayout looks up the images of all glyphs in the glyph cache, converts the colours for the
+     * gamma and decides what to do for each command every time a layout is drawn. A draw list keeps
+     * the result of all that, so that drawing a layout that doesn't change again, e.g. in each frame
+     * of an animation, only needs to blend the images. Consecutive commands of the same kind and
+     * colour are merged into runs that are drawn together.
+     *
+     * The list refers to the images within the glyph cache, when the cache removes one of them (or
+     * another image of the same part of the cache) the list is compiled again on the next use. It
+     * is also compiled again, when the gamma, the sub-pixel arrangement or the glyph cache change.
+     * The list belongs to one layout, when the layout changes, call clear. The list can be used
+     * with showSDL and showMemory objects that share their glyph cache.
+     */
+    typedef internal::DrawList_c DrawList_c;
+
+    /** \brief display a single layout using a draw list
+     *
+     * The list is compiled from the whole layout, when it is not valid, and then drawn. The
+     * output is the same as with the other showLayout, except when the shadow layers are switched
+     * on, see setShadowLayers, then the list is not used.
+     *
+     *  \param l layout to draw, the layout the list belongs to
+     *  \param sx x position on the target surface in 1/64th pixels
+     *  \param sy y position on the target surface in 1/64th pixels
+     *  \param s target surface
+     *  \param sp which kind of sub-pixel positioning do you want?
+     *  \param images a pointer to an image drawer class that is used to draw the images, when you give
+     *                a nullptr here, no images will be drawn
+     *  \param dl the draw list of the layout
+     */
+    void showLayout(const TextLayout_c & l, int sx, int sy, SDL_Surface * s,
+                    SubPixelArrangement sp, ImageDrawer_c * images, DrawList_c & dl)
+    {
+      switch (getSurfaceFormat(s))
       {
-        switch (i.command)
-        {
-          case CommandData_c::CMD_GLYPH:
-            outputGlyph(sx+i.x, sy+i.y, cache.getGlyph(i.font, i.glyphIndex, sp, i.blurr), sp, g.forward(i.c), s);
-            break;
+        case FMT_XRGB8888: showLayout(l, sx, sy, s, sp, images, dl, internal::PixelXRGB8888_t()); break;
+        case FMT_RGBA8888: showLayout(l, sx, sy, s, sp, images, dl, internal::PixelRGBA8888_t()); break;
+        case FMT_ABGR8888: showLayout(l, sx, sy, s, sp, images, dl, internal::PixelABGR8888_t()); break;
+        case FMT_BGRA8888: showLayout(l, sx, sy, s, sp, images, dl, internal::PixelBGRA8888_t()); break;
+        case FMT_RGB888:   showLayout(l, sx, sy, s, sp, images, dl, internal::PixelRGB888_t()); break;
+        case FMT_BGR888:   showLayout(l, sx, sy, s, sp, images, dl, internal::PixelBGR888_t()); break;
+        case FMT_RGB565:   showLayout(l, sx, sy, s, sp, images, dl, internal::PixelRGB565_t()); break;
+        case FMT_BGR565:   showLayout(l, sx, sy, s, sp, images, dl, internal::PixelBGR565_t()); break;
+        default:           showLayout(l, sx, sy, s, sp, images, dl, PixelSDL_c(s->format)); break;
+      }
+    }
 
-          case CommandData_c::CMD_RECT:
-            if (i.blurr == 0)
-            {
-              r.x = (i.x+sx+32)/64;
-              r.y = (i.y+sy+32)/64;
-              r.w = (i.x+sx+i.w+32)/64-r.x;
-              r.h = (i.y+sy+i.h+32)/64-r.y;
-              SDL_FillRect(s, &r, SDL_MapRGBA(s->format, i.c.r(), i.c.g(), i.c.b(), i.c.a()));
-            }
-            else
-            {
-              outputGlyph(sx+i.x, sy+i.y, cache.getRect(i.w, i.h, sp, i.blurr), sp, g.forward(i.c), s);
-            }
-            break;
+    /** \brief the coverage of a whole layout, see renderMask */
+    typedef internal::CoverageMask_c CoverageMask_c;
 
-          case CommandData_c::CMD_IMAGE:
-            if (images)
-              images->draw(i.x+sx, i.y+sy, i.w, i.h, s, i.imageURL);
-            break;
+    /** \brief render a layout into a coverage mask
+     *
+     * Layouts that don't change, like labels or menu entries, can be rendered once into a mask
+     * that is then drawn with showMask in a single pass instead of blending glyph by glyph
+     * each time. The mask contains the coverage of all glyphs and rectangles of the layout,
+     * scaled by the alpha value of their colour, the colours themselves are replaced by the
+     * colour given to showMask. Overlapping glyphs don't add up their coverage. Images are
+     * not part of the mask.
+     *
+     * The mask may be kept as long as you like, also after this object is destroyed, copies
+     * of the mask share the image.
+     *
+     * \param l the layout to render
+     * \param sp the sub-pixel arrangement the mask is drawn with
+     * \return the mask
+     */
+    CoverageMask_c renderMask(const TextLayout_c & l, SubPixelArrangement sp = SUBP_NONE)
+    {
+      return CoverageMask_c(l, sp, *cache);
+    }
+
+    /** \brief draw a coverage mask
+     *
+     * When the mask is drawn at whole pixel positions the result is the same as drawing the layout
+     * with all commands in the colour c, as long as the glyphs don't overlap, at other positions the
+     * mask is shifted by sub-pixels.
+     *
+     * \param m the mask, see renderMask
+     * \param sx x position of the origin of the layout on the target surface in 1/64th pixels
+     * \param sy y position of the origin of the layout on the target surface in 1/64th pixels
+     * \param s target surface
+     * \param c the colour of the text
+     * \param opacity additional opacity, multiplied with the alpha value of c
+     */
+    void showMask(const CoverageMask_c & m, int sx, int sy, SDL_Surface * s, Color_c c, uint8_t opacity = 255)
+    {
+      if (m.empty()) return;
+
+      c = Color_c(c.r(), c.g(), c.b(), (c.a() * opacity + 127) / 255);
+
+      switch (getSurfaceFormat(s))
+      {
+        case FMT_XRGB8888: showMask(m, sx, sy, s, c, internal::PixelXRGB8888_t()); break;
+        case FMT_RGBA8888: showMask(m, sx, sy, s, c, internal::PixelRGBA8888_t()); break;
+        case FMT_ABGR8888: showMask(m, sx, sy, s, c, internal::PixelABGR8888_t()); break;
+        case FMT_BGRA8888: showMask(m, sx, sy, s, c, internal::PixelBGRA8888_t()); break;
+        case FMT_RGB888:   showMask(m, sx, sy, s, c, internal::PixelRGB888_t()); break;
+        case FMT_BGR888:   showMask(m, sx, sy, s, c, internal::PixelBGR888_t()); break;
+        case FMT_RGB565:   showMask(m, sx, sy, s, c, internal::PixelRGB565_t()); break;
+        case FMT_BGR565:   showMask(m, sx, sy, s, c, internal::PixelBGR565_t()); break;
+        default:           showMask(m, sx, sy, s, c, PixelSDL_c(s->format)); break;
+      }
+    }
+
+    /** \brief repaint the parts of a surface where a layout changed
+     *
+     * The surface must show the old layout at the given position on top of a uniformly coloured
+     * background. The areas where the new layout looks different (see findDamage) are filled with
+     * the background colour and the new layout is drawn into them, which gives the same result
+     * as filling the whole surface and drawing the new layout, but is much faster when only a
+     * small part changed, e.g. a blinking caret or a counter. Everything is limited to the clip rectangle.
+     *
+     * \param o the layout currently shown on the surface
+     * \param l the new layout
+     * \param sx x position on the target surface in 1/64th pixels
+     * \param sy y position on the target surface in 1/64th pixels
+     * \param s target surface
+     * \param background the colour of the background
+     * \param sp which kind of sub-pixel positioning do you want?
+     * \param images the image drawer, see showLayout, images are clipped with SDL_SetClipRect
+     * \return the repainted areas of the surface, e.g. for SDL_UpdateRects
+     */
+    std::vector<SDL_Rect> showDamage(const TextLayout_c & o, const TextLayout_c & l, int sx, int sy, SDL_Surface * s,
+                                     Color_c background, SubPixelArrangement sp = SUBP_NONE, ImageDrawer_c * images = 0)
+    {
+      std::vector<SDL_Rect> res;
+
+      for (auto & d : findDamage(o, l))
+      {
+        int64_t x0 = internal::div_inf<int64_t>((int64_t)d.x + sx, 64);
+        int64_t y0 = internal::div_inf<int64_t>((int64_t)d.y + sy, 64);
+        int64_t x1 = -internal::div_inf<int64_t>(-((int64_t)d.x + d.w + sx), 64);
+        int64_t y1 = -internal::div_inf<int64_t>(-((int64_t)d.y + d.h + sy), 64);
+
+        x0 = std::max<int64_t>(x0, 0);
+        y0 = std::max<int64_t>(y0, 0);
+        x1 = std::min<int64_t>(x1, s->w);
+        y1 = std::min<int64_t>(y1, s->h);
+
+        if (x1 <= x0 || y1 <= y0) continue;
+
+        auto a = showLayoutIn(l, sx, sy, s, sp, images, Clip_c { (int)x0, (int)y0, (int)(x1-x0), (int)(y1-y0) }, background);
+
+        if (a.w > 0 && a.h > 0)
+        {
+          SDL_Rect r;
+          r.x = a.x;
+          r.y = a.y;
+          r.w = a.w;
+          r.h = a.h;
+          res.push_back(r);
         }
       }
+
+      return res;
+    }
+
+    /** \brief scroll a layout that is shown on a surface by whole pixels
+     *
+     * The surface must show the layout at the position sx, sy on top of a uniformly coloured
+     * background. The content of the surface within the clip rectangle is moved by dx, dy pixels
+     * and only the parts that become visible are filled with the background and drawn, which
+     * gives the same result as filling the area and drawing the layout at sx+64*dx, sy+64*dy.
+     *
+     * \param l the layout
+     * \param sx current x position of the layout on the target surface in 1/64th pixels
+     * \param sy current y position of the layout on the target surface in 1/64th pixels
+     * \param dx the number of pixels to move to the right
+     * \param dy the number of pixels to move down
+     * \param s target surface
+     * \param background the colour of the background
+     * \param sp which kind of sub-pixel positioning do you want?
+     * \param images the image drawer, see showLayout, images are clipped with SDL_SetClipRect
+     */
+    void scrollLayout(const TextLayout_c & l, int sx, int sy, int dx, int dy, SDL_Surface * s,
+                      Color_c background, SubPixelArrangement sp = SUBP_NONE, ImageDrawer_c * images = 0)
+    {
+      Clip_c v = intersect(clip, Clip_c { 0, 0, s->w, s->h });
+
+      if (v.w == 0 || v.h == 0) return;
+
+      sx += 64*dx;
+      sy += 64*dy;
+
+      if (std::abs(dx) >= v.w || std::abs(dy) >= v.h)
+      {
+        showLayoutIn(l, sx, sy, s, sp, images, v, background);
+        return;
+      }
+
+      // the area that keeps its content, just moved
+      Clip_c d { v.x + std::max(dx, 0), v.y + std::max(dy, 0), v.w - std::abs(dx), v.h - std::abs(dy) };
+
+      if (SDL_MUSTLOCK(s)) SDL_LockSurface(s);
+
+      int bpp = s->format->BytesPerPixel;
+      uint8_t * p = (uint8_t*)s->pixels;
+
+      for (int i = 0; i < d.h; i++)
+      {
+        // when moving down, start at the bottom so that no row is overwritten before it is moved
+        int y = dy > 0 ? d.y + d.h - 1 - i : d.y + i;
+        memmove(p + y*s->pitch + d.x*bpp, p + (y-dy)*s->pitch + (d.x-dx)*bpp, d.w*bpp);
+      }
+
+      if (SDL_MUSTLOCK(s)) SDL_UnlockSurface(s);
+
+      // the newly visible rows and columns
+      if (dy != 0)
+        showLayoutIn(l, sx, sy, s, sp, images, Clip_c { v.x, dy > 0 ? v.y : d.y + d.h, v.w, std::abs(dy) }, background);
+
+      if (dx != 0)
+        showLayoutIn(l, sx, sy, s, sp, images, Clip_c { dx > 0 ? v.x : d.x + d.w, d.y, std::abs(dx), d.h }, background);
     }
 
     /** \brief update the gamma value used for output
@@ -292,6 +506,7 @@ class showSDL
     void setGamma(uint8_t gamma = 22)
     {
       g.setGamma(gamma);
+      this->gamma = gamma;
     }
 
     /** \brief set the clip rectangle
@@ -301,6 +516,11 @@ class showSDL
      * are set in such a way that calling it without arguments clears the
      * clip rectangle
      *
+     * For big layouts showLayout only looks at the commands that are within the clip
+     * rectangle, see TextLayout_c::findCommands, so when you show a small part of
+     * a huge layout, e.g. a page of a long document, set the clip rectangle to the
+     * visible area.
+     *
      * \param x x-coordinate of upper left corner
      * \param y y-coordinate of upper left corner
      * \param w width of the clip rectangle
@@ -308,24 +528,653 @@ class showSDL
      */
     void setClipRect(uint16_t x = 0, uint16_t y = 0, uint16_t w = std::numeric_limits<uint16_t>::max(), uint16_t h = std::numeric_limits<uint16_t>::max())
     {
-      cx = x;
-      cy = y;
-      cw = w;
-      ch = h;
+      clip = Clip_c { x, y, w, h };
+    }
+
+    /** \brief set the number of threads used by showLayout
+     *
+     * With more than one thread showLayout splits the target surface into horizontal bands
+     * and draws the bands in parallel. The glyphs of the layout are rendered in parallel as well,
+     * see prepare. The output is exactly the same as with one thread.
+     *
+     * Layouts containing images are always drawn with one thread when an image drawer is
+     * given, as the image drawer might not be thread safe. The same is true for surfaces
+     * that need locking.
+     *
+     * \param num number of threads, 0 uses one thread per processor, the default is 1
+     */
+    void setThreads(size_t num = 0)
+    {
+      threads = num;
+    }
+
+    /** \brief draw the shadows of lines as one image
+     *
+     * The layouter creates a blurred copy of each glyph for text shadows and normally
+     * each of these is rendered, blurred and cached on its own. When this mode is switched on
+     * the consecutive blurred commands with the same colour and radius, e.g. the shadow
+     * of one line, are drawn unblurred into a coverage mask that is blurred once. This is a lot
+     * faster for long texts with shadows and overlapping glyphs don't darken the shadow.
+     *
+     * The images are cached, the same line at a different position reuses its image. The
+     * shadows are always drawn without sub-pixel rendering and may be positioned up to
+     * one pixel differently compared to the normal output.
+     *
+     * \param on true to switch the mode on
+     * \param budget the maximal number of bytes for the cached shadow images
+     */
+    void setShadowLayers(bool on, size_t budget = internal::ShadowLayers_c::defaultBudget)
+    {
+      useLayers = on;
+      layers.setBudget(on ? budget : 0);
     }
 
     /** \brief trims the font cache down to a maximal number of entries
      *
      * the SDL output module keeps a cache of rendered glyphs to speed up the process of
-     * outputting layouts. This cache may get too big on memory. To keep things within limits
-     * you can call this function to remove entries.
+     * outputting layouts. The cache keeps itself within the budget set with setCacheBudget,
+     * but you can call this function to remove additional entries.
      * If there are more entries in the cache the ones that were used the longest time ago are removed
      *
      * \param num maximal number of entries, e.g. 0 completely empties the cache
      */
     void trimCache(size_t num)
     {
-      cache.trim(num);
+      cache->trim(num);
+    }
+
+    /** \brief set the maximal amount of memory for the glyph cache
+     *
+     * The cache accounts the size of each rendered image and automatically removes the
+     * images that were used the longest time ago when the budget is exceeded, so usually
+     * there is no need to call trimCache. The default is 32MB.
+     *
+     * Images that are bigger than the admission limit (e.g. glyphs of huge fonts or with
+     * a big blur radius) are not cached the first time they are drawn, so that they don't
+     * replace many of the smaller glyphs. When the same image is drawn again shortly
+     * after that it will be cached.
+     *
+     * \param bytes the maximal number of bytes for the cache
+     * \param admission images bigger than this number of bytes are only cached when they
+     *        are drawn repeatedly, 0 selects 1/64 of the budget
+     */
+    void setCacheBudget(size_t bytes, size_t admission = 0)
+    {
+      cache->setBudget(bytes);
+      cache->setAdmissionLimit(admission);
+    }
+
+    /** \brief store the glyph images within the cache run length encoded
+     *
+     * Glyphs, especially blurred ones, consist mainly of runs of transparent and
+     * opaque pixels. When compression is on, these runs are stored as one value, so
+     * that more glyphs fit into the cache budget, and when drawing the transparent
+     * runs are skipped and the opaque runs are filled without blending.
+     * The output is the same in both cases. Only the glyphs rendered after the call
+     * are affected, the default is off.
+     *
+     * \param on true to encode the glyph images
+     */
+    void setCacheCompression(bool on)
+    {
+      cache->setCompression(on);
+    }
+
+    /** \brief statistics of the glyph cache, see internal::GlyphCache_c::Statistics_c */
+    typedef internal::GlyphCache_c::Statistics_c CacheStatistics_c;
+
+    /** \brief get information about the state of the glyph cache, like the number of bytes
+     * used and the number of evictions
+     */
+    CacheStatistics_c getCacheStatistics(void) const
+    {
+      return cache->getStatistics();
+    }
+
+    /** \brief render all glyphs of a layout into the glyph cache
+     *
+     * showLayout renders glyphs that are not in the cache one after the other when
+     * it needs them. For big layouts, especially with blurred shadows, this takes a long
+     * time. This function collects all glyphs of the layout that are not yet in the cache and
+     * renders them using several threads, so the following showLayout is fast.
+     *
+     * The glyphs of one font file are rendered by one thread at a time, unless you allow the
+     * font cache to open the files several times with FontCache_c::setMaxFaceInstances. Each
+     * instance costs memory, so this function doesn't do that for you. The blurring is always
+     * done by all threads.
+     *
+     * \param l the layout to prepare
+     * \param sp the sub-pixel arrangement that you will use for showLayout
+     * \param async when true the function returns right away and renders the glyphs in the
+     *        background, e.g. to prepare layouts that will be scrolled into view soon. The glyphs
+     *        are added to the cache by one of the next calls to showLayout after they are finished.
+     *        The layout may be destroyed while the glyphs are rendered
+     * \param threads number of threads to use, 0 uses one thread per processor
+     * \return number of glyphs that are rendered
+     */
+    size_t prepare(const TextLayout_c & l, SubPixelArrangement sp = SUBP_NONE, bool async = false, size_t threads = 0)
+    {
+      return cache->prepare(l, sp, threads, async);
+    }
+
+    /** \brief use a glyph cache file
+     *
+     * The file is mapped into memory and the glyphs within it are used instead of rendering
+     * them again, which makes the first output of a layout after a program start much faster.
+     * Several processes can use the same file at the same time. Glyphs that are not in the file are
+     * rendered as usual and kept in memory, use saveCacheFile to write them into a file.
+     *
+     * Fonts are identified by the content of their font file, so the cache file stays valid
+     * when the font files are moved, it contains only images that were created by
+     * the same version of STLL though.
+     *
+     * Call this function before outputting anything, even when the file doesn't exist
+     * yet, because only then the glyph cache notes the information required to save the glyphs.
+     * You can call it several times to use several files, they are searched in the order they were added.
+     *
+     * \param path the file to use
+     * \return true, when the file could be used, false when it doesn't exist or is not a valid cache file
+     */
+    bool loadCacheFile(const std::string & path)
+    {
+      return cache->addFile(path);
+    }
+
+    /** \brief write the glyph cache into a file
+     *
+     * The file is written into a temporary file first and then renamed, so that other
+     * processes that use the old file are not disturbed.
+     *
+     * \param path the file to write
+     * \param all when true the glyphs of the files added with loadCacheFile are included, when false
+     *        only the glyphs that were rendered by this object and are still in the cache are written,
+     *        which is useful to create a private file in addition to a shared one
+     * \return true on success
+     */
+    bool saveCacheFile(const std::string & path, bool all = true) const
+    {
+      return cache->save(path, all);
+    }
+
+    /** \brief remove all glyphs of a font face from the glyph cache
+     *
+     * The glyph cache identifies font faces by their address. When a font face is
+     * destroyed while there are still glyphs of it in the cache, a new face might
+     * get the same address and would then use the wrong glyphs. Call this function
+     * before a font face is destroyed, e.g. by registering it with
+     * FontCache_c::addEvictionListener. The shadow layers containing glyphs of the face
+     * are removed as well.
+     *
+     * \param face the font face that will be destroyed
+     */
+    void removeFontFace(const FontFace_c * face)
+    {
+      cache->removeFont(face);
+      layers.removeFont(face);
+    }
+
+    /** \brief get the glyph cache of this object
+     *
+     * The cache is thread safe, so it can be given to other output objects with setGlyphCache, e.g.
+     * to the objects of several windows or of several threads, which then render each glyph only once
+     * and share the memory budget. The settings of the cache (budget, compression, cache files) are
+     * shared as well.
+     */
+    std::shared_ptr<internal::GlyphCache_c> getGlyphCache(void) const
+    {
+      return cache;
+    }
+
+    /** \brief use another glyph cache, e.g. the one of another output object, see getGlyphCache
+     *
+     * This must not be called while a layout is drawn
+     *
+     * \param c the cache to use from now on
+     */
+    void setGlyphCache(std::shared_ptr<internal::GlyphCache_c> c)
+    {
+      cache = c;
+    }
+
+  private:
+
+    // fill the area a (limited to the clip rectangle) with the background and draw the layout
+    // into it, returns the area that was drawn
+    Clip_c showLayoutIn(const TextLayout_c & l, int sx, int sy, SDL_Surface * s, SubPixelArrangement sp,
+                        ImageDrawer_c * images, const Clip_c & a, Color_c background)
+    {
+      Clip_c c = intersect(clip, a);
+
+      if (c.w == 0 || c.h == 0) return c;
+
+      SDL_Rect r, sdlClip;
+
+      r.x = c.x;
+      r.y = c.y;
+      r.w = c.w;
+      r.h = c.h;
+
+      SDL_FillRect(s, &r, SDL_MapRGBA(s->format, background.r(), background.g(), background.b(), background.a()));
+
+      // images are drawn by the application, so limit them using the clip rectangle of SDL
+      SDL_GetClipRect(s, &sdlClip);
+
+      Clip_c ic = intersect(c, Clip_c { sdlClip.x, sdlClip.y, sdlClip.w, sdlClip.h });
+      SDL_Rect ir;
+
+      ir.x = ic.x;
+      ir.y = ic.y;
+      ir.w = ic.w;
+      ir.h = ic.h;
+
+      SDL_SetClipRect(s, &ir);
+
+      Clip_c old = clip;
+      clip = c;
+
+      try
+      {
+        showLayout(l, sx, sy, s, sp, images);
+      }
+      catch (...)
+      {
+        clip = old;
+        SDL_SetClipRect(s, &sdlClip);
+        throw;
+      }
+
+      clip = old;
+      SDL_SetClipRect(s, &sdlClip);
+
+      return c;
+    }
+
+    // layouts with at least this number of commands are culled to the clip rectangle
+    // using the index of the layout, for smaller layouts looking at all commands is faster
+    static const size_t minIndexedCommands = 256;
+
+    // fill an unblurred rectangle clipped to cl
+    void fillRect(const CommandData_c & i, int sx, int sy, SDL_Surface * s, const Clip_c & cl)
+    {
+      fillRect(i.x, i.y, i.w, i.h, i.c, sx, sy, s, cl);
+    }
+
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, Color_c c, int sx, int sy, SDL_Surface * s, const Clip_c & cl)
+    {
+      int64_t x0 = ((int64_t)x+sx+32)/64;
+      int64_t y0 = ((int64_t)y+sy+32)/64;
+      int64_t x1 = ((int64_t)x+sx+w+32)/64;
+      int64_t y1 = ((int64_t)y+sy+h+32)/64;
+
+      x0 = std::max<int64_t>({ x0, cl.x, 0 });
+      y0 = std::max<int64_t>({ y0, cl.y, 0 });
+      x1 = std::min<int64_t>({ x1, (int64_t)cl.x + cl.w, s->w });
+      y1 = std::min<int64_t>({ y1, (int64_t)cl.y + cl.h, s->h });
+
+      if (x1 <= x0 || y1 <= y0) return;
+
+      SDL_Rect r;
+
+      r.x = x0;
+      r.y = y0;
+      r.w = x1 - x0;
+      r.h = y1 - y0;
+
+      SDL_FillRect(s, &r, SDL_MapRGBA(s->format, c.r(), c.g(), c.b(), c.a()));
+    }
+
+    // the rows of the surface a command may draw into, img is the image of a glyph
+    // or blurred rectangle, without image for the other commands
+    static std::pair<int, int> commandRows(const CommandData_c & i, const internal::SlicedImage_c & img, int sy)
+    {
+      if (img.image)
+        return internal::DrawList_c::imageRows(i.y, img, sy);
+
+      if (i.command == CommandData_c::CMD_RECT)
+        return internal::DrawList_c::rectRows(i.y, i.h, sy);
+
+      return std::make_pair(0, 0);
+    }
+
+    // find the commands of big layouts that are visible within the clip rectangle,
+    // returns false when all commands are to be drawn
+    bool findVisible(const TextLayout_c & l, int sx, int sy, SDL_Surface * s, std::vector<size_t> & visible) const
+    {
+      if (l.getData().size() < minIndexedCommands) return false;
+
+      auto clamp = [](int64_t v) -> int
+      {
+        return std::min<int64_t>(std::max<int64_t>(v, std::numeric_limits<int>::min()), std::numeric_limits<int>::max());
+      };
+
+      int64_t x0 = std::max(clip.x, 0);
+      int64_t y0 = std::max(clip.y, 0);
+      int64_t x1 = std::min<int64_t>((int64_t)clip.x + clip.w, s->w);
+      int64_t y1 = std::min<int64_t>((int64_t)clip.y + clip.h, s->h);
+
+      TextLayout_c::Rectangle_c r;
+
+      r.x = clamp(x0*64 - sx);
+      r.y = clamp(y0*64 - sy);
+      r.w = clamp(std::max<int64_t>(0, x1 - x0)*64);
+      r.h = clamp(std::max<int64_t>(0, y1 - y0)*64);
+
+      visible = l.findCommands(r);
+      return true;
+    }
+
+    // the output of a mask with the pixel accessor px for the surface
+    template <class P>
+    void showMask(const CoverageMask_c & m, int sx, int sy, SDL_Surface * s, Color_c c, const P & px)
+    {
+      outputGlyph(sx, sy, m.getImage(), m.getSubPixelArrangement(), g.forward(c), s, clip, px);
+    }
+
+    // the output of a layout with the pixel accessor px for the surface
+    template <class P>
+    void showLayout(const TextLayout_c & l, int sx, int sy, SDL_Surface * s,
+                    SubPixelArrangement sp, ImageDrawer_c * images, const P & px)
+    {
+      auto & data = l.getData();
+      std::vector<size_t> visible;
+      bool culled = findVisible(l, sx, sy, s, visible);
+
+      // the images of the cache must stay valid until they are drawn, also when
+      // the cache is shared with other threads
+      internal::GlyphCache_c::Hold_c hold(*cache);
+
+      // the shadows of lines that are drawn as one image, the commands are in visible
+      std::vector<internal::ShadowGroup_c> groups;
+
+      if (useLayers)
+      {
+        if (!culled)
+        {
+          visible.resize(data.size());
+          std::iota(visible.begin(), visible.end(), 0);
+          culled = true;
+        }
+
+        groups = internal::ShadowLayers_c::findGroups(l, visible);
+
+        for (auto & gr : groups)
+          gr.image = layers.getImage(l, gr.dataFirst, gr.dataLast, *cache);
+      }
+
+      // call f for all commands that need to be drawn in their order
+      auto forCommands = [&](auto f)
+      {
+        if (culled)
+          for (auto n : visible)
+            f(data[n]);
+        else
+          for (auto & i : data)
+            f(i);
+      };
+
+      size_t t = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+
+      if (t > 1 && !SDL_MUSTLOCK(s) && s->h > 0)
+      {
+        bool hasImages = false;
+
+        if (images)
+          forCommands([&hasImages](const CommandData_c & i) {
+            if (i.command == CommandData_c::CMD_IMAGE) hasImages = true; });
+
+        if (!hasImages)
+        {
+          if (!culled)
+          {
+            visible.resize(data.size());
+            std::iota(visible.begin(), visible.end(), 0);
+          }
+
+          showLayoutBanded(l, visible, groups, sx, sy, s, sp, t, px);
+          layers.trim();
+          return;
+        }
+      }
+
+      /* render */
+      auto draw = [&](const CommandData_c & i)
+      {
+        switch (i.command)
+        {
+          case CommandData_c::CMD_GLYPH:
+            outputGlyph(sx+i.x, sy+i.y, cache->getGlyph(i.font, i.glyphIndex, sp, i.blurr), sp, g.forward(i.c), s, clip, px);
+            break;
+
+          case CommandData_c::CMD_RECT:
+            if (i.blurr == 0)
+            {
+              fillRect(i, sx, sy, s, clip);
+            }
+            else
+            {
+              outputGlyph(sx+i.x, sy+i.y, cache->getRect(i.w, i.h, sp, i.blurr), sp, g.forward(i.c), s, clip, px);
+            }
+            break;
+
+          case CommandData_c::CMD_IMAGE:
+            if (images)
+              images->draw(i.x+sx, i.y+sy, i.w, i.h, s, i.imageURL);
+            break;
+        }
+      };
+
+      if (groups.empty())
+      {
+        forCommands(draw);
+        return;
+      }
+
+      size_t gn = 0;
+
+      for (size_t n = 0; n < visible.size(); )
+      {
+        if (gn < groups.size() && groups[gn].first == n)
+        {
+          auto & gr = groups[gn++];
+
+          if (gr.image)
+          {
+            auto & a = data[gr.dataFirst];
+            outputGlyph(sx+a.x, sy+a.y, *gr.image, SUBP_NONE, g.forward(a.c), s, clip, px);
+            n = gr.last;
+            continue;
+          }
+        }
+
+        draw(data[visible[n]]);
+        n++;
+      }
+
+      layers.trim();
+    }
+
+    // one command to draw in a band: img is the image for glyphs, blurred rectangles and shadow
+    // groups, without image for the others, c is nullptr for commands drawn as part of a group
+    class BandItem_c
+    {
+      public:
+        const CommandData_c * c;
+        internal::SlicedImage_c img;
+        SubPixelArrangement sp;
+    };
+
+    // the output of the commands with the indices in cmds using t threads: the surface is split
+    // into horizontal bands, each command is added to all bands it touches keeping the order of
+    // the commands and the bands are drawn in parallel, each with the clip rectangle limited
+    // to the band. As a pixel only depends on the commands that draw into it and their
+    // order the result is the same as when drawing everything at once
+    template <class P>
+    void showLayoutBanded(const TextLayout_c & l, const std::vector<size_t> & cmds,
+                          const std::vector<internal::ShadowGroup_c> & groups, int sx, int sy, SDL_Surface * s,
+                          SubPixelArrangement sp, size_t t, const P & px)
+    {
+      auto & data = l.getData();
+
+      std::vector<BandItem_c> items(cmds.size());
+
+      for (size_t n = 0; n < cmds.size(); n++)
+        items[n] = BandItem_c { &data[cmds[n]], internal::SlicedImage_c(), sp };
+
+      // the commands of groups are replaced by the image of the group at the first command
+      for (auto & gr : groups)
+        if (gr.image)
+        {
+          for (size_t n = gr.first; n < gr.last; n++)
+            items[n].c = nullptr;
+
+          items[gr.first] = BandItem_c { &data[gr.dataFirst], internal::SlicedImage_c(*gr.image), SUBP_NONE };
+        }
+
+      // the missing glyphs are rendered in parallel before they are requested, the
+      // cache is held by showLayout
+
+      if (groups.empty())
+      {
+        cache->prepare(l, cmds, sp, t, false);
+      }
+      else
+      {
+        std::vector<size_t> prep;
+
+        for (size_t n = 0; n < cmds.size(); n++)
+          if (items[n].c && !items[n].img.image)
+            prep.push_back(cmds[n]);
+
+        cache->prepare(l, prep, sp, t, false);
+      }
+
+      for (auto & it : items)
+      {
+        if (!it.c || it.img.image) continue;
+
+        auto & i = *it.c;
+
+        if (i.command == CommandData_c::CMD_GLYPH)
+          it.img = internal::SlicedImage_c(cache->getGlyph(i.font, i.glyphIndex, sp, i.blurr));
+        else if (i.command == CommandData_c::CMD_RECT && i.blurr != 0)
+          it.img = cache->getRect(i.w, i.h, sp, i.blurr);
+      }
+
+      int bh = internal::bandHeight(s->h, t);
+      std::vector<std::vector<size_t>> bands((s->h + bh - 1) / bh);
+
+      for (size_t n = 0; n < cmds.size(); n++)
+      {
+        if (!items[n].c) continue;
+
+        auto rows = commandRows(*items[n].c, items[n].img, sy);
+
+        int y0 = std::max(rows.first, 0);
+        int y1 = std::min(rows.second, s->h);
+
+        for (int b = y0 / bh; y0 < y1 && b <= (y1-1) / bh; b++)
+          bands[b].push_back(n);
+      }
+
+      internal::forBands(bands.size(), t, [&](size_t b)
+      {
+        Clip_c cl = internal::bandClip(clip, b * bh, (b+1) * bh);
+
+        if (cl.h == 0) return;
+
+        for (auto n : bands[b])
+        {
+          auto & it = items[n];
+          auto & i = *it.c;
+
+          if (it.img.image)
+            outputGlyph(sx+i.x, sy+i.y, it.img, it.sp, g.forward(i.c), s, cl, px);
+          else
+            fillRect(i, sx, sy, s, cl);
+        }
+      });
+    }
+
+    // the output of a layout using a draw list with the pixel accessor px for the surface
+    template <class P>
+    void showLayout(const TextLayout_c & l, int sx, int sy, SDL_Surface * s,
+                    SubPixelArrangement sp, ImageDrawer_c * images, internal::DrawList_c & dl, const P & px)
+    {
+      // the images of the shadow layers are not part of the list
+      if (useLayers)
+      {
+        showLayout(l, sx, sy, s, sp, images, px);
+        return;
+      }
+
+      size_t t = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+
+      // the cache is held before the list is checked, so that the images the list refers
+      // to stay valid while it is drawn
+      internal::GlyphCache_c::Hold_c hold(*cache);
+
+      if (!dl.valid(cache, sp, gamma))
+        dl.compile(l, sp, cache, t, g, gamma);
+
+      if (t > 1 && !SDL_MUSTLOCK(s) && s->h > 0 && !(images && dl.hasImages()))
+      {
+        showListBanded(dl, sx, sy, s, sp, t, px);
+        return;
+      }
+
+      // the rows that can be drawn into, the runs are skipped item by item outside of them
+      int top = std::max(clip.y, 0);
+      int bottom = std::min<int64_t>((int64_t)clip.y + clip.h, s->h);
+
+      auto & items = dl.getItems();
+
+      for (auto & r : dl.getRuns())
+      {
+        switch (r.kind)
+        {
+          case internal::DrawList_c::RUN_GLYPHS:
+            for (uint32_t n = r.first; n < r.last; n++)
+            {
+              auto & i = items[n];
+              auto rows = internal::DrawList_c::rows(r, i, sy);
+
+              if (rows.second > top && rows.first < bottom)
+                outputGlyph(sx+i.x, sy+i.y, i.img, sp, r.fc, s, clip, px);
+            }
+            break;
+
+          case internal::DrawList_c::RUN_RECTS:
+            for (uint32_t n = r.first; n < r.last; n++)
+            {
+              auto & i = items[n];
+              fillRect(i.x, i.y, i.w, i.h, r.c, sx, sy, s, clip);
+            }
+            break;
+
+          case internal::DrawList_c::RUN_IMAGES:
+            if (images)
+              for (uint32_t n = r.first; n < r.last; n++)
+              {
+                auto & i = items[n];
+                images->draw(i.x+sx, i.y+sy, i.w, i.h, s, dl.getURL(i));
+              }
+            break;
+        }
+      }
+    }
+
+    // the output of a draw list using t threads, the same as showLayoutBanded
+    template <class P>
+    void showListBanded(const internal::DrawList_c & dl, int sx, int sy, SDL_Surface * s,
+                        SubPixelArrangement sp, size_t t, const P & px)
+    {
+      internal::Target_c target { (uint8_t*)s->pixels, s->pitch, s->format->BytesPerPixel, s->w, s->h };
+
+      internal::showListBanded(dl, sx, sy, target, clip, sp, t, px, g,
+        [&](const internal::DrawList_c::Item_c & i, Color_c c, const Clip_c & cl)
+        {
+          fillRect(i.x, i.y, i.w, i.h, c, sx, sy, s, cl);
+        });
     }
 };
 
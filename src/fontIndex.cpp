@@ -0,0 +1,461 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#include <stll/fontIndex.h>
+
+#include <stll/layouterCSS.h>
+#include <stll/utf-8.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_SFNT_NAMES_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_IDS_H
+
+#include <fstream>
+#include <algorithm>
+#include <set>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace STLL {
+
+// catalogue files start with this magic and version, when the format changes, increase
+// the version, old catalogues will then simply be rebuilt
+static const char catalogueMagic[8] = { 'S', 'T', 'L', 'L', 'F', 'I', 'D', 'X' };
+static const uint32_t catalogueVersion = 1;
+
+bool FontIndexEntry_c::mayContain(char32_t ch) const
+{
+  uint32_t block = ch >> 8;
+
+  // find the first range that ends at or behind the block
+  auto i = std::lower_bound(coverage.begin(), coverage.end(), block,
+                            [](const std::pair<uint16_t, uint16_t> & r, uint32_t b) { return r.second < b; });
+
+  return i != coverage.end() && i->first <= block;
+}
+
+// the file types that FreeType can open
+static bool isFontFile(const std::string & name)
+{
+  static const char * extensions[] = { ".ttf", ".otf", ".ttc", ".otc", ".pfa", ".pfb", ".woff", ".woff2" };
+
+  auto dot = name.rfind('.');
+  if (dot == std::string::npos) return false;
+
+  std::string ext = name.substr(dot);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+  for (auto e : extensions)
+    if (ext == e)
+      return true;
+
+  return false;
+}
+
+void FontIndex_c::walk(const std::string & directory, std::map<std::string, std::pair<uint64_t, int64_t>> & found,
+                       std::vector<std::pair<uint64_t, uint64_t>> & visited) const
+{
+  struct stat st;
+
+  if (stat(directory.c_str(), &st) != 0) return;
+
+  auto id = std::make_pair((uint64_t)st.st_dev, (uint64_t)st.st_ino);
+  if (std::find(visited.begin(), visited.end(), id) != visited.end()) return;
+  visited.push_back(id);
+
+  DIR * d = opendir(directory.c_str());
+  if (!d) return;
+
+  while (dirent * e = readdir(d))
+  {
+    std::string name = e->d_name;
+
+    if (name == "." || name == "..") continue;
+
+    std::string path = directory + "/" + name;
+
+    if (stat(path.c_str(), &st) != 0) continue;
+
+    if (S_ISDIR(st.st_mode))
+    {
+      walk(path, found, visited);
+    }
+    else if (S_ISREG(st.st_mode) && isFontFile(name))
+    {
+      found[path] = std::make_pair((uint64_t)st.st_size, (int64_t)st.st_mtime);
+    }
+  }
+
+  closedir(d);
+}
+
+// get an english name from the name table of the font, an empty string, when
+// it is not available
+static std::string getSfntName(FT_Face f, FT_UShort id)
+{
+  FT_UInt cnt = FT_Get_Sfnt_Name_Count(f);
+
+  for (FT_UInt i = 0; i < cnt; i++)
+  {
+    FT_SfntName n;
+
+    if (FT_Get_Sfnt_Name(f, i, &n)) continue;
+
+    if (   n.name_id == id
+        && n.platform_id == TT_PLATFORM_MICROSOFT
+        && n.encoding_id == TT_MS_ID_UNICODE_CS
+        && n.language_id == TT_MS_LANGID_ENGLISH_UNITED_STATES)
+    {
+      // the string is UTF-16 big endian
+      std::string result;
+
+      for (FT_UInt j = 0; j+1 < n.string_len; j += 2)
+      {
+        char32_t c = (n.string[j] << 8) | n.string[j+1];
+
+        if (c >= 0xD800 && c < 0xDC00 && j+3 < n.string_len)
+        {
+          char32_t c2 = (n.string[j+2] << 8) | n.string[j+3];
+          c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+          j += 2;
+        }
+
+        result += U32ToUTF8(c);
+      }
+
+      return result;
+    }
+  }
+
+  return "";
+}
+
+void FontIndex_c::index(FontIndexEntry_c & e) const
+{
+  e.family.clear();
+  e.coverage.clear();
+
+  FT_Face f;
+
+  try
+  {
+    f = lib->newFace(internal::FontFileResource_c(e.path));
+  }
+  catch (FreetypeException_c &)
+  {
+    // keep the entry with an empty family, so that we don't try again
+    // until the file changes
+    return;
+  }
+
+  // prefer the typographic names, they group all weights into one family
+  // the normal family names often contain the weight for fonts with many weights
+  e.family = getSfntName(f, 16);
+  std::string styleName = getSfntName(f, 17);
+
+  if (e.family.empty() && f->family_name) e.family = f->family_name;
+  if (styleName.empty() && f->style_name) styleName = f->style_name;
+
+  if (f->style_flags & FT_STYLE_FLAG_ITALIC)
+    e.style = (styleName.find("Oblique") != std::string::npos) ? "oblique" : "italic";
+  else
+    e.style = "normal";
+
+  if (   styleName.find("Small Caps") != std::string::npos
+      || styleName.find("SmallCaps") != std::string::npos)
+    e.variant = "small-caps";
+  else
+    e.variant = "normal";
+
+  e.weight = (f->style_flags & FT_STYLE_FLAG_BOLD) ? "bold" : "normal";
+  e.stretch = "normal";
+
+  if (TT_OS2 * os2 = static_cast<TT_OS2*>(FT_Get_Sfnt_Table(f, FT_SFNT_OS2)))
+  {
+    unsigned int w = os2->usWeightClass;
+
+    // some old fonts use the values 1 to 9
+    if (w < 10) w *= 100;
+    w = std::min(900u, std::max(100u, (w + 50) / 100 * 100));
+
+    // fonts marked as bold are the bold member of their family, even when their
+    // weight class is not exactly 700, so keep bold for them
+    if (f->style_flags & FT_STYLE_FLAG_BOLD)
+      e.weight = "bold";
+    else if (w == 400)
+      e.weight = "normal";
+    else if (w == 700)
+      e.weight = "bold";
+    else
+      e.weight = std::to_string(w);
+
+    static const char * stretches[] = { "ultra-condensed", "extra-condensed", "condensed", "semi-condensed",
+      "normal", "semi-expanded", "expanded", "extra-expanded", "ultra-expanded" };
+
+    if (os2->usWidthClass >= 1 && os2->usWidthClass <= 9)
+      e.stretch = stretches[os2->usWidthClass-1];
+  }
+
+  // collect the blocks that contain characters
+  FT_UInt gi;
+  FT_ULong c = FT_Get_First_Char(f, &gi);
+
+  while (gi != 0)
+  {
+    uint16_t block = c >> 8;
+
+    if (!e.coverage.empty() && (e.coverage.back().second == block || e.coverage.back().second+1 == block))
+      e.coverage.back().second = block;
+    else
+      e.coverage.push_back(std::make_pair(block, block));
+
+    c = FT_Get_Next_Char(f, c, &gi);
+  }
+
+  lib->doneFace(f);
+}
+
+size_t FontIndex_c::scan(const std::string & directory)
+{
+  std::map<std::string, std::pair<uint64_t, int64_t>> found;
+  std::vector<std::pair<uint64_t, uint64_t>> visited;
+
+  std::string dir = directory;
+  while (dir.size() > 1 && dir.back() == '/') dir.pop_back();
+
+  walk(dir, found, visited);
+
+  size_t changes = 0;
+
+  // remove all entries below the directory that are gone
+  std::string prefix = dir + "/";
+
+  for (auto i = entries.lower_bound(prefix); i != entries.end() && i->first.compare(0, prefix.size(), prefix) == 0; )
+  {
+    if (found.find(i->first) == found.end())
+    {
+      i = entries.erase(i);
+      changes++;
+    }
+    else
+    {
+      ++i;
+    }
+  }
+
+  // add new and changed entries
+  for (auto & f : found)
+  {
+    auto i = entries.find(f.first);
+
+    if (i != entries.end() && i->second.fileSize == f.second.first && i->second.mtime == f.second.second)
+      continue;
+
+    FontIndexEntry_c e;
+    e.path = f.first;
+    e.fileSize = f.second.first;
+    e.mtime = f.second.second;
+
+    index(e);
+
+    entries[f.first] = std::move(e);
+    changes++;
+  }
+
+  return changes;
+}
+
+// helpers to write and read the catalogue, all numbers are stored little endian
+
+static void writeInt(std::ostream & o, uint64_t v, int bytes)
+{
+  for (int i = 0; i < bytes; i++)
+  {
+    o.put(static_cast<char>(v & 0xFF));
+    v >>= 8;
+  }
+}
+
+static void writeString(std::ostream & o, const std::string & s)
+{
+  writeInt(o, s.size(), 4);
+  o.write(s.data(), s.size());
+}
+
+static uint64_t readInt(std::istream & i, int bytes)
+{
+  uint64_t v = 0;
+
+  for (int b = 0; b < bytes; b++)
+    v |= static_cast<uint64_t>(static_cast<uint8_t>(i.get())) << (8*b);
+
+  return v;
+}
+
+static std::string readString(std::istream & i)
+{
+  uint32_t len = readInt(i, 4);
+
+  // guard against broken files, no string in there will be that long
+  if (!i || len > 0x10000)
+  {
+    i.setstate(std::ios::failbit);
+    return "";
+  }
+
+  std::string s(len, ' ');
+  i.read(&s[0], len);
+
+  return s;
+}
+
+bool FontIndex_c::save(const std::string & catalogue) const
+{
+  std::ofstream o(catalogue, std::ios::binary | std::ios::trunc);
+
+  if (!o) return false;
+
+  o.write(catalogueMagic, sizeof(catalogueMagic));
+  writeInt(o, catalogueVersion, 4);
+  writeInt(o, entries.size(), 4);
+
+  for (auto & i : entries)
+  {
+    auto & e = i.second;
+
+    writeString(o, e.path);
+    writeInt(o, e.fileSize, 8);
+    writeInt(o, e.mtime, 8);
+    writeString(o, e.family);
+    writeString(o, e.style);
+    writeString(o, e.variant);
+    writeString(o, e.weight);
+    writeString(o, e.stretch);
+
+    writeInt(o, e.coverage.size(), 4);
+
+    for (auto & c : e.coverage)
+    {
+      writeInt(o, c.first, 2);
+      writeInt(o, c.second, 2);
+    }
+  }
+
+  return (bool)o;
+}
+
+bool FontIndex_c::load(const std::string & catalogue)
+{
+  entries.clear();
+
+  std::ifstream i(catalogue, std::ios::binary);
+
+  if (!i) return false;
+
+  char magic[sizeof(catalogueMagic)];
+  i.read(magic, sizeof(magic));
+
+  if (!i || !std::equal(magic, magic+sizeof(magic), catalogueMagic)) return false;
+  if (readInt(i, 4) != catalogueVersion) return false;
+
+  uint32_t cnt = readInt(i, 4);
+
+  for (uint32_t n = 0; n < cnt && i; n++)
+  {
+    FontIndexEntry_c e;
+
+    e.path = readString(i);
+    e.fileSize = readInt(i, 8);
+    e.mtime = readInt(i, 8);
+    e.family = readString(i);
+    e.style = readString(i);
+    e.variant = readString(i);
+    e.weight = readString(i);
+    e.stretch = readString(i);
+
+    uint32_t ranges = readInt(i, 4);
+
+    // there are at most 0x1100 blocks, so there can't be more ranges
+    if (ranges > 0x1100) break;
+
+    e.coverage.resize(ranges);
+
+    for (auto & c : e.coverage)
+    {
+      c.first = readInt(i, 2);
+      c.second = readInt(i, 2);
+    }
+
+    if (i) entries[e.path] = std::move(e);
+  }
+
+  if (!i || entries.size() != cnt)
+  {
+    entries.clear();
+    return false;
+  }
+
+  return true;
+}
+
+std::vector<std::string> FontIndex_c::getFamilies(void) const
+{
+  std::set<std::string> families;
+
+  for (auto & e : entries)
+    if (e.second.isFont())
+      families.insert(e.second.family);
+
+  return std::vector<std::string>(families.begin(), families.end());
+}
+
+size_t FontIndex_c::addToFamily(const std::string & family, FontFamily_c & f) const
+{
+  size_t cnt = 0;
+
+  for (auto & e : entries)
+    if (e.second.isFont() && e.second.family == family)
+    {
+      f.addFont(FontResource_c(e.second.path), e.second.style, e.second.variant, e.second.weight, e.second.stretch);
+      cnt++;
+    }
+
+  return cnt;
+}
+
+size_t FontIndex_c::addToStyleSheet(TextStyleSheet_c & s) const
+{
+  size_t cnt = 0;
+
+  for (auto & e : entries)
+    if (e.second.isFont())
+    {
+      s.addFont(e.second.family, FontResource_c(e.second.path), e.second.style, e.second.variant, e.second.weight, e.second.stretch);
+      cnt++;
+    }
+
+  return cnt;
+}
+
+}
@@ -26,27 +26,38 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 
 namespace STLL {
 
 static std::map<std::string, std::shared_ptr<internal::HyphenDict<char32_t>>> dictionaries;
 
+// layouts running in several threads read the dictionaries, adding a dictionary writes
+static std::shared_timed_mutex dictionariesMutex;
+
 void addHyphenDictionary(const std::vector<std::string> & langs, std::istream & str)
 {
   auto dict = std::make_shared<internal::HyphenDict<char32_t>>(str);
+
+  std::unique_lock<std::shared_timed_mutex> lock(dictionariesMutex);
   for (auto & l : langs) dictionaries[l] = dict;
 }
 
 void addHyphenDictionary(const std::vector<std::string> & langs, std::istream && str)
 {
   auto dict = std::make_shared<internal::HyphenDict<char32_t>>(str);
+
+  std::unique_lock<std::shared_timed_mutex> lock(dictionariesMutex);
   for (auto & l : langs) dictionaries[l] = dict;
 }
 
 namespace internal {
 
-const HyphenDict<char32_t> * getHyphenDict(const std::string & lang)
+std::shared_ptr<const HyphenDict<char32_t>> getHyphenDict(const std::string & lang)
 {
+  std::shared_lock<std::shared_timed_mutex> lock(dictionariesMutex);
+
   std::string l = lang;
 
   while (!l.empty())
@@ -55,7 +66,7 @@ const HyphenDict<char32_t> * getHyphenDict(const std::string & lang)
 
     if (d != dictionaries.end())
     {
-      return d->second.get();
+      return d->second;
     }
 
     auto p = lang.find_last_of('-');
@@ -24,11 +24,14 @@
 
 #include "hyphen/hyphen.h"
 #include <string>
+#include <memory>
 #include <cstdint>
 
 namespace STLL { namespace internal {
 
-const HyphenDict<char32_t> * getHyphenDict(const std::string & lang);
+// get the dictionary for a language, the returned pointer keeps the dictionary alive, even
+// when it is replaced by another one while it is used
+std::shared_ptr<const HyphenDict<char32_t>> getHyphenDict(const std::string & lang);
 
 } }
 
@@ -0,0 +1,312 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include <stll/internal/layoutIndex.h>
+#include <stll/internal/blurr.h>
+#include <stll/layouter.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace STLL { namespace internal {
+
+// buckets are at least 16 pixels high
+static const int minShift = 10;
+
+// commands spanning more buckets than this go into the list of tall commands
+static const int64_t maxSpan = 8;
+
+// additional space around glyphs for rounding and sub-pixel filtering, in 1/64 pixels
+static const int64_t glyphMargin = 3*64;
+
+// space around blurred images, the reduced resolution images of big blurrs on the
+// OpenGL atlas may be up to one scaled pixel bigger
+static int64_t blurrMargin(uint16_t blurr)
+{
+  return blurr ? (int64_t)(gaussBlurrDist(blurr/64.0) + gaussBlurrScale(blurr/64.0))*64 : 0;
+}
+
+CommandBox_c commandBox(const CommandData_c & i)
+{
+  CommandBox_c b { i.x, i.y, (int64_t)i.x + i.w, (int64_t)i.y + i.h };
+  int64_t m = 64;
+
+  switch (i.command)
+  {
+    case CommandData_c::CMD_GLYPH:
+      {
+        int32_t l, t, r, bt;
+        std::tie(l, t, r, bt) = i.font->getBoundingBox();
+
+        b = CommandBox_c { (int64_t)i.x + l, (int64_t)i.y + t, (int64_t)i.x + r, (int64_t)i.y + bt };
+        m = glyphMargin + blurrMargin(i.blurr);
+      }
+      break;
+
+    case CommandData_c::CMD_RECT:
+      m += blurrMargin(i.blurr);
+      break;
+
+    case CommandData_c::CMD_IMAGE:
+      break;
+  }
+
+  b.x0 -= m;
+  b.y0 -= m;
+  b.x1 += m;
+  b.y1 += m;
+
+  return b;
+}
+
+LayoutIndex_c::LayoutIndex_c(const std::vector<CommandData_c> & data) : top(0), shift(minShift)
+{
+  boxes.reserve(data.size());
+
+  int64_t bottom = 0;
+  int64_t heights = 0;
+
+  for (auto & i : data)
+  {
+    auto b = commandBox(i);
+
+    if (boxes.empty() || b.y0 < top) top = b.y0;
+    if (boxes.empty() || b.y1 > bottom) bottom = b.y1;
+    heights += b.y1 - b.y0;
+
+    boxes.push_back(b);
+  }
+
+  if (boxes.empty()) return;
+
+  // buckets about as high as the average command, but not more buckets
+  // than a few per command
+  while (((int64_t)1 << shift) < heights / (int64_t)boxes.size()) shift++;
+  while (((bottom - top) >> shift) > 2 * (int64_t)boxes.size() + 16) shift++;
+
+  buckets.resize(((bottom - top) >> shift) + 1);
+
+  for (size_t n = 0; n < boxes.size(); n++)
+  {
+    int64_t b0 = (boxes[n].y0 - top) >> shift;
+    int64_t b1 = (boxes[n].y1 - 1 - top) >> shift;
+
+    if (b1 - b0 >= maxSpan)
+      tall.push_back(n);
+    else
+      for (int64_t b = b0; b <= b1; b++)
+        buckets[b].push_back(n);
+  }
+}
+
+std::vector<size_t> LayoutIndex_c::find(int64_t x0, int64_t y0, int64_t x1, int64_t y1) const
+{
+  std::vector<size_t> res;
+
+  if (x1 <= x0 || y1 <= y0 || boxes.empty()) return res;
+
+  auto add = [&](uint32_t n)
+  {
+    auto & b = boxes[n];
+
+    if (b.x0 < x1 && b.x1 > x0 && b.y0 < y1 && b.y1 > y0)
+      res.push_back(n);
+  };
+
+  int64_t b0 = std::max<int64_t>(0, (y0 - top) >> shift);
+  int64_t b1 = std::min<int64_t>(buckets.size() - 1, (y1 - 1 - top) >> shift);
+
+  for (int64_t b = b0; b <= b1; b++)
+    for (auto n : buckets[b])
+      add(n);
+
+  for (auto n : tall)
+    add(n);
+
+  // commands touching several buckets are found more than once
+  std::sort(res.begin(), res.end());
+  res.erase(std::unique(res.begin(), res.end()), res.end());
+
+  return res;
+}
+
+} }
+
+namespace STLL {
+
+std::vector<size_t> TextLayout_c::findCommands(const Rectangle_c & r) const
+{
+  std::shared_ptr<const internal::LayoutIndex_c> i;
+
+  {
+    std::lock_guard<std::mutex> lock(indexMutex);
+
+    if (!index)
+      index = std::make_shared<internal::LayoutIndex_c>(data);
+
+    i = index;
+  }
+
+  return i->find(r.x, r.y, (int64_t)r.x + r.w, (int64_t)r.y + r.h);
+}
+
+}
+
+namespace STLL {
+
+// damage is merged into at most this number of rectangles
+static const size_t maxDamageRects = 16;
+
+static bool sameCommand(const CommandData_c & a, const CommandData_c & b)
+{
+  return a.command == b.command && a.x == b.x && a.y == b.y && a.glyphIndex == b.glyphIndex &&
+         a.font == b.font && a.w == b.w && a.h == b.h && a.c == b.c && a.blurr == b.blurr &&
+         a.imageURL == b.imageURL;
+}
+
+static bool touches(const internal::CommandBox_c & a, const internal::CommandBox_c & b)
+{
+  return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+}
+
+static void unite(internal::CommandBox_c & a, const internal::CommandBox_c & b)
+{
+  a.x0 = std::min(a.x0, b.x0);
+  a.y0 = std::min(a.y0, b.y0);
+  a.x1 = std::max(a.x1, b.x1);
+  a.y1 = std::max(a.y1, b.y1);
+}
+
+// merge boxes that touch until all boxes are separate
+static void mergeBoxes(std::vector<internal::CommandBox_c> & boxes)
+{
+  std::vector<internal::CommandBox_c> res;
+
+  for (auto b : boxes)
+  {
+    // the boxes in res don't touch each other, the boxes behind end have been compared
+    // with b, b takes over the boxes it touches and only when that makes b bigger the
+    // boxes compared so far need to be compared again
+    size_t end = res.size();
+
+    while (end > 0)
+    {
+      end--;
+
+      if (touches(res[end], b))
+      {
+        auto old = b;
+        unite(b, res[end]);
+
+        res[end] = res.back();
+        res.pop_back();
+
+        if (old.x0 != b.x0 || old.y0 != b.y0 || old.x1 != b.x1 || old.y1 != b.y1)
+          end = res.size();
+      }
+    }
+
+    res.push_back(b);
+  }
+
+  boxes.swap(res);
+}
+
+std::vector<TextLayout_c::Rectangle_c> findDamage(const TextLayout_c & a, const TextLayout_c & b)
+{
+  auto & da = a.getData();
+  auto & db = b.getData();
+
+  // skip the common start and end
+  size_t s = 0;
+  while (s < da.size() && s < db.size() && sameCommand(da[s], db[s])) s++;
+
+  size_t ea = da.size();
+  size_t eb = db.size();
+  while (ea > s && eb > s && sameCommand(da[ea-1], db[eb-1])) { ea--; eb--; }
+
+  std::vector<internal::CommandBox_c> boxes;
+
+  if (ea - s == eb - s)
+  {
+    // the same number of commands changed, as long as the other commands stay the same
+    // only the areas of the changed commands look different
+    for (size_t i = s; i < ea; i++)
+      if (!sameCommand(da[i], db[i]))
+      {
+        boxes.push_back(internal::commandBox(da[i]));
+        boxes.push_back(internal::commandBox(db[i]));
+      }
+  }
+  else
+  {
+    for (size_t i = s; i < ea; i++) boxes.push_back(internal::commandBox(da[i]));
+    for (size_t i = s; i < eb; i++) boxes.push_back(internal::commandBox(db[i]));
+  }
+
+  mergeBoxes(boxes);
+
+  if (boxes.size() > maxDamageRects)
+  {
+    // too many separate areas, unite neighbouring boxes from top to bottom
+    std::sort(boxes.begin(), boxes.end(), [](const internal::CommandBox_c & x, const internal::CommandBox_c & y)
+    {
+      return x.y0 < y.y0;
+    });
+
+    std::vector<internal::CommandBox_c> res;
+    size_t per = (boxes.size() + maxDamageRects - 1) / maxDamageRects;
+
+    for (size_t i = 0; i < boxes.size(); i++)
+      if (i % per == 0)
+        res.push_back(boxes[i]);
+      else
+        unite(res.back(), boxes[i]);
+
+    mergeBoxes(res);
+    boxes.swap(res);
+  }
+
+  std::vector<TextLayout_c::Rectangle_c> res;
+
+  auto clamp = [](int64_t v) -> int
+  {
+    return std::min<int64_t>(std::max<int64_t>(v, std::numeric_limits<int>::min()), std::numeric_limits<int>::max());
+  };
+
+  for (auto & x : boxes)
+  {
+    TextLayout_c::Rectangle_c r;
+
+    r.x = clamp(x.x0);
+    r.y = clamp(x.y0);
+    r.w = clamp(x.x1 - x.x0);
+    r.h = clamp(x.y1 - x.y0);
+
+    res.push_back(r);
+  }
+
+  return res;
+}
+
+}
@@ -40,7 +40,7 @@ namespace STLL {
 
 TextLayout_c::TextLayout_c(TextLayout_c&& src) :
 height(src.height), left(src.left), right(src.right), firstBaseline(src.firstBaseline),
-data(std::move(src.data)), links(std::move(src.links)) { }
+data(std::move(src.data)), index(std::move(src.index)), links(std::move(src.links)) { }
 
 TextLayout_c::TextLayout_c(const TextLayout_c& src):
 height(src.height), left(src.left), right(src.right), firstBaseline(src.firstBaseline),
@@ -50,6 +50,8 @@ TextLayout_c::TextLayout_c(void): height(0), left(0), right(0), firstBaseline(0)
 
 void TextLayout_c::append(const TextLayout_c & l, int dx, int dy)
 {
+  index.reset();
+
   if (data.empty())
     firstBaseline = l.firstBaseline + dy;
 
@@ -81,6 +83,8 @@ void TextLayout_c::append(const TextLayout_c & l, int dx, int dy)
 
 void TextLayout_c::shift(int32_t dx, int32_t dy)
 {
+  index.reset();
+
   for (auto & a : data)
   {
     a.x += dx;
@@ -179,7 +183,6 @@ static runInfo createRun(const std::u32string & txt32, size_t spos, size_t runst
                          const AttributeIndex_c & attr, hb_buffer_t *buf,
                          const LayoutProperties_c & prop,
                          std::shared_ptr<FontFace_c> & font,
-                         hb_font_t * hb_ft_font,
                          char linebreak,
                          FriBidiLevel embedding_level,
                          size_t normalLayer
@@ -252,9 +255,10 @@ static runInfo createRun(const std::u32string & txt32, size_t spos, size_t runst
     hb_buffer_set_direction(buf, HB_DIRECTION_RTL);
   }
 
-  // get the right font for this run and do the shaping
-  if (hb_ft_font)
-    hb_shape(hb_ft_font, buf, NULL, 0);
+  // get the right font for this run and do the shaping, the harfbuzz
+  // font is kept within the font face and is only created once
+  if (font)
+    font->shape(buf);
 
   // get the output
   unsigned int         glyph_count;
@@ -458,27 +462,13 @@ static std::vector<runInfo> createTextRuns(const std::u32string & txt32,
                                            const std::vector<int> & hyphens
                                           )
 {
-  // Get our harfbuzz font structs
-  std::map<const std::shared_ptr<FontFace_c>, hb_font_t *> hb_ft_fonts;
-
-  // also get the maximal shadow numbers, so that we know how many layers there are
+  // get the maximal shadow numbers, so that we know how many layers there are
   size_t normalLayer = 0;
 
   for (size_t i = 0; i < txt32.length(); i++)
   {
     if (!isBidiCharacter(txt32[i]))
     {
-      auto a = attr.get(i);
-
-      for (auto f : a.font)
-      {
-        // if we don't have the font in the map yet, we add it
-        if (hb_ft_fonts.find(f) == hb_ft_fonts.end())
-        {
-          hb_ft_fonts[f] = hb_ft_font_create(f->getFace(), NULL);
-        }
-      }
-
       normalLayer = std::max(normalLayer, attr.get(i).shadows.size());
     }
   }
@@ -530,10 +520,7 @@ static std::vector<runInfo> createTextRuns(const std::u32string & txt32,
     }
 
     // save the run
-    hb_font_t * hbfont = nullptr;
-    if (font) hbfont = hb_ft_fonts[font];
-
-    runs.emplace_back(createRun(txt32, spos, runstart, attr, buf, prop, font, hbfont, linebreaks[spos-1], embedding_levels[runstart], normalLayer));
+    runs.emplace_back(createRun(txt32, spos, runstart, attr, buf, prop, font, linebreaks[spos-1], embedding_levels[runstart], normalLayer));
     runstart = spos;
 
     if (spos < hyphens.size() && hyphens[spos] != 0)
@@ -542,19 +529,16 @@ static std::vector<runInfo> createTextRuns(const std::u32string & txt32,
       std::u32string txt32a = U"\u00AD";
       AttributeIndex_c attra(attr.get(runstart));
 
-      runs.emplace_back(createRun(txt32a, 1, 0, attra, buf, prop, font, hbfont, LINEBREAK_ALLOWBREAK, embedding_levels[runstart], normalLayer));
+      runs.emplace_back(createRun(txt32a, 1, 0, attra, buf, prop, font, LINEBREAK_ALLOWBREAK, embedding_levels[runstart], normalLayer));
     }
 
     // skip bidi characters
     while (runstart < txt32.length() && isBidiCharacter(txt32[runstart])) runstart++;
   }
 
-  // free harfbuzz buffer and fonts
+  // free harfbuzz buffer
   hb_buffer_destroy(buf);
 
-  for (auto & a : hb_ft_fonts)
-    hb_font_destroy(a.second);
-
   return runs;
 }
 
@@ -25,6 +25,9 @@
 #include FT_FREETYPE_H
 #include FT_OUTLINE_H
 #include FT_LCD_FILTER_H
+#include FT_SIZES_H
+#include FT_MODULE_H
+#include FT_TRUETYPE_TABLES_H
 
 #include <hb.h>
 #include <hb-ft.h>
@@ -32,8 +35,16 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <set>
+#include <thread>
+#include <functional>
+#include <algorithm>
 
 #include <cassert>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 
 namespace STLL {
 
@@ -43,68 +54,518 @@ FontFace_c::GlyphSlot_c::GlyphSlot_c(const FT_GlyphSlotRec_* ft) :
   w(ft->bitmap.width), h(ft->bitmap.rows),
   top(ft->bitmap_top),
   left(ft->bitmap_left),
-  pitch(ft->bitmap.pitch),
-  data((uint8_t*)ft->bitmap.buffer)
-  {}
+  pitch(std::abs(ft->bitmap.pitch)),
+  buffer((size_t)pitch*h)
+{
+  // the rows are copied from top to bottom, bitmaps that flow up start with the bottom row
+  const uint8_t * src = ft->bitmap.buffer;
+  if (ft->bitmap.pitch < 0) src -= (ptrdiff_t)(h-1)*ft->bitmap.pitch;
+
+  for (int y = 0; y < h; y++)
+    memcpy(buffer.data() + y*pitch, src + (ptrdiff_t)y*ft->bitmap.pitch, pitch);
+
+  data = buffer.data();
+}
+
+const size_t FontFile_c::maxInstances;
+
+FontFile_c::FontFile_c(std::shared_ptr<FreeTypeLibrary_c> l, const internal::FontFileResource_c & r, size_t instances) :
+                numInstances(0), maxInst(1), lib(l), rec(r), faceMemory(0), coverageMemory(0), contentHash(0)
+{
+  setMaxInstances(instances);
+
+  size_t before = lib->getAllocatedMemory();
+  faces[0] = lib->newFace(r);
+  faceMemory = lib->getAllocatedMemory() - before;
+  numInstances = 1;
+}
+
+FontFile_c::~FontFile_c()
+{
+  for (size_t i = 0; i < numInstances; i++)
+    lib->doneFace(faces[i]);
+}
+
+void FontFile_c::setMaxInstances(size_t n)
+{
+  maxInst = std::min(maxInstances, std::max((size_t)1, n));
+}
+
+FontFile_c::FaceLock_c FontFile_c::lockFace(size_t idx)
+{
+  assert(idx < numInstances);
+  return FaceLock_c(faces[idx], idx, std::unique_lock<std::mutex>(mutexes[idx]));
+}
 
-FontFace_c::FontFace_c(std::shared_ptr<FreeTypeLibrary_c> l, const internal::FontFileResource_c & r, uint32_t s) :
-                lib(l), rec(r), size(s)
+FontFile_c::FaceLock_c FontFile_c::lockFace(void)
+{
+  size_t n = numInstances.load(std::memory_order_acquire);
+
+  // first try to find a face that is not in use right now
+  for (size_t i = 0; i < n; i++)
+  {
+    std::unique_lock<std::mutex> l(mutexes[i], std::try_to_lock);
+
+    if (l.owns_lock())
+      return FaceLock_c(faces[i], i, std::move(l));
+  }
+
+  // all are in use, so open the file once more, if we may
+  if (n < maxInst)
+  {
+    std::lock_guard<std::mutex> o(openMutex);
+
+    n = numInstances.load(std::memory_order_acquire);
+
+    if (n < maxInst)
+    {
+      size_t before = lib->getAllocatedMemory();
+      faces[n] = lib->newFace(rec);
+      faceMemory += lib->getAllocatedMemory() - before;
+
+      std::unique_lock<std::mutex> l(mutexes[n]);
+      numInstances.store(n+1, std::memory_order_release);
+
+      return FaceLock_c(faces[n], n, std::move(l));
+    }
+  }
+
+  // we have to wait, spread the waiting threads over the faces
+  size_t i = std::hash<std::thread::id>()(std::this_thread::get_id()) % n;
+
+  return FaceLock_c(faces[i], i, std::unique_lock<std::mutex>(mutexes[i]));
+}
+
+size_t FontFile_c::memory(void) const
+{
+  return sizeof(FontFile_c) + faceMemory + coverageMemory;
+}
+
+bool FontFile_c::containsGlyph(char32_t ch)
+{
+  std::call_once(coverageFlag, [this]()
+  {
+    // walk once over the unicode character map of the font and note all
+    // the characters that are mapped to a glyph
+    auto l = lockFace();
+    auto c = std::make_unique<internal::CodepointCoverage_c>();
+
+    FT_UInt gi;
+    FT_ULong cp = FT_Get_First_Char(l.getFace(), &gi);
+
+    while (gi != 0)
+    {
+      c->add(cp);
+      cp = FT_Get_Next_Char(l.getFace(), cp, &gi);
+    }
+
+    coverageMemory = c->memory();
+    coverage = std::move(c);
+  });
+
+  return coverage->contains(ch);
+}
+
+// hash a block of data, 8 bytes are processed at a time and the result is
+// mixed in the end with the finalizer of murmur hash 3
+static uint64_t hashData(const uint8_t * d, size_t len, uint64_t h)
+{
+  size_t i = 0;
+
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t w;
+    memcpy(&w, d+i, 8);
+    h ^= w * 0x87c37b91114253d5ULL;
+    h = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937fULL;
+  }
+
+  for (; i < len; i++)
+  {
+    h ^= d[i] * 0x87c37b91114253d5ULL;
+    h = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937fULL;
+  }
+
+  return h;
+}
+
+uint64_t FontFile_c::getContentHash(void)
+{
+  std::call_once(hashFlag, [this]()
+  {
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    size_t len = 0;
+
+    if (rec.getData())
+    {
+      len = rec.getDatasize();
+      h = hashData(rec.getData().get(), len, h);
+    }
+    else
+    {
+      FILE * f = fopen(rec.getDescription().c_str(), "rb");
+
+      if (!f) return;
+
+      std::vector<uint8_t> buf(64*1024);
+      size_t r;
+
+      // the chunk size is a multiple of 8, so the result is the same as when
+      // the whole file is hashed at once
+      while ((r = fread(buf.data(), 1, buf.size(), f)) > 0)
+      {
+        h = hashData(buf.data(), r, h);
+        len += r;
+      }
+
+      fclose(f);
+    }
+
+    h ^= len;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    contentHash = h ? h : 1;
+  });
+
+  return contentHash;
+}
+
+FontFace_c::FontFace_c(std::shared_ptr<FontFile_c> fl, uint32_t sz) : file(std::move(fl)), size(sz),
+  sizeMemory(0), hbMemory(0)
+{
+  sizes.fill(nullptr);
+  hb.fill(nullptr);
+
+  // always create the size for the first face, getFace relies on it and we
+  // take the metrics from it
+  auto l = file->lockFace(0);
+  activate(l);
+
+  FT_Size s = sizes[0];
+
+  height = s->metrics.height;
+  ascender = s->metrics.ascender;
+  descender = s->metrics.descender;
+  yScale = s->metrics.y_scale;
+
+  FT_Face f = l.getFace();
+
+  if (FT_IS_SCALABLE(f))
+  {
+    bboxLeft = static_cast<int64_t>(f->bbox.xMin*s->metrics.x_scale) / 65536;
+    bboxRight = static_cast<int64_t>(f->bbox.xMax*s->metrics.x_scale) / 65536;
+    bboxTop = -static_cast<int64_t>(f->bbox.yMax*yScale) / 65536;
+    bboxBottom = -static_cast<int64_t>(f->bbox.yMin*yScale) / 65536;
+  }
+  else
+  {
+    // bitmap fonts don't have a bounding box, the strikes fit into the
+    // height and are not wider than the maximal advance
+    bboxLeft = -s->metrics.max_advance;
+    bboxRight = 2*s->metrics.max_advance;
+    bboxTop = -std::max<int32_t>(ascender, height);
+    bboxBottom = std::max<int32_t>(-descender, height);
+  }
+}
+
+FontFace_c::FontFace_c(std::shared_ptr<FreeTypeLibrary_c> l, const internal::FontFileResource_c & r, uint32_t sz) :
+  FontFace_c(std::make_shared<FontFile_c>(l, r), sz)
 {
-  f = lib->newFace(r, s);
 }
 
 FontFace_c::~FontFace_c()
 {
-  lib->doneFace(f);
+  for (size_t i = 0; i < file->getNumInstances(); i++)
+  {
+    if (!sizes[i]) continue;
+
+    // destroying the size modifies the face, so we need the lock
+    auto l = file->lockFace(i);
+
+    if (hb[i]) hb_font_destroy(hb[i]);
+    file->getLibrary()->doneSize(sizes[i]);
+  }
+}
+
+void FontFace_c::activate(const FontFile_c::FaceLock_c & l)
+{
+  size_t i = l.getIndex();
+
+  if (!sizes[i])
+  {
+    size_t before = file->getLibrary()->getAllocatedMemory();
+    sizes[i] = file->getLibrary()->newSize(l.getFace(), size, file->getResource().getDescription());
+    sizeMemory += file->getLibrary()->getAllocatedMemory() - before;
+  }
+  else
+  {
+    FT_Activate_Size(sizes[i]);
+  }
+}
+
+FT_Face FontFace_c::getFace(void) const
+{
+  // other threads might use the face right now with their size activated
+  auto l = file->lockFace(0);
+  FT_Activate_Size(sizes[0]);
+  return l.getFace();
+}
+
+FontFile_c::FaceLock_c FontFace_c::lockFace(void)
+{
+  auto l = file->lockFace();
+  activate(l);
+  return l;
+}
+
+// HarfBuzz doesn't allow us to find out how much memory it uses for a font, but the biggest
+// part are the copies of the font tables that hb-ft loads from the FreeType face, so we use
+// the size of those tables plus a bit for the remaining structures as an estimate
+static size_t estimateHarfBuzzMemory(FT_Face f)
+{
+  static const FT_ULong tables[] = {
+    FT_MAKE_TAG('G', 'D', 'E', 'F'), FT_MAKE_TAG('G', 'S', 'U', 'B'), FT_MAKE_TAG('G', 'P', 'O', 'S'),
+    FT_MAKE_TAG('c', 'm', 'a', 'p'), FT_MAKE_TAG('h', 'm', 't', 'x'), FT_MAKE_TAG('v', 'm', 't', 'x'),
+    FT_MAKE_TAG('k', 'e', 'r', 'n'), FT_MAKE_TAG('m', 'o', 'r', 'x'), FT_MAKE_TAG('k', 'e', 'r', 'x')
+  };
+
+  size_t result = 4096;
+
+  for (auto t : tables)
+  {
+    FT_ULong len = 0;
+    if (FT_Load_Sfnt_Table(f, t, 0, nullptr, &len) == 0)
+      result += len;
+  }
+
+  return result;
+}
+
+void FontFace_c::shape(hb_buffer_t * buf)
+{
+  auto l = file->lockFace();
+
+  // the harfbuzz font takes the scaling from the active size, and its glyph
+  // functions use the active size as well, so we need to activate in all cases
+  activate(l);
+
+  hb_font_t * & h = hb[l.getIndex()];
+
+  if (!h)
+  {
+    h = hb_ft_font_create(l.getFace(), NULL);
+    hbMemory += estimateHarfBuzzMemory(l.getFace());
+  }
+
+  hb_shape(h, buf, NULL, 0);
+}
+
+size_t FontFace_c::memory(void) const
+{
+  return sizeof(FontFace_c) + sizeMemory + hbMemory;
 }
 
 uint32_t FontFace_c::getHeight(void) const
 {
-  return f->size->metrics.height;
+  return height;
 }
 
 int32_t FontFace_c::getAscender(void) const
 {
-  return f->size->metrics.ascender;
+  return ascender;
 }
 
 int32_t FontFace_c::getDescender(void) const
 {
-  return f->size->metrics.descender;
+  return descender;
 }
 
 int32_t FontFace_c::getUnderlinePosition(void) const
 {
-  return static_cast<int64_t>(f->underline_position*f->size->metrics.y_scale) / 65536;
+  return static_cast<int64_t>(file->getFace()->underline_position*yScale) / 65536;
 }
 
 int32_t FontFace_c::getUnderlineThickness(void) const
 {
-  return static_cast<int64_t>(f->underline_thickness*f->size->metrics.y_scale) / 65536;
+  return static_cast<int64_t>(file->getFace()->underline_thickness*yScale) / 65536;
 }
 
 std::shared_ptr<FontFace_c> FontCache_c::getFont(const internal::FontFileResource_c & res, uint32_t size)
 {
   FontFaceParameter_c ffp(res, size);
 
+  std::lock_guard<std::mutex> lock(mutex);
+
   auto i = fonts.find(ffp);
 
   if (i != fonts.end())
   {
-    auto a = i->second;
+    // move the font to the front of the lru list
+    lru.splice(lru.begin(), lru, i->second.lru);
+    hits++;
 
-    if (a) return a;
+    return i->second.face;
   }
 
-  // TODO... race maybe someone else opens a font here?
+  misses++;
+
+  // reuse the font file, when another size of it is already open
+  std::shared_ptr<FontFile_c> file = files[res].lock();
 
-  auto a = std::make_shared<FontFace_c>(lib, res, size);
+  if (!file)
+  {
+    file = std::make_shared<FontFile_c>(lib, res, maxInstances);
+    files[res] = file;
+  }
 
-  fonts.insert(std::make_pair(ffp, a));
+  auto a = std::make_shared<FontFace_c>(file, size);
+
+  lru.push_front(ffp);
+  fonts.insert(std::make_pair(ffp, FontFaceEntry_c{a, lru.begin()}));
+
+  if (budget) trim(budget);
 
   return a;
 }
 
+void FontCache_c::trim(size_t bytes)
+{
+  size_t mem = memoryLocked();
+
+  // walk from the oldest to the newest font and remove all that are not in use
+  auto it = lru.end();
+
+  while (mem > bytes && it != lru.begin())
+  {
+    --it;
+
+    auto f = fonts.find(*it);
+    assert(f != fonts.end());
+
+    // only the cache holds this face
+    if (f->second.face.use_count() == 1)
+    {
+      mem -= std::min(mem, f->second.face->memory());
+
+      // when this is the last face using the file, the file will be closed as well
+      if (f->second.face->getFile().use_count() == 1)
+        mem -= std::min(mem, f->second.face->getFile()->memory());
+
+      for (auto & l : listeners)
+        l.second(f->second.face.get());
+
+      fonts.erase(f);
+      it = lru.erase(it);
+      evictions++;
+    }
+  }
+}
+
+void FontCache_c::clear(void)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  trim(0);
+
+  for(auto it = files.begin(); it != files.end(); )
+  {
+    if(it->second.expired())
+    {
+      it = files.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+void FontCache_c::setMemoryBudget(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  budget = bytes;
+  if (budget) trim(budget);
+}
+
+void FontCache_c::setMaxFaceInstances(size_t n)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  maxInstances = n;
+
+  for (auto & f : files)
+    if (auto fl = f.second.lock())
+      fl->setMaxInstances(n);
+}
+
+size_t FontCache_c::addEvictionListener(std::function<void(const FontFace_c *)> f)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  listeners.emplace_back(++listenerId, std::move(f));
+  return listenerId;
+}
+
+void FontCache_c::removeEvictionListener(size_t id)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (auto it = listeners.begin(); it != listeners.end(); ++it)
+    if (it->first == id)
+    {
+      listeners.erase(it);
+      return;
+    }
+}
+
+size_t FontCache_c::memory(void) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  return memoryLocked();
+}
+
+size_t FontCache_c::memoryLocked(void) const
+{
+  size_t result = 0;
+  std::set<const FontFile_c*> fls;
+
+  for (auto & f : fonts)
+  {
+    result += f.second.face->memory();
+
+    if (fls.insert(f.second.face->getFile().get()).second)
+      result += f.second.face->getFile()->memory();
+  }
+
+  return result;
+}
+
+FontCache_c::Statistics_c FontCache_c::getStatistics(void) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Statistics_c st;
+
+  st.faces = fonts.size();
+  st.memory = memoryLocked();
+  st.budget = budget;
+  st.hits = hits;
+  st.misses = misses;
+  st.evictions = evictions;
+
+  for (auto & f : files)
+    if (!f.second.expired())
+      st.files++;
+
+  return st;
+}
+
 
 Font_c FontCache_c::getFont(const FontResource_c & res, uint32_t size)
 {
@@ -139,9 +600,14 @@ FontFace_c::GlyphSlot_c FontFace_c::renderGlyph(glyphIndex_t glyphIndex, SubPixe
       break;
   }
 
+  auto l = file->lockFace();
+  activate(l);
+
+  FT_Face f = l.getFace();
+
   /* load glyph image into the slot (erase previous one) */
-  if (FT_Load_Glyph(f, glyphIndex, FT_LOAD_TARGET_LIGHT)) return 0;
-  if (FT_Render_Glyph(f->glyph, rm)) return 0;
+  if (FT_Load_Glyph(f, glyphIndex, FT_LOAD_TARGET_LIGHT)) return GlyphSlot_c(0, 0);
+  if (FT_Render_Glyph(f->glyph, rm)) return GlyphSlot_c(0, 0);
 
     assert(f->glyph->format == FT_GLYPH_FORMAT_BITMAP);
     assert( sp != SUBP_NONE                       || f->glyph->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY);
@@ -151,13 +617,51 @@ FontFace_c::GlyphSlot_c FontFace_c::renderGlyph(glyphIndex_t glyphIndex, SubPixe
   return GlyphSlot_c(f->glyph);
 }
 
-bool FontFace_c::containsGlyph(char32_t ch)
+FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r, uint32_t size)
 {
-  return FT_Get_Char_Index(f, ch) != 0;
+  FT_Face f = newFace(r);
+
+  if (FT_Set_Pixel_Sizes(f, (size+32)/64, (size+32)/64))
+  {
+    doneFace(f);
+
+    throw FreetypeException_c(std::string("Could not set the requested file to font '") +
+                              r.getDescription() + "'");
+  }
+
+  return f;
 }
 
-FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r, uint32_t size)
+FT_Size FreeTypeLibrary_c::newSize(FT_Face f, uint32_t size, const std::string & descr)
 {
+  FT_Size s;
+
+  if (FT_New_Size(f, &s))
+  {
+    throw FreetypeException_c(std::string("Could not create a new size for font '") + descr + "'");
+  }
+
+  // the size needs to be active to set its pixel size
+  if (FT_Activate_Size(s) || FT_Set_Pixel_Sizes(f, (size+32)/64, (size+32)/64))
+  {
+    doneSize(s);
+
+    throw FreetypeException_c(std::string("Could not set the requested file to font '") +
+                              descr + "'");
+  }
+
+  return s;
+}
+
+void FreeTypeLibrary_c::doneSize(FT_Size s)
+{
+  FT_Done_Size(s);
+}
+
+FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r)
+{
+  std::lock_guard<std::mutex> lock(faceMutex);
+
   FT_Face f;
   FT_Open_Args a;
   if (r.getDatasize() == 0) {
@@ -178,14 +682,6 @@ FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r, uint3
                               "file is spelled wrong or file is broken");
   }
 
-  if (FT_Set_Pixel_Sizes(f, (size+32)/64, (size+32)/64))
-  {
-    doneFace(f);
-
-    throw FreetypeException_c(std::string("Could not set the requested file to font '") +
-                              r.getDescription() + "'");
-  }
-
   /*  See http://www.microsoft.com/typography/otspec/name.htm
    *        for a list of some possible platform-encoding pairs.
    *        We're interested in 0-3 aka 3-1 - UCS-2.
@@ -204,7 +700,7 @@ FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r, uint3
     {
       if (FT_Set_Charmap(f, f->charmaps[i]))
       {
-        doneFace(f);
+        FT_Done_Face(f);
         throw FreetypeException_c(std::string("Could not set a unicode character map to font '") +
                                   r.getDescription() + "'. Maybe the font doesn't have one?");
       }
@@ -212,38 +708,108 @@ FT_Face FreeTypeLibrary_c::newFace(const internal::FontFileResource_c & r, uint3
     }
   }
 
-  doneFace(f);
+  FT_Done_Face(f);
   throw FreetypeException_c(std::string("Could not find a unicode character map to font '") +
                             r.getDescription() + "'. Maybe the font doesn't have one?");
 }
 
 void FreeTypeLibrary_c::doneFace(FT_Face f)
 {
+  std::lock_guard<std::mutex> lock(faceMutex);
+
   FT_Done_Face(f);
 }
 
+// the memory functions for FreeType, they keep track of the number of bytes allocated, to do
+// that the size of each block is stored in front of the block
+static const size_t memoryHeader = alignof(std::max_align_t);
+
+static void * ftAlloc(FT_Memory m, long size)
+{
+  uint8_t * p = static_cast<uint8_t*>(std::malloc(size + memoryHeader));
+  if (!p) return nullptr;
+
+  *reinterpret_cast<size_t*>(p) = size;
+  *static_cast<std::atomic<size_t>*>(m->user) += size;
+
+  return p + memoryHeader;
+}
+
+static void ftFree(FT_Memory m, void * block)
+{
+  if (!block) return;
+
+  uint8_t * p = static_cast<uint8_t*>(block) - memoryHeader;
+
+  *static_cast<std::atomic<size_t>*>(m->user) -= *reinterpret_cast<size_t*>(p);
+  std::free(p);
+}
+
+static void * ftRealloc(FT_Memory m, long, long newSize, void * block)
+{
+  if (!block) return ftAlloc(m, newSize);
+
+  uint8_t * p = static_cast<uint8_t*>(block) - memoryHeader;
+  size_t oldSize = *reinterpret_cast<size_t*>(p);
+
+  p = static_cast<uint8_t*>(std::realloc(p, newSize + memoryHeader));
+  if (!p) return nullptr;
+
+  *reinterpret_cast<size_t*>(p) = newSize;
+  *static_cast<std::atomic<size_t>*>(m->user) += newSize;
+  *static_cast<std::atomic<size_t>*>(m->user) -= oldSize;
+
+  return p + memoryHeader;
+}
+
 FreeTypeLibrary_c::~FreeTypeLibrary_c()
 {
-  FT_Done_FreeType(lib);
+  FT_Done_Library(lib);
+  delete mem;
 }
 
-FreeTypeLibrary_c::FreeTypeLibrary_c()
+FreeTypeLibrary_c::FreeTypeLibrary_c() : allocated(0)
 {
-  if (FT_Init_FreeType(&lib))
+  mem = new FT_MemoryRec_;
+  mem->user = &allocated;
+  mem->alloc = ftAlloc;
+  mem->free = ftFree;
+  mem->realloc = ftRealloc;
+
+  if (FT_New_Library(mem, &lib))
   {
+    delete mem;
     throw FreetypeException_c("Could not initialize font rendering library instance");
   }
 
+  FT_Add_Default_Modules(lib);
+
+#if (FREETYPE_MAJOR*10000 + FREETYPE_MINOR*100 + FREETYPE_PATCH) >= 20801
+  FT_Set_Default_Properties(lib);
+#endif
+
   FT_Library_SetLcdFilter(lib, FT_LCD_FILTER_DEFAULT);
 }
 
 std::shared_ptr<FontFace_c> Font_c::get(char32_t codepoint) const
 {
-  for (auto f : fonts)
-    if (f->containsGlyph(codepoint)) return f;
+  uint64_t l = last.load(std::memory_order_relaxed);
+
+  if ((l >> 32) == codepoint && l != invalidLast)
+    return fonts[l & 0xFFFFFFFF];
+
+  for (size_t i = 0; i < fonts.size(); i++)
+    if (fonts[i]->containsGlyph(codepoint))
+    {
+      last.store(((uint64_t)codepoint << 32) | i, std::memory_order_relaxed);
+      return fonts[i];
+    }
 
   if (fonts.size())
+  {
+    last.store((uint64_t)codepoint << 32, std::memory_order_relaxed);
     return fonts[0];
+  }
 
   return 0;
 }
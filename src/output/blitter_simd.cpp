@@ -0,0 +1,632 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stll/internal/blitter_simd.h>
+#include <stll/internal/dividers.h>
+
+#include <atomic>
+#include <tuple>
+#include <cstring>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define STLL_BLIT_X86
+#include <immintrin.h>
+#endif
+
+namespace STLL { namespace internal {
+
+namespace {
+
+// one line of a glyph to blend onto the surface
+class Line_c
+{
+  public:
+    uint8_t * dst;        // first pixel to write
+    const uint8_t * src;  // coverage values, one per channel for sub-pixel output, one per pixel otherwise
+    int pixels;           // number of pixels to write
+    int prev;             // coverage value in front of src[0]
+    int stb;              // position between two coverage values 0..63, see blend
+    int alpha;
+    int colour[3];        // colour of the 3 channels, gamma corrected and scaled
+    int solid[3];         // output value of the 3 channels for full coverage
+    int offset[3];        // byte position of the 3 channels within the pixel
+    uint32_t keep;        // mask of the bytes of a pixel that are not changed
+    uint32_t solidPixel;  // the pixel with solid in the channels
+    bool subpixel;
+
+    // calculate solid and the masks from colour and offset
+    void setSolid(const GammaTables_c & g)
+    {
+      keep = 0xFFFFFFFF;
+      solidPixel = 0;
+
+      for (int k = 0; k < 3; k++)
+      {
+        solid[k] = g.inverse[colour[k]];
+        keep &= ~(0xFFu << (8*offset[k]));
+        solidPixel |= solid[k] << (8*offset[k]);
+      }
+    }
+};
+
+// the same as blend in blitter.h, but with the already scaled colour d2
+inline int blendScalar(int a1, int d2, int b1, int b2, int c, const GammaTables_c & g)
+{
+  if (b1 == 0 && (b2== 0 || c == 0)) return a1;
+
+  int b = (int)b1 + ((int)b2-(int)b1)*c/64;
+
+  int d1 = g.forward[a1];
+
+  return g.inverse[d1 + (d2-d1)*b/(255*255)];
+}
+
+// blend n pixels, cov points to the coverage value of the first pixel, prev is the value in front
+// of it, everything is copied into local variables, as the compiler has to assume that the stores
+// into the surface change the line and table information otherwise
+void pixelsScalar(uint8_t * dst, const uint8_t * cov, int n, int prev, const Line_c & l, const GammaTables_c & gt)
+{
+  const GammaTables_c g = gt;
+  const int a = l.alpha;
+  const int stb = l.stb;
+  const int c0 = l.colour[0], c1 = l.colour[1], c2 = l.colour[2];
+  uint8_t * p0 = dst + l.offset[0];
+  uint8_t * p1 = dst + l.offset[1];
+  uint8_t * p2 = dst + l.offset[2];
+
+  int b2 = prev*a;
+
+  if (l.subpixel)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      int b0 = cov[3*i]*a;
+      int b1 = cov[3*i+1]*a;
+      int b3 = cov[3*i+2]*a;
+
+      p0[4*i] = blendScalar(p0[4*i], c0, b0, b2, stb, g);
+      p1[4*i] = blendScalar(p1[4*i], c1, b1, b0, stb, g);
+      p2[4*i] = blendScalar(p2[4*i], c2, b3, b1, stb, g);
+
+      b2 = b3;
+    }
+  }
+  else
+  {
+    for (int i = 0; i < n; i++)
+    {
+      int b1 = cov[i]*a;
+
+      if (b1 != 0 || (b2 != 0 && stb != 0))
+      {
+        p0[4*i] = blendScalar(p0[4*i], c0, b1, b2, stb, g);
+        p1[4*i] = blendScalar(p1[4*i], c1, b1, b2, stb, g);
+        p2[4*i] = blendScalar(p2[4*i], c2, b1, b2, stb, g);
+      }
+
+      b2 = b1;
+    }
+  }
+}
+
+// a kernel blends n pixels like pixelsScalar, but it may read the coverage value in front of cov
+typedef void (*Kernel_t)(uint8_t * dst, const uint8_t * cov, int n, const Line_c & l, const GammaTables_c & g);
+
+void kernelScalar(uint8_t * dst, const uint8_t * cov, int n, const Line_c & l, const GammaTables_c & g)
+{
+  pixelsScalar(dst, cov, n, cov[-1], l, g);
+}
+
+// blend a line, the first pixel is done separately, so that the kernel can always read the
+// coverage value in front
+void blendLine(const Line_c & l, const GammaTables_c & g, Kernel_t kernel)
+{
+  if (l.pixels <= 0) return;
+
+  pixelsScalar(l.dst, l.src, 1, l.prev, l, g);
+  kernel(l.dst + 4, l.src + (l.subpixel ? 3 : 1), l.pixels-1, l, g);
+}
+
+#ifdef STLL_BLIT_X86
+
+// the kernels work on groups of 4 (SSE2) or 8 (AVX2) pixels. They calculate the interpolated
+// coverage for the whole group and sort the pixels (or channels for sub-pixel output) into the ones
+// that blend doesn't change, the ones with full coverage that get the precalculated solid colour and
+// the rest. Only the rest needs the gamma lookups, which are done one at a time. When most of a
+// sub-pixel group needs lookups the group is done by pixelsScalar, as are the pixels at the end
+// of the line that don't fill a whole group
+
+// blend with the interpolated coverage b already calculated
+inline uint8_t mixScalar(uint8_t a1, int d2, int b, const GammaTables_c & g)
+{
+  int d1 = g.forward[a1];
+  return g.inverse[d1 + (d2-d1)*b/(255*255)];
+}
+
+// handle the channels of a group of sub-pixel output, all bits not set in skip need an update
+inline void subpixelRest(uint8_t * dst, uint32_t skip, uint32_t solid, const int32_t * b,
+                         const Line_c & l, const GammaTables_c & g)
+{
+  // pixel and channel of the sub-pixel values of a group
+  static const uint8_t pixel[24] = { 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 5, 6, 6, 6, 7, 7, 7 };
+  static const uint8_t channel[24] = { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2 };
+
+  for (uint32_t rest = ~skip; rest; rest &= rest-1)
+  {
+    int j = __builtin_ctz(rest);
+    int k = channel[j];
+    uint8_t * p = dst + 4*pixel[j] + l.offset[k];
+
+    *p = ((solid >> j) & 1) ? l.solid[k] : mixScalar(*p, l.colour[k], b[j], g);
+  }
+}
+
+// the interpolated coverage and the masks of the skipped and solid lanes for 4 coverage values,
+// a fits into 16 bit, so does the difference of the coverage values, so the multiplications can
+// be done with 16 bit operations
+__attribute__((target("sse2")))
+inline void coverageSSE2(const uint8_t * c, const Line_c & l, __m128i & b, int & skip, int & solid)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i as = _mm_set1_epi32(l.alpha*l.stb);   // pairs of (alpha*stb, 0) for madd
+
+  int32_t v0, v1;
+  memcpy(&v0, c, 4);
+  memcpy(&v1, c-1, 4);
+  __m128i s = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v0), zero), zero);
+  __m128i p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v1), zero), zero);
+
+  __m128i t = _mm_madd_epi16(_mm_sub_epi32(p, s), as);
+  t = _mm_srai_epi32(_mm_add_epi32(t, _mm_and_si128(_mm_srai_epi32(t, 31), _mm_set1_epi32(63))), 6);
+  b = _mm_add_epi32(_mm_mullo_epi16(s, _mm_set1_epi32(l.alpha)), t);
+
+  __m128i sk = _mm_and_si128(_mm_cmpeq_epi32(s, zero), _mm_or_si128(_mm_cmpeq_epi32(p, zero), _mm_set1_epi32(l.stb ? 0 : -1)));
+  skip = _mm_movemask_ps(_mm_castsi128_ps(sk));
+  solid = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(b, _mm_set1_epi32(255*255))));
+}
+
+__attribute__((target("sse2")))
+void kernelSSE2(uint8_t * dst, const uint8_t * cov, int n, const Line_c & line, const GammaTables_c & gt)
+{
+  const Line_c & l = line;
+  const GammaTables_c g = gt;
+
+  const __m128i full = _mm_set1_epi32(255*255);
+
+  const __m128i keepMask = _mm_set1_epi32(l.keep);
+  const __m128i solidMask = _mm_set1_epi32(l.solidPixel);
+
+  alignas(16) int32_t bv[12];
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4)
+  {
+    if (l.subpixel)
+    {
+      uint32_t skip = 0, solid = 0;
+
+      for (int v = 0; v < 3; v++)
+      {
+        __m128i b;
+        int sk, so;
+        coverageSSE2(cov + 3*i + 4*v, l, b, sk, so);
+        _mm_store_si128((__m128i*)(bv + 4*v), b);
+        skip |= sk << (4*v);
+        solid |= so << (4*v);
+      }
+
+      if (solid == 0xFFF)
+      {
+        __m128i px = _mm_loadu_si128((const __m128i*)(dst + 4*i));
+        _mm_storeu_si128((__m128i*)(dst + 4*i), _mm_or_si128(_mm_and_si128(px, keepMask), solidMask));
+      }
+      else if (__builtin_popcount(skip | solid) < 6)
+        kernelScalar(dst + 4*i, cov + 3*i, 4, l, g);
+      else if (skip != 0xFFF)
+        subpixelRest(dst + 4*i, skip | 0xFFFFF000, solid, bv, l, g);
+    }
+    else
+    {
+      __m128i b;
+      int skip, solid;
+      coverageSSE2(cov + i, l, b, skip, solid);
+
+      if (skip == 0xF) continue;
+
+      if (solid)
+      {
+        __m128i px = _mm_loadu_si128((const __m128i*)(dst + 4*i));
+        __m128i sp = _mm_or_si128(_mm_and_si128(px, keepMask), solidMask);
+        __m128i m = _mm_cmpeq_epi32(b, full);
+        _mm_storeu_si128((__m128i*)(dst + 4*i), _mm_or_si128(_mm_andnot_si128(m, px), _mm_and_si128(m, sp)));
+      }
+
+      _mm_store_si128((__m128i*)bv, b);
+
+      for (int rest = ~(skip | solid) & 0xF; rest; rest &= rest-1)
+      {
+        int j = __builtin_ctz(rest);
+        uint8_t * p = dst + 4*(i+j);
+
+        for (int k = 0; k < 3; k++)
+          p[l.offset[k]] = mixScalar(p[l.offset[k]], l.colour[k], bv[j], g);
+      }
+    }
+  }
+
+  kernelScalar(dst + 4*i, cov + (l.subpixel ? 3*i : i), n-i, l, g);
+}
+
+// the same for 8 coverage values
+__attribute__((target("avx2")))
+inline void coverageAVX2(const uint8_t * c, const Line_c & l, __m256i & b, int & skip, int & solid)
+{
+  const __m256i zero = _mm256_setzero_si256();
+
+  __m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)c));
+  __m256i p = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(c-1)));
+
+  __m256i t = _mm256_mullo_epi32(_mm256_sub_epi32(p, s), _mm256_set1_epi32(l.alpha*l.stb));
+  t = _mm256_srai_epi32(_mm256_add_epi32(t, _mm256_and_si256(_mm256_srai_epi32(t, 31), _mm256_set1_epi32(63))), 6);
+  b = _mm256_add_epi32(_mm256_mullo_epi32(s, _mm256_set1_epi32(l.alpha)), t);
+
+  __m256i sk = _mm256_and_si256(_mm256_cmpeq_epi32(s, zero), _mm256_or_si256(_mm256_cmpeq_epi32(p, zero), _mm256_set1_epi32(l.stb ? 0 : -1)));
+  skip = _mm256_movemask_ps(_mm256_castsi256_ps(sk));
+  solid = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(b, _mm256_set1_epi32(255*255))));
+}
+
+__attribute__((target("avx2")))
+void kernelAVX2(uint8_t * dst, const uint8_t * cov, int n, const Line_c & line, const GammaTables_c & gt)
+{
+  const Line_c & l = line;
+  const GammaTables_c g = gt;
+
+  const __m256i full = _mm256_set1_epi32(255*255);
+
+  const __m256i keepMask = _mm256_set1_epi32(l.keep);
+  const __m256i solidMask = _mm256_set1_epi32(l.solidPixel);
+
+  alignas(32) int32_t bv[24];
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8)
+  {
+    if (l.subpixel)
+    {
+      uint32_t skip = 0, solid = 0;
+
+      for (int v = 0; v < 3; v++)
+      {
+        __m256i b;
+        int sk, so;
+        coverageAVX2(cov + 3*i + 8*v, l, b, sk, so);
+        _mm256_store_si256((__m256i*)(bv + 8*v), b);
+        skip |= sk << (8*v);
+        solid |= so << (8*v);
+      }
+
+      if (solid == 0xFFFFFF)
+      {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(dst + 4*i));
+        _mm256_storeu_si256((__m256i*)(dst + 4*i), _mm256_or_si256(_mm256_and_si256(px, keepMask), solidMask));
+      }
+      else if (__builtin_popcount(skip | solid) < 12)
+        kernelScalar(dst + 4*i, cov + 3*i, 8, l, g);
+      else if (skip != 0xFFFFFF)
+        subpixelRest(dst + 4*i, skip | 0xFF000000, solid, bv, l, g);
+    }
+    else
+    {
+      __m256i b;
+      int skip, solid;
+      coverageAVX2(cov + i, l, b, skip, solid);
+
+      if (skip == 0xFF) continue;
+
+      if (solid)
+      {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(dst + 4*i));
+        __m256i sp = _mm256_or_si256(_mm256_and_si256(px, keepMask), solidMask);
+        _mm256_storeu_si256((__m256i*)(dst + 4*i), _mm256_blendv_epi8(px, sp, _mm256_cmpeq_epi32(b, full)));
+      }
+
+      _mm256_store_si256((__m256i*)bv, b);
+
+      for (int rest = ~(skip | solid) & 0xFF; rest; rest &= rest-1)
+      {
+        int j = __builtin_ctz(rest);
+        uint8_t * p = dst + 4*(i+j);
+
+        for (int k = 0; k < 3; k++)
+          p[l.offset[k]] = mixScalar(p[l.offset[k]], l.colour[k], bv[j], g);
+      }
+    }
+  }
+
+  kernelScalar(dst + 4*i, cov + (l.subpixel ? 3*i : i), n-i, l, g);
+}
+
+#endif
+
+bool supported(BlitterLevel l)
+{
+#ifdef STLL_BLIT_X86
+  __builtin_cpu_init();
+
+  switch (l)
+  {
+    case BLIT_SCALAR: return true;
+    case BLIT_SSE2: return __builtin_cpu_supports("sse2");
+    case BLIT_AVX2: return __builtin_cpu_supports("avx2");
+  }
+
+  return false;
+#else
+  return l == BLIT_SCALAR;
+#endif
+}
+
+BlitterLevel best(void)
+{
+  if (supported(BLIT_AVX2)) return BLIT_AVX2;
+  if (supported(BLIT_SSE2)) return BLIT_SSE2;
+  return BLIT_SCALAR;
+}
+
+std::atomic<int> currentLevel(-1);
+
+// get the kernel for the current level, the vector kernels rely on the
+// gamma corrected values being smaller than 2^11
+Kernel_t kernelFunction(const GammaTables_c & g)
+{
+  if (g.scale <= 8)
+    switch (getBlitterLevel())
+    {
+#ifdef STLL_BLIT_X86
+      case BLIT_AVX2: return kernelAVX2;
+      case BLIT_SSE2: return kernelSSE2;
+#endif
+      default: break;
+    }
+
+  return kernelScalar;
+}
+
+// the pixels of row y of an image, encoded images are decoded into a buffer of the
+// thread that stays valid until the next call
+const uint8_t * imageRow(const PaintData_c & img, int y)
+{
+  if (!img.isCompressed())
+    return img.getBuffer() + y*img.pitch;
+
+  static thread_local std::vector<uint8_t> row;
+
+  row.resize(img.pitch);
+  img.decodeRow(y, row.data());
+
+  return row.data();
+}
+
+}
+
+BlitterLevel getBlitterLevel(void)
+{
+  int l = currentLevel;
+
+  if (l < 0)
+  {
+    l = best();
+    currentLevel = l;
+  }
+
+  return (BlitterLevel)l;
+}
+
+BlitterLevel setBlitterLevel(BlitterLevel l)
+{
+  while (l != BLIT_SCALAR && !supported(l))
+    l = (BlitterLevel)(l-1);
+
+  currentLevel = l;
+  return l;
+}
+
+bool acceleratedBlitterAvailable(bool subpixel)
+{
+  // with SSE2 the sub-pixel values need to be loaded and sorted one by one, that is slower
+  // than the template function
+  if (subpixel)
+    return getBlitterLevel() == BLIT_AVX2;
+  else
+    return getBlitterLevel() != BLIT_SCALAR;
+}
+
+// the positioning and clipping is the same as in outputGlyph_NONE
+void outputGlyph_NONE_XRGB(int sx, int sy, const PaintData_c & img, Color_c c,
+                           uint8_t * s, int pitch, int w, int h, const GammaTables_c & g,
+                           int cx, int cy, int cw, int ch)
+{
+  const int bbp = 4;
+
+  if (cx <= 0) { cw += cx; } else { w -= cx; s += bbp*cx; sx -= 64*cx; }
+  if (cy <= 0) { ch += cy; } else { h -= cy; s += pitch*cy; sy -= 64*cy; }
+  if (w > cw) { w = cw; }
+  if (h > ch) { h = ch; }
+
+  int stx, stb;
+
+  std::tie(stx, stb) = divmod_inf(sx, 64);
+  stx += img.left;
+
+  int sty = div_inf(sy+32, 64) - img.top;
+
+  int yp = sty;
+
+  int sti = 0;
+  int stw = img.width + 1;
+
+  if (stx < 0)
+  {
+    sti -= stx;
+    stw += stx;
+    stx = 0;
+  }
+
+  if (stx+stw > w)
+  {
+    stw -= (stx+stw-w);
+  }
+
+  if (stw <= 0) return;
+  if (sty >= h || sty+img.rows < 0) return;
+
+  // with alpha 0 blend never changes a pixel
+  if (c.a() == 0) return;
+
+  Kernel_t kernel = kernelFunction(g);
+
+  Line_c l;
+  l.pixels = stw;
+  l.stb = stb;
+  l.alpha = c.a();
+  l.colour[0] = c.r()*g.scale; l.offset[0] = 2;
+  l.colour[1] = c.g()*g.scale; l.offset[1] = 1;
+  l.colour[2] = c.b()*g.scale; l.offset[2] = 0;
+  l.setSolid(g);
+  l.subpixel = false;
+
+  for (int y = 0; y < img.rows; y++)
+  {
+    if (yp >= 0 && yp < h)
+    {
+      l.dst = s + yp*pitch + bbp*stx;
+      l.src = imageRow(img, y) + sti;
+      l.prev = (sti > 0) ? *(l.src-1) : 0;
+
+      blendLine(l, g, kernel);
+    }
+    yp++;
+  }
+}
+
+// the positioning and clipping is the same as in outputGlyph_HorizontalRGB
+void outputGlyph_HorizontalRGB_XRGB(int sx, int sy, const PaintData_c & img, int sp1c, int sp2c, int sp3c, int alpha,
+                                    bool bgr, uint8_t * s, int pitch, int w, int h, const GammaTables_c & g,
+                                    int cx, int cy, int cw, int ch)
+{
+  const int bbp = 4;
+
+  if (cx <= 0) { cw += cx; } else { w -= cx; s += bbp*cx; sx -= 64*cx; }
+  if (cy <= 0) { ch += cy; } else { h -= cy; s += pitch*cy; sy -= 64*cy; }
+  if (w > cw) { w = cw; }
+  if (h > ch) { h = ch; }
+
+  int stx = div_inf(sx, 64) + img.left;
+  int sty = div_inf(sy+32, 64) - img.top;
+  int stc, stb;
+
+  std::tie(stc, stb) = divmod_inf(3*sx, 64);
+  stc = mod_inf(stc, 3);
+
+  int yp = sty;
+
+  int sti = 0;
+  int stw = img.width/3;
+
+  if (stx < 0 && stc != 0)
+  {
+    sti += 3-stc;
+    stc = 0;
+    stx++;
+    stw--;
+  }
+
+  if (stx < 0)
+  {
+    sti -= 3*stx;
+    stw += stx;
+    stx = 0;
+  }
+
+  if (stx+stw > w)
+  {
+    stw -= (stx+stw-w);
+  }
+
+  if (stw <= 0) return;
+  if (sty >= h || sty+img.rows < 0) return;
+
+  // with alpha 0 blend never changes a pixel
+  if (alpha == 0) return;
+
+  Kernel_t kernel = kernelFunction(g);
+
+  Line_c l;
+  l.pixels = stw-1;
+  l.stb = stb;
+  l.alpha = alpha;
+  l.colour[0] = sp1c*g.scale;
+  l.colour[1] = sp2c*g.scale;
+  l.colour[2] = sp3c*g.scale;
+  l.offset[0] = bgr ? 0 : 2;
+  l.offset[1] = 1;
+  l.offset[2] = bgr ? 2 : 0;
+  l.setSolid(g);
+  l.subpixel = true;
+
+  for (int y = 0; y < img.rows; y++)
+  {
+    if (yp >= 0 && yp < h)
+    {
+      int a = 0;
+      int aprev = 0;
+
+      uint8_t * dst = s + yp*pitch + bbp*stx;
+      const uint8_t * src = imageRow(img, y) + sti;
+      if (sti > 0) aprev = *(src-1) * alpha;
+
+      // the first pixel may start in the middle, so do it like the template function
+      uint8_t * p1 = dst + l.offset[0];
+      uint8_t * p2 = dst + l.offset[1];
+      uint8_t * p3 = dst + l.offset[2];
+
+      switch (stc)
+      {
+        case 0: a = *src*alpha; *p1 = blendScalar(*p1, l.colour[0], a, aprev, stb, g); aprev = a; src++;
+          // fall through
+        case 1: a = *src*alpha; *p2 = blendScalar(*p2, l.colour[1], a, aprev, stb, g); aprev = a; src++;
+          // fall through
+        case 2: a = *src*alpha; *p3 = blendScalar(*p3, l.colour[2], a, aprev, stb, g); aprev = a; src++;
+      }
+
+      l.dst = dst + bbp;
+      l.src = src;
+      l.prev = *(src-1);
+
+      blendLine(l, g, kernel);
+    }
+    yp++;
+  }
+}
+
+} }
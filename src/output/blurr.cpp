@@ -21,9 +21,17 @@
  */
 #include <stll/internal/blurr.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cmath>
-#include <memory>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#define STLL_BLURR_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace STLL { namespace internal {
 
@@ -44,86 +52,347 @@ static std::array<uint8_t, BLURR_N> boxesForGauss(double rad)  // standard devia
   return a;
 }
 
-static void boxBlurH_4 (uint8_t * s, int spitch, uint8_t *d, int dpitch, int w, int h, int r)
+namespace {
+
+// round(v/d) for the sums of a box of width d = 2r+1, as d is odd there are no
+// halves and this is the same as (v+r)/d. For d <= 4096 the division is replaced by a
+// multiplication with the fixed point reciprocal m = ceil(2^32/d): the sums are smaller
+// than 256*d, so the error of the reciprocal is too small to ever change the result
+class BoxDivider_c
+{
+  public:
+    uint32_t r, d, m;
+
+    explicit BoxDivider_c(int rad) : r(rad), d(2*rad+1), m(((1ull << 32) + d - 1) / d) {}
+
+    bool exact(void) const { return d <= 4096; }
+
+    uint8_t operator()(uint32_t v) const
+    {
+      if (exact())
+        return ((uint64_t)(v + r) * m) >> 32;
+      else
+        return (v + r) / d;
+    }
+};
+
+// the scratch memory of a thread, it is kept for the next blurr unless it is big
+class Scratch_c
+{
+  public:
+    std::vector<uint8_t> img1, img2, low;
+    std::vector<uint32_t> sums;
+
+    void prepare(size_t pixels, size_t line)
+    {
+      if (img1.size() < pixels) img1.resize(pixels);
+      if (img2.size() < pixels) img2.resize(pixels);
+      if (sums.size() < line) sums.resize(line);
+    }
+
+    void release(void)
+    {
+      if (img1.size() + low.size() > keepBytes)
+      {
+        std::vector<uint8_t>().swap(img1);
+        std::vector<uint8_t>().swap(img2);
+        std::vector<uint8_t>().swap(low);
+        std::vector<uint32_t>().swap(sums);
+      }
+    }
+
+    static const size_t keepBytes = 1024*1024;
+};
+
+thread_local Scratch_c scratch;
+
+#ifdef STLL_BLURR_SSE2
+// 16 columns of boxBlurColumns, s is the sum of the rows in the box, a is added and
+// b removed from it after the output of the current sums to d
+inline void columnsSSE2(uint32_t * s, const uint8_t * a, const uint8_t * b, uint8_t * d,
+                        __m128i r, __m128i m)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i high = _mm_set_epi32(-1, 0, -1, 0);
+
+  __m128i va = _mm_loadu_si128((const __m128i*)a);
+  __m128i vb = _mm_loadu_si128((const __m128i*)b);
+
+  __m128i a16[2] = { _mm_unpacklo_epi8(va, zero), _mm_unpackhi_epi8(va, zero) };
+  __m128i b16[2] = { _mm_unpacklo_epi8(vb, zero), _mm_unpackhi_epi8(vb, zero) };
+
+  __m128i q[4];
+
+  for (int k = 0; k < 4; k++)
+  {
+    __m128i sum = _mm_loadu_si128((const __m128i*)(s+4*k));
+
+    // the upper 32 bit of (sum+r)*m for all 4 lanes
+    __m128i v = _mm_add_epi32(sum, r);
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(v, m), 32);
+    __m128i odd = _mm_and_si128(_mm_mul_epu32(_mm_srli_epi64(v, 32), m), high);
+    q[k] = _mm_or_si128(even, odd);
+
+    __m128i a32 = (k & 1) ? _mm_unpackhi_epi16(a16[k/2], zero) : _mm_unpacklo_epi16(a16[k/2], zero);
+    __m128i b32 = (k & 1) ? _mm_unpackhi_epi16(b16[k/2], zero) : _mm_unpacklo_epi16(b16[k/2], zero);
+
+    _mm_storeu_si128((__m128i*)(s+4*k), _mm_sub_epi32(_mm_add_epi32(sum, a32), b32));
+  }
+
+  _mm_storeu_si128((__m128i*)d, _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+}
+#endif
+
+// box blurr of all columns of the image at once: the sums of the boxes of a row are
+// kept in s and updated from row to row, so the image is read row by row. Pixels outside
+// of the image have the value of the nearest pixel inside
+void boxBlurColumns(const uint8_t * src, int spitch, uint8_t * dst, int dpitch, int w, int h, int r, uint32_t * s)
 {
-  double iarr = 1.0 / (r+r+1);
-  if (r >= w)
+  BoxDivider_c div(r);
+
+  for (int x = 0; x < w; x++)
+    s[x] = (r+1) * src[x];
+
+  for (int y = 1; y <= r; y++)
+  {
+    const uint8_t * l = src + std::min(y, h-1)*spitch;
+
+    for (int x = 0; x < w; x++)
+      s[x] += l[x];
+  }
+
+  for (int y = 0; y < h; y++)
   {
-    for(int i = 0; i < h; i++)
+    const uint8_t * a = src + std::min(y+r+1, h-1)*spitch;
+    const uint8_t * b = src + std::max(y-r, 0)*spitch;
+    uint8_t * d = dst + y*dpitch;
+    int x = 0;
+
+#ifdef STLL_BLURR_SSE2
+    if (div.exact())
+    {
+      const __m128i vr = _mm_set1_epi32(div.r);
+      const __m128i vm = _mm_set1_epi32(div.m);
+
+      for (; x+16 <= w; x += 16)
+        columnsSSE2(s+x, a+x, b+x, d+x, vr, vm);
+    }
+#endif
+
+    for (; x < w; x++)
     {
-      int ti = i*dpitch;
-      int li = i*spitch;
-      int fv = s[li];
-      int lv = s[li+w-1];
-      int val = (r+1)*fv;
-      for (int j=0;   j < w; j++) val += s[li+j];
-      val += lv * (r-w);
-      for (int j=0;   j<= w; j++) { val += lv - fv; d[ti++] = round(val*iarr); }
+      d[x] = div(s[x]);
+      s[x] += a[x] - b[x];
     }
   }
-  else
+}
+
+// transpose the w x h image src into the h x w image dst, in tiles so
+// that the accesses on both sides stay within a few cache lines
+void transpose(const uint8_t * src, int spitch, uint8_t * dst, int dpitch, int w, int h)
+{
+  const int tile = 16;
+
+  for (int y0 = 0; y0 < h; y0 += tile)
+    for (int x0 = 0; x0 < w; x0 += tile)
+    {
+      int y1 = std::min(y0+tile, h);
+      int x1 = std::min(x0+tile, w);
+
+      for (int x = x0; x < x1; x++)
+        for (int y = y0; y < y1; y++)
+          dst[x*dpitch+y] = src[y*spitch+x];
+    }
+}
+
+// the 3 box blurr passes in both directions
+void boxBlurr(uint8_t * s, int pitch, int w, int h, double r, int sx, int sy)
+{
+  auto a = boxesForGauss(r/2);
+
+  scratch.prepare((size_t)w*h, std::max(w, h));
+
+  uint8_t * img1 = scratch.img1.data();
+  uint8_t * img2 = scratch.img2.data();
+  uint32_t * sums = scratch.sums.data();
+
+  for (int i = 0; i < BLURR_N; i++)
   {
-    for(int i = 0; i < h; i++)
+    int ry = sy*(a[i]-1)/2;
+    int rx = sx*(a[i]-1)/2;
+
+    // vertical pass from s into img1
+    const uint8_t * src = s;
+    int spitch = pitch;
+
+    if (ry > 0)
     {
-      int ti = i*dpitch;
-      int li = i*spitch;
-      int ri = li+r;
-      int fv = s[li];
-      int lv = s[li+w-1];
-      int val = (r+1)*fv;
-      for (int j=0;   j < r; j++) val += s[li+j];
-      for (int j=0;   j<= r; j++) { val += s[ri++] - fv     ; d[ti++] = round(val*iarr); }
-      for (int j=r+1; j<w-r; j++) { val += s[ri++] - s[li++]; d[ti++] = round(val*iarr); }
-      for (int j=w-r; j<w  ; j++) { val += lv      - s[li++]; d[ti++] = round(val*iarr); }
+      boxBlurColumns(s, pitch, img1, w, w, h, ry, sums);
+      src = img1;
+      spitch = w;
+    }
+
+    // horizontal pass back into s, done as vertical pass on the transposed image
+    if (rx > 0)
+    {
+      transpose(src, spitch, img2, h, w, h);
+      boxBlurColumns(img2, h, img1, h, h, w, rx, sums);
+      transpose(img1, h, s, pitch, h, w);
+    }
+    else if (src != s)
+    {
+      for (int y = 0; y < h; y++)
+        memcpy(s+y*pitch, src+y*spitch, w);
     }
   }
 }
 
-static void boxBlurT_4 (uint8_t * s, int spitch, uint8_t * d, int dpitch, int w, int h, int r)
+// each pixel of d is the average of a block of fx x fy pixels of s, the blocks at the
+// right and bottom border may be smaller
+void downsample(const uint8_t * s, int spitch, int w, int h, int fx, int fy, uint8_t * d, int dpitch)
 {
-  double iarr = 1.0 / (r+r+1);
-  if (r >= h)
+  int lw = (w + fx - 1) / fx;
+  int lh = (h + fy - 1) / fy;
+
+  std::vector<uint32_t> sums(lw);
+
+  for (int ly = 0; ly < lh; ly++)
   {
-    for(int i=0; i < w; i++)
+    std::fill(sums.begin(), sums.end(), 0);
+
+    int y0 = ly*fy;
+    int y1 = std::min(y0+fy, h);
+
+    for (int y = y0; y < y1; y++)
+      for (int lx = 0, x = 0; lx < lw; lx++)
+        for (int x1 = std::min(x+fx, w); x < x1; x++)
+          sums[lx] += s[y*spitch+x];
+
+    for (int lx = 0; lx < lw; lx++)
     {
-      int ti = i;
-      int ri = ti+r*spitch;
-      int fv = s[ti];
-      int lv = s[ti+spitch*(h-1)];
-      int val = (r+1)*fv;
-      for (int j=0;   j < h; j++) val += s[ti+j*spitch];
-      val += lv * (r-h);
-      for (int j=0  ; j<= h; j++) { val += lv - fv   ; d[ti] = round(val*iarr); ri+=spitch; ti+=dpitch; }
+      uint32_t n = (std::min(lx*fx+fx, w) - lx*fx) * (y1-y0);
+      d[ly*dpitch+lx] = (sums[lx] + n/2) / n;
     }
   }
-  else
+}
+
+// bilinear interpolation of the lw x lh image s to w x h pixels, the pixel centres of s are
+// in the centres of the blocks used by downsample, the weights use 8 bit fixed point
+void upsample(const uint8_t * s, int spitch, int lw, int lh, int fx, int fy, uint8_t * d, int dpitch, int w, int h)
+{
+  // the 2 source pixels and the weight of the second one for a position in one direction
+  auto weights = [](int n, int f, int ln, int * i0, int * i1, int * t)
+  {
+    for (int x = 0; x < n; x++)
+    {
+      // (x + 0.5)/f - 0.5 in 1/256 units
+      int u = ((2*x + 1 - f) * 256) / (2*f);
+      int k = (u < 0) ? 0 : u / 256;
+
+      i0[x] = std::min(k, ln-1);
+      i1[x] = std::min(k+1, ln-1);
+      t[x] = (u < 0) ? 0 : u % 256;
+    }
+  };
+
+  std::vector<int> cols(3*w), rows(3*h);
+
+  weights(w, fx, lw, cols.data(), cols.data()+w, cols.data()+2*w);
+  weights(h, fy, lh, rows.data(), rows.data()+h, rows.data()+2*h);
+
+  for (int y = 0; y < h; y++)
   {
-    for(int i=0; i < w; i++)
+    const uint8_t * l0 = s + rows[y]*spitch;
+    const uint8_t * l1 = s + rows[h+y]*spitch;
+    int ty = rows[2*h+y];
+
+    for (int x = 0; x < w; x++)
     {
-      int ti = i;
-      int li = ti;
-      int ri = ti+r*spitch;
-      int fv = s[ti];
-      int lv = s[ti+spitch*(h-1)];
-      int val = (r+1)*fv;
-      for (int j=0;   j < r; j++) val += s[ti+j*spitch];
-      for (int j=0  ; j<= r; j++) { val += s[ri] - fv   ; d[ti] = round(val*iarr); ri+=spitch; ti+=dpitch; }
-      for (int j=r+1; j<h-r; j++) { val += s[ri] - s[li]; d[ti] = round(val*iarr); li+=spitch; ri+=spitch; ti+=dpitch; }
-      for (int j=h-r; j<h  ; j++) { val += lv    - s[li]; d[ti] = round(val*iarr); li+=spitch; ti+=dpitch; }
+      int tx = cols[2*w+x];
+      uint32_t a = l0[cols[x]]*(256-ty) + l1[cols[x]]*ty;
+      uint32_t b = l0[cols[w+x]]*(256-ty) + l1[cols[w+x]]*ty;
+
+      d[y*dpitch+x] = (a*(256-tx) + b*tx + 32768) >> 16;
     }
   }
 }
 
-void gaussBlur (uint8_t * s, int pitch, int w, int h, double r, int sx, int sy)
+// the radius for the blurr at the resolution reduced by f so that the variance of the
+// complete filter, including the box of the downsampling and the bilinear interpolation,
+// is the same as the one of the box blurrs at full resolution
+double reducedRadius(double r, int f)
 {
   auto a = boxesForGauss(r/2);
-  auto d = std::make_unique<uint8_t[]>(w*h);
-  boxBlurT_4(s, pitch, d.get(), w, w, h, sy*(a[0]-1)/2);
-  boxBlurH_4(d.get(), w, s, pitch, w, h, sx*(a[0]-1)/2);
-  boxBlurT_4(s, pitch, d.get(), w, w, h, sy*(a[1]-1)/2);
-  boxBlurH_4(d.get(), w, s, pitch, w, h, sx*(a[1]-1)/2);
-  boxBlurT_4(s, pitch, d.get(), w, w, h, sy*(a[2]-1)/2);
-  boxBlurH_4(d.get(), w, s, pitch, w, h, sx*(a[2]-1)/2);
+
+  double v = 0;
+  for (auto b : a) v += (b*b-1)/12.0;
+
+  v = v/(f*f) - (f*f-1)/(12.0*f*f) - 1/6.0;
+
+  return 2*sqrt(std::max(v, 0.0));
+}
+
+// the blurr radius, in pixels, from which on gaussBlur works with downsampled images
+std::atomic<int> cutoff(24*64);
+
+}
+
+void setGaussBlurrCutoff(double r)
+{
+  cutoff = r*64;
+}
+
+double getGaussBlurrCutoff(void)
+{
+  return cutoff/64.0;
+}
+
+int gaussBlurrScale(double r)
+{
+  int c = cutoff;
+
+  // the radius at the reduced resolution is at least half of the cutoff
+  if (c <= 0 || r*64 < c)
+    return 1;
+  else
+    return std::max<int>(1, 2*r*64/c);
+}
+
+void gaussBlur (uint8_t * s, int pitch, int w, int h, double r, int sx, int sy)
+{
+  int f = gaussBlurrScale(r);
+
+  if (f == 1)
+  {
+    boxBlurr(s, pitch, w, h, r, sx, sy);
+  }
+  else
+  {
+    int fx = f*sx;
+    int fy = f*sy;
+    int lw = (w + fx - 1) / fx;
+    int lh = (h + fy - 1) / fy;
+
+    std::vector<uint8_t> & low = scratch.low;
+
+    if (low.size() < (size_t)lw*lh) low.resize((size_t)lw*lh);
+
+    downsample(s, pitch, w, h, fx, fy, low.data(), lw);
+    boxBlurr(low.data(), lw, lw, lh, reducedRadius(r, f), 1, 1);
+    upsample(low.data(), lw, lw, lh, fx, fy, s, pitch, w, h);
+  }
+
+  scratch.release();
+}
+
+void gaussBlurDown(const uint8_t * s, int spitch, int w, int h, double r, uint8_t * d, int dpitch)
+{
+  int f = gaussBlurrScale(r);
+
+  downsample(s, spitch, w, h, f, f, d, dpitch);
+  boxBlurr(d, dpitch, (w + f - 1) / f, (h + f - 1) / f, reducedRadius(r, f), 1, 1);
+
+  scratch.release();
 }
 
 int gaussBlurrDist(double r)
@@ -133,4 +402,20 @@ int gaussBlurrDist(double r)
   return /*(a[0]-1)/2 + (a[1]-1)/2 +*/ a[2];
 }
 
+int gaussBlurrReach(double r)
+{
+  int f = gaussBlurrScale(r);
+
+  auto a = boxesForGauss((f == 1 ? r : reducedRadius(r, f))/2);
+
+  int reach = 0;
+
+  for (int i = 0; i < BLURR_N; i++)
+    reach += (a[i]-1)/2;
+
+  // at reduced resolution the block of the downsampling and the interpolation
+  // add one pixel each
+  return f == 1 ? reach : (reach + 2) * f;
+}
+
 } }
\ No newline at end of file
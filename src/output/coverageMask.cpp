@@ -0,0 +1,142 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stll/internal/coverageMask.h>
+#include <stll/internal/blitter.h>
+#include <stll/internal/dividers.h>
+#include <stll/layouter.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace STLL { namespace internal {
+
+CoverageMask_c::CoverageMask_c(const TextLayout_c & l, SubPixelArrangement s, GlyphCache_c & cache) : sp(s)
+{
+  auto & cmds = l.getData();
+
+  // the images must stay valid until they are drawn into the mask
+  GlyphCache_c::Hold_c hold(cache);
+
+  std::vector<SlicedImage_c> img(cmds.size());
+
+  // the area of the mask in pixels, it contains exactly the pixels the blitters
+  // write for the commands
+  int64_t x0 = std::numeric_limits<int64_t>::max();
+  int64_t y0 = std::numeric_limits<int64_t>::max();
+  int64_t x1 = std::numeric_limits<int64_t>::min();
+  int64_t y1 = std::numeric_limits<int64_t>::min();
+
+  for (size_t n = 0; n < cmds.size(); n++)
+  {
+    auto & i = cmds[n];
+    int64_t ix0, iy0, ix1, iy1;
+
+    if (i.command == CommandData_c::CMD_GLYPH)
+      img[n] = SlicedImage_c(cache.getGlyph(i.font, i.glyphIndex, sp, i.blurr));
+    else if (i.command == CommandData_c::CMD_RECT && i.blurr != 0)
+      img[n] = cache.getRect(i.w, i.h, sp, i.blurr);
+
+    if (img[n].image)
+    {
+      ix0 = div_inf<int64_t>(i.x, 64) + img[n].image->left;
+      ix1 = ix0 + ((sp == SUBP_NONE) ? img[n].width() + 1 : img[n].width() / 3);
+      iy0 = div_inf<int64_t>((int64_t)i.y + 32, 64) - img[n].image->top;
+      iy1 = iy0 + img[n].rows();
+    }
+    else if (i.command == CommandData_c::CMD_RECT)
+    {
+      ix0 = div_inf<int64_t>((int64_t)i.x + 32, 64);
+      iy0 = div_inf<int64_t>((int64_t)i.y + 32, 64);
+      ix1 = div_inf<int64_t>((int64_t)i.x + i.w + 32, 64);
+      iy1 = div_inf<int64_t>((int64_t)i.y + i.h + 32, 64);
+    }
+    else
+    {
+      continue;
+    }
+
+    if (ix1 <= ix0 || iy1 <= iy0) continue;
+
+    x0 = std::min(x0, ix0);
+    y0 = std::min(y0, iy0);
+    x1 = std::max(x1, ix1);
+    y1 = std::max(y1, iy1);
+  }
+
+  if (x1 <= x0 || y1 <= y0) return;
+
+  int f = (sp == SUBP_NONE) ? 1 : 3;
+  int w = x1 - x0;
+  int h = y1 - y0;
+
+  GlyphCacheFile_c::Record_c r;
+  r.left = x0;
+  r.top = -y0;
+  r.width = f*w;
+  r.rows = h;
+  r.pitch = f*(w+1);
+
+  std::vector<uint8_t> mask((size_t)r.pitch*h, 0);
+
+  // the coverage of the commands is combined, see blendCoverage, the sub-pixels are
+  // kept in the byte order of the image
+  auto get1 = [](const uint8_t * p) -> auto { return std::make_tuple(p[0], p[0], p[0]); };
+  auto put1 = [](uint8_t * p, uint8_t a, uint8_t, uint8_t) -> void { p[0] = a; };
+  auto get3 = [](const uint8_t * p) -> auto { return std::make_tuple(p[0], p[1], p[2]); };
+  auto put3 = [](uint8_t * p, uint8_t a, uint8_t b, uint8_t c) -> void { p[0] = a; p[1] = b; p[2] = c; };
+
+  for (size_t n = 0; n < cmds.size(); n++)
+  {
+    auto & i = cmds[n];
+    int32_t x = (int64_t)i.x - 64*x0;
+    int32_t y = (int64_t)i.y - 64*y0;
+
+    if (img[n].image)
+    {
+      int alpha = i.c.a();
+
+      auto draw = [&](const PaintData_c & p)
+      {
+        if (sp == SUBP_NONE)
+          outputGlyph_NONE(x, y, p, Color_c(255, 255, 255, alpha), mask.data(), r.pitch, 1, w, h, get1, put1, blendCoverage);
+        else
+          outputGlyph_HorizontalRGB(x, y, p, 255, 255, 255, alpha, mask.data(), r.pitch, 3, w, h, get3, put3, blendCoverage);
+      };
+
+      if (img[n].stretched())
+        img[n].strips(0, img[n].rows(), draw);
+      else
+        draw(*img[n].image);
+    }
+    else if (i.command == CommandData_c::CMD_RECT)
+    {
+      // unblurred rectangles are filled without blending by the output drivers
+      fillCoverageRect(x, y, i.w, i.h, mask.data(), r.pitch, f, w, h);
+    }
+  }
+
+  data = std::make_shared<Data_c>(r, mask.data());
+}
+
+} }
@@ -0,0 +1,152 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stll/internal/drawList.h>
+#include <stll/internal/glyphprepare.h>
+#include <stll/internal/dividers.h>
+#include <stll/layouter.h>
+
+
+namespace STLL { namespace internal {
+
+static_assert(GlyphCache_c::numShards <= 32, "the shards of a draw list must fit into its bit mask");
+
+bool DrawList_c::valid(const std::shared_ptr<GlyphCache_c> & c, SubPixelArrangement s, uint8_t g) const
+{
+  if (!cache || cache != c || sp != s || gamma != g) return false;
+
+  for (size_t n = 0; n < GlyphCache_c::numShards; n++)
+    if ((shards & (1u << n)) && c->getRemovals(n) != removals[n])
+      return false;
+
+  return true;
+}
+
+void DrawList_c::clear(void)
+{
+  runs.clear();
+  items.clear();
+  urls.clear();
+  cache.reset();
+  shards = 0;
+}
+
+void DrawList_c::compile(const TextLayout_c & l, const std::vector<size_t> * commands, SubPixelArrangement s,
+                         const std::shared_ptr<GlyphCache_c> & c, size_t threads)
+{
+  clear();
+
+  auto & data = l.getData();
+
+  cache = c;
+  sp = s;
+
+  // the counters are read before the images are looked up, so that the images of the list evicted
+  // while compiling (by this or other threads) invalidate the list, this includes the images
+  // that are not admitted to the cache, they are freed when the cache is released. The images are
+  // looked up as listed, so only their removal counts, not that of the other images of the shards
+  for (size_t n = 0; n < GlyphCache_c::numShards; n++)
+    removals[n] = c->getRemovals(n);
+
+  if (commands)
+    c->prepare(l, *commands, sp, threads, false);
+  else
+    c->prepare(l, sp, threads, false);
+
+  size_t num = commands ? commands->size() : data.size();
+
+  items.reserve(num);
+
+  for (size_t n = 0; n < num; n++)
+  {
+    auto & i = data[commands ? (*commands)[n] : n];
+    Item_c it { SlicedImage_c(), i.x, i.y, (int32_t)i.w, (int32_t)i.h, 0 };
+    RunKind k;
+
+    switch (i.command)
+    {
+      case CommandData_c::CMD_GLYPH:
+        k = RUN_GLYPHS;
+        it.img = SlicedImage_c(c->getGlyph(i.font, i.glyphIndex, sp, i.blurr, true));
+        shards |= 1u << GlyphCache_c::shardIndex(GlyphKey_c(i.font, i.glyphIndex, sp, i.blurr));
+        break;
+
+      case CommandData_c::CMD_RECT:
+        if (i.blurr == 0)
+        {
+          k = RUN_RECTS;
+        }
+        else
+        {
+          int ew, eh;
+
+          k = RUN_GLYPHS;
+          it.img = c->getRect(i.w, i.h, sp, i.blurr, true);
+          shards |= 1u << GlyphCache_c::shardIndex(rectSliceKey(GlyphKey_c(i.w, i.h, sp, i.blurr), ew, eh));
+        }
+        break;
+
+      case CommandData_c::CMD_IMAGE:
+        k = RUN_IMAGES;
+        it.url = urls.size();
+        urls.push_back(i.imageURL);
+        break;
+
+      default:
+        continue;
+    }
+
+    if (runs.empty() || runs.back().kind != k || !(runs.back().c == i.c))
+      runs.push_back(Run_c { k, i.c, i.c, (uint32_t)items.size(), (uint32_t)items.size() });
+
+    items.push_back(it);
+    runs.back().last++;
+  }
+}
+
+std::pair<int, int> DrawList_c::rows(const Run_c & r, const Item_c & i, int sy)
+{
+  switch (r.kind)
+  {
+    case RUN_GLYPHS:
+      return imageRows(i.y, i.img, sy);
+
+    case RUN_RECTS:
+      return rectRows(i.y, i.h, sy);
+
+    default:
+      return std::make_pair(0, 0);
+  }
+}
+
+std::pair<int, int> DrawList_c::imageRows(int32_t y, const SlicedImage_c & img, int sy)
+{
+  int t = div_inf(sy+y+32, 64) - img.image->top;
+  return std::make_pair(t - 1, t + img.rows() + 1);
+}
+
+std::pair<int, int> DrawList_c::rectRows(int32_t y, int32_t h, int sy)
+{
+  return std::make_pair((y+sy+32)/64 - 1, (y+sy+h+32)/64 + 1);
+}
+
+} }
@@ -34,89 +34,911 @@
 #include FT_FREETYPE_H
 
 #include <unordered_map>
+#include <tuple>
+#include <cstring>
+#include <algorithm>
+#include <unordered_set>
+#include <thread>
+#include <iterator>
+#include <chrono>
 
 // TODO properly handle it, when FreeType returns an bitmap format that is not supported
 
 namespace STLL { namespace internal {
 
+size_t SlabAllocator_c::sizeClass(size_t n)
+{
+  if (n <= 256) return (n+15)/16 - 1;
+
+  // find k with 2^k < n <= 2^(k+1) and split that range into 4 classes
+  size_t k = 8;
+  while (((size_t)2 << k) < n) k++;
+
+  return 16 + (k-8)*4 + (n - 1 - ((size_t)1 << k)) / ((size_t)1 << (k-2));
+}
+
+size_t SlabAllocator_c::classBytes(size_t c)
+{
+  if (c < 16) return (c+1)*16;
+
+  size_t k = (c-16)/4 + 8;
+  return ((size_t)1 << k) + ((c-16)%4 + 1)*((size_t)1 << (k-2));
+}
+
+uint8_t * SlabAllocator_c::allocate(size_t n)
+{
+  if (n == 0) n = 1;
+
+  if (n > maxSlab)
+  {
+    bigBytes += n;
+    return new uint8_t[n];
+  }
+
+  size_t c = sizeClass(n);
+  uint8_t * p = freeLists[c];
+
+  liveBlocks++;
+
+  if (p)
+  {
+    // the free blocks contain the pointer to the next free block
+    std::memcpy(&freeLists[c], p, sizeof(uint8_t*));
+    return p;
+  }
+
+  size_t b = classBytes(c);
+
+  if (bumpLeft < b)
+  {
+    // put the rest of the current page into the free lists of the smaller classes
+    while (bumpLeft >= 16)
+    {
+      size_t r = sizeClass(bumpLeft);
+      if (classBytes(r) > bumpLeft) r--;
+
+      std::memcpy(bump, &freeLists[r], sizeof(uint8_t*));
+      freeLists[r] = bump;
+      bump += classBytes(r);
+      bumpLeft -= classBytes(r);
+    }
+
+    pages.emplace_back(new uint8_t[pageSize]);
+    bump = pages.back().get();
+    bumpLeft = pageSize;
+  }
+
+  p = bump;
+  bump += b;
+  bumpLeft -= b;
+
+  return p;
+}
+
+void SlabAllocator_c::release(uint8_t * p, size_t n)
+{
+  if (!p) return;
+
+  if (n == 0) n = 1;
+
+  if (n > maxSlab)
+  {
+    bigBytes -= n;
+    delete [] p;
+    return;
+  }
+
+  size_t c = sizeClass(n);
+
+  std::memcpy(p, &freeLists[c], sizeof(uint8_t*));
+  freeLists[c] = p;
+
+  liveBlocks--;
+
+  if (liveBlocks == 0)
+  {
+    pages.clear();
+    freeLists.fill(nullptr);
+    bump = nullptr;
+    bumpLeft = 0;
+  }
+}
+
+uint8_t * PaintData_c::allocate(int w, int h)
+{
+  bufferSize = (size_t)w*h;
+  uint8_t * b = slab.allocate(bufferSize);
+  std::memset(b, 0, bufferSize);
+  buffer = b;
+  return b;
+}
+
+// use the image within a cache file
+PaintData_c::PaintData_c(const GlyphCacheFile_c::Record_c & r, const uint8_t * data, SlabAllocator_c & a, bool copy) :
+  left(r.left), top(r.top), rows(r.rows), width(r.width), pitch(r.pitch), slab(a), buffer(data), owned(false)
+{
+  if (copy)
+  {
+    owned = true;
+    std::memcpy(allocate(pitch, rows), data, (size_t)pitch*rows);
+  }
+}
+
 // create from glyph data
-PaintData_c::PaintData_c(const FontFace_c::GlyphSlot_c & ft, uint16_t blurr, SubPixelArrangement sp)
+PaintData_c::PaintData_c(const FontFace_c::GlyphSlot_c & ft, uint16_t blurr, SubPixelArrangement sp, SlabAllocator_c & a) : slab(a)
 {
   std::tie(left, top, width, pitch, rows) = glyphPrepare(ft, blurr, sp, 0,
     [this](int w, int h, int, int) -> auto {
-      buffer = std::make_unique<uint8_t[]>(w*h);
-      return std::make_tuple(buffer.get(), w);});
+      return std::make_tuple(allocate(w, h), w);});
 }
 
 // create rectangle data
-PaintData_c::PaintData_c(uint16_t _pitch, uint16_t _rows, uint16_t blurr, SubPixelArrangement sp)
+PaintData_c::PaintData_c(uint16_t _pitch, uint16_t _rows, uint16_t blurr, SubPixelArrangement sp, SlabAllocator_c & a) : slab(a)
 {
   FontFace_c::GlyphSlot_c ft(_pitch, _rows);
 
   std::tie(left, top, width, pitch, rows) = glyphPrepare(ft, blurr, sp, 0,
     [this](int w, int h, int, int) -> auto {
-      buffer = std::make_unique<uint8_t[]>(w*h);
-      return std::make_tuple(buffer.get(), w);});
+      return std::make_tuple(allocate(w, h), w);});
+}
+
+// append runs of kind k for n columns, the values come from v for runs of values
+static void appendRuns(std::vector<uint8_t> & out, int k, int n, const uint8_t * v)
+{
+  while (n > 0)
+  {
+    int l = std::min(n, 64);
+
+    out.push_back((k << 6) | (l-1));
+
+    if (k == PaintData_c::runValues)
+    {
+      out.insert(out.end(), v, v+l);
+      v += l;
+    }
+
+    n -= l;
+  }
+}
+
+void PaintData_c::compress(void)
+{
+  if (!owned || compressed || rows <= 0) return;
+
+  std::vector<uint32_t> offsets(rows);
+  std::vector<uint8_t> runs;
+  size_t header = sizeof(uint32_t)*rows;
+
+  // transparent and opaque columns are collected into runs when there are at least 2
+  // of them, everything in between becomes a run of values
+  auto uniformAt = [this](const uint8_t * r, int x) -> bool
+  {
+    return (r[x] == 0 || r[x] == 255) && x+1 < pitch && r[x+1] == r[x];
+  };
+
+  for (int y = 0; y < rows; y++)
+  {
+    const uint8_t * r = buffer + y*pitch;
+    int x = 0;
+
+    offsets[y] = header + runs.size();
+
+    while (x < pitch)
+    {
+      if (uniformAt(r, x))
+      {
+        int e = x+2;
+        while (e < pitch && r[e] == r[x]) e++;
+
+        appendRuns(runs, r[x] ? runFull : runZero, e-x, nullptr);
+        x = e;
+      }
+      else
+      {
+        int e = x+1;
+        while (e < pitch && !uniformAt(r, e)) e++;
+
+        appendRuns(runs, runValues, e-x, r+x);
+        x = e;
+      }
+    }
+
+    // stop when the encoded image is not smaller
+    if (header + runs.size() >= bufferSize) return;
+  }
+
+  size_t n = header + runs.size();
+  uint8_t * b = slab.allocate(n);
+
+  std::memcpy(b, offsets.data(), header);
+  std::memcpy(b + header, runs.data(), runs.size());
+
+  slab.release(const_cast<uint8_t*>(buffer), bufferSize);
+
+  buffer = b;
+  bufferSize = n;
+  compressed = true;
+}
+
+void PaintData_c::decodeRow(int y, uint8_t * dst) const
+{
+  RunReader_c r(*this, y);
+  int x = 0;
+
+  while (x < pitch)
+  {
+    int v;
+    const uint8_t * d;
+    int n = r.next(pitch-x, v, d);
+
+    if (v < 0)
+      std::memcpy(dst+x, d, n);
+    else
+      std::memset(dst+x, v, n);
+
+    x += n;
+  }
+}
+
+void SlicedImage_c::render(int32_t y0, int32_t y1, uint8_t * dst, int32_t dpitch) const
+{
+  int32_t mx = image->width / 2;
+  int32_t my = image->rows / 2;
+
+  for (int32_t y = y0; y < y1; y++)
+  {
+    int32_t sy = (y <= my) ? y : (y <= my + extraH) ? my : y - extraH;
+    const uint8_t * src = image->getBuffer() + sy*image->pitch;
+    uint8_t * d = dst + (y-y0)*dpitch;
+
+    memcpy(d, src, mx);
+    memset(d + mx, src[mx], extraW + 1);
+    memcpy(d + mx + extraW + 1, src + mx + 1, image->pitch - mx - 1);
+  }
+}
+
+void GlyphCache_c::unlink(Shard_c & s, Entry_c * e)
+{
+  if (e->prev) e->prev->next = e->next; else s.newest = e->next;
+  if (e->next) e->next->prev = e->prev; else s.oldest = e->prev;
+
+  e->prev = e->next = nullptr;
+}
+
+void GlyphCache_c::pushFront(Shard_c & s, Entry_c * e)
+{
+  e->prev = nullptr;
+  e->next = s.newest;
+
+  if (s.newest) s.newest->prev = e; else s.oldest = e;
+
+  s.newest = e;
+}
+
+void GlyphCache_c::touch(Shard_c & s, Entry_c * e)
+{
+  if (e != s.newest)
+  {
+    unlink(s, e);
+    pushFront(s, e);
+  }
+}
+
+void GlyphCache_c::erase(size_t s, Entry_c * e)
+{
+  auto & sh = shards[s];
+
+  unlink(sh, e);
+  sh.stats.bytes -= e->data->memory() + entryOverhead;
+  if (e->listed) sh.removals++;
+
+  auto d = std::move(e->data);
+  sh.map.erase(*e->key);
+  retire(s, std::move(d));
+}
+
+void GlyphCache_c::shrink(size_t s, size_t bytes)
+{
+  auto & sh = shards[s];
+
+  while (sh.stats.bytes > bytes && sh.oldest)
+  {
+    erase(s, sh.oldest);
+    sh.stats.evictions++;
+  }
+}
+
+void GlyphCache_c::retire(size_t s, std::unique_ptr<PaintData_c> p, bool keep)
+{
+  {
+    std::lock_guard<std::mutex> lock(holdMutex);
+
+    if (!holds.empty())
+    {
+      retired.push_back(Retired_c { epoch++, s, std::move(p) });
+      return;
+    }
+  }
+
+  if (keep)
+    shards[s].uncached = std::move(p);
+}
+
+PaintData_c & GlyphCache_c::insert(size_t s, const GlyphKey_c & k, std::unique_ptr<PaintData_c> d, uint64_t fontHash,
+                                   uint32_t fontSize, bool admit, bool listed)
+{
+  auto & sh = shards[s];
+
+  // a prepare may have added the same image while it was rendered, keep that one
+  auto e = sh.map.find(k);
+
+  if (e != sh.map.end())
+  {
+    touch(sh, &e->second);
+    e->second.listed |= listed;
+    return *e->second.data;
+  }
+
+  // rectangles are not encoded, SlicedImage_c needs their pixels
+  if (compression && k.font)
+    d->compress();
+
+  size_t bytes = d->memory() + entryOverhead;
+  size_t b = shardBudget();
+
+  if (bytes > b || (!admit && bytes > getAdmissionLimit()))
+  {
+    // only admit big images, when they have been requested recently, otherwise
+    // just keep them until the next request
+    size_t h = std::hash<GlyphKey_c>()(k);
+    auto r = std::find(sh.rejected.begin(), sh.rejected.end(), h);
+
+    if (bytes > b || r == sh.rejected.end())
+    {
+      if (r == sh.rejected.end())
+      {
+        sh.rejected[sh.rejectedPos] = h;
+        sh.rejectedPos = (sh.rejectedPos + 1) % sh.rejected.size();
+      }
+
+      sh.stats.bypassed++;
+      if (listed) sh.removals++;
+
+      PaintData_c & p = *d;
+      retire(s, std::move(d), true);
+      return p;
+    }
+
+    *r = 0;
+  }
+
+  shrink(s, b - bytes);
+
+  auto i = sh.map.emplace(k, std::move(d)).first;
+  i->second.key = &i->first;
+  i->second.fontHash = fontHash;
+  i->second.fontSize = fontSize;
+  i->second.listed = listed;
+  pushFront(sh, &i->second);
+  sh.stats.bytes += bytes;
+
+  return *i->second.data;
+}
+
+bool GlyphCache_c::contains(const GlyphKey_c & k)
+{
+  auto & sh = shards[shardIndex(k)];
+  std::lock_guard<std::mutex> lock(sh.mutex);
+
+  return sh.map.count(k) || sh.flights.count(k);
+}
+
+// fill the key fields of a cache file record
+static GlyphCacheFile_c::Record_c fileKey(const GlyphKey_c & k, uint64_t fontHash, uint32_t fontSize)
+{
+  GlyphCacheFile_c::Record_c r;
+  memset(&r, 0, sizeof(r));
+
+  r.font = fontHash;
+  r.size = fontSize;
+  r.glyph = k.glyphIndex;
+  r.sp = k.sp;
+  r.blurr = k.blurr;
+  r.w = k.w;
+  r.h = k.h;
+
+  return r;
+}
+
+const uint8_t * GlyphCache_c::findInFiles(const GlyphKey_c & k, uint64_t fontHash, uint32_t fontSize,
+                                          const GlyphCacheFile_c::Record_c *& rec) const
+{
+  auto r = fileKey(k, fontHash, fontSize);
+
+  for (auto & f : files)
+  {
+    rec = f->find(r);
+    if (rec) return f->getData(*rec);
+  }
+
+  return nullptr;
+}
+
+template <class S>
+PaintData_c & GlyphCache_c::get(const GlyphKey_c & k, S setup, bool listed)
+{
+  size_t s = shardIndex(k);
+  auto & sh = shards[s];
+
+  std::unique_lock<std::mutex> lock(sh.mutex);
+
+  while (true)
+  {
+    auto i = sh.map.find(k);
+
+    if (i != sh.map.end())
+    {
+      sh.stats.hits++;
+      touch(sh, &i->second);
+      i->second.listed |= listed;
+      return *i->second.data;
+    }
+
+    auto f = sh.flights.find(k);
+
+    if (f == sh.flights.end()) break;
+
+    // another thread renders the image, wait for it, when the image was not admitted
+    // to the cache it is not found afterwards and rendered again here
+    auto fl = f->second;
+    fl->cv.wait(lock, [&fl]() { return fl->done; });
+  }
+
+  PrepareJob_c j(k);
+  setup(j);
+
+  if (!files.empty() && (!j.face || j.image.font))
+  {
+    const GlyphCacheFile_c::Record_c * r;
+    auto d = findInFiles(k, j.image.font, j.image.size, r);
+
+    if (d)
+    {
+      sh.stats.fileHits++;
+      return insert(s, k, std::make_unique<PaintData_c>(*r, d, sh.slab), j.image.font, j.image.size, false, listed);
+    }
+  }
+
+  sh.stats.misses++;
+
+  // render without holding the lock, so that other threads can use the shard in the meantime
+  auto fl = std::make_shared<Flight_c>();
+  sh.flights.emplace(k, fl);
+  lock.unlock();
+
+  auto land = [&]()
+  {
+    lock.lock();
+    sh.flights.erase(k);
+    fl->done = true;
+    fl->cv.notify_all();
+  };
+
+  try
+  {
+    render(j);
+  }
+  catch (...)
+  {
+    land();
+    throw;
+  }
+
+  land();
+
+  return insert(s, k, std::make_unique<PaintData_c>(j.image, j.data.data(), sh.slab, true), j.image.font, j.image.size,
+                false, listed);
 }
 
 // get the glyph from the cache, or render new using FreeType
-PaintData_c & GlyphCache_c::getGlyph(std::shared_ptr<FontFace_c> face, glyphIndex_t glyph, SubPixelArrangement sp, uint16_t blurr)
+PaintData_c & GlyphCache_c::getGlyph(std::shared_ptr<FontFace_c> face, glyphIndex_t glyph, SubPixelArrangement sp, uint16_t blurr,
+                                     bool listed)
 {
   GlyphKey_c k(face, glyph, sp, blurr);
 
-  auto i = glyphCache.find(k);
+  if (hasPending)
+    addPending();
+
+  // the first call for a font hashes the whole font file, do that before the shard is locked,
+  // so that the other threads using the shard don't have to wait for it
+  uint64_t fontHash = persistent ? face->getFile()->getContentHash() : 0;
+
+  return get(k, [&k, &face, fontHash](PrepareJob_c & j)
+  {
+    j.face = face;
+    j.image = fileKey(k, fontHash, face->getSize());
+  }, listed);
+}
+
+SlicedImage_c GlyphCache_c::getRect(int w, int h, SubPixelArrangement sp, uint16_t blurr, bool listed)
+{
+  int ew, eh;
+  GlyphKey_c k = rectSliceKey(GlyphKey_c(w, h, sp, blurr), ew, eh);
+
+  if (hasPending)
+    addPending();
+
+  return SlicedImage_c(get(k, [&k](PrepareJob_c & j) { j.image = fileKey(k, 0, 0); }, listed), ew, eh);
+}
 
-  if (i == glyphCache.end())
+void GlyphCache_c::trim(size_t num)
+{
+  // the entries are spread evenly over the shards
+  for (size_t s = 0; s < numShards; s++)
   {
-    auto g = face->renderGlyph(glyph, sp);
+    auto & sh = shards[s];
+    std::lock_guard<std::mutex> lock(sh.mutex);
 
-    i = glyphCache.insert(std::make_pair(k, std::move(PaintData_c(g, blurr, sp)))).first;
+    size_t n = num / numShards + (s < num % numShards ? 1 : 0);
+
+    while (sh.map.size() > n)
+      erase(s, sh.oldest);
   }
+}
 
-  i->second.lastUse = useCounter;
-  useCounter++;
+uint64_t GlyphCache_c::hold(void)
+{
+  std::lock_guard<std::mutex> lock(holdMutex);
 
-  return i->second;
+  holds.insert(epoch);
+  return epoch;
 }
 
-PaintData_c & GlyphCache_c::getRect(int w, int h, SubPixelArrangement sp, uint16_t blurr)
+void GlyphCache_c::release(uint64_t ticket)
 {
-  GlyphKey_c k(w, h, sp, blurr);
+  std::vector<Retired_c> done;
+
+  {
+    std::lock_guard<std::mutex> lock(holdMutex);
+
+    holds.erase(holds.find(ticket));
+
+    // the images retired before the oldest remaining hold started are not used anymore
+    uint64_t oldest = holds.empty() ? std::numeric_limits<uint64_t>::max() : *holds.begin();
+
+    while (!retired.empty() && retired.front().epoch < oldest)
+    {
+      done.push_back(std::move(retired.front()));
+      retired.pop_front();
+    }
+  }
+
+  // the images must be freed with the lock of their shard, as the shard allocators are not locked
+  for (auto & r : done)
+  {
+    std::lock_guard<std::mutex> lock(shards[r.shard].mutex);
+    r.image.reset();
+  }
+}
 
-  auto i = glyphCache.find(k);
+void GlyphCache_c::setBudget(size_t bytes)
+{
+  budget = bytes;
 
-  if (i == glyphCache.end())
+  for (size_t s = 0; s < numShards; s++)
   {
-    i = glyphCache.insert(std::make_pair(k, std::move(PaintData_c(k.w, k.h, k.blurr, k.sp)))).first;
+    std::lock_guard<std::mutex> lock(shards[s].mutex);
+    shrink(s, shardBudget());
   }
+}
 
-  return i->second;
+GlyphCache_c::~GlyphCache_c(void)
+{
+  for (auto & t : tasks)
+    t.wait();
 }
 
-void GlyphCache_c::trim(size_t num)
+void GlyphCache_c::render(PrepareJob_c & j)
+{
+  auto m = [&j](int w, int h, int, int) -> auto {
+    j.data.assign((size_t)w*h, 0);
+    return std::make_tuple(j.data.data(), w);};
+
+  if (j.face)
+    std::tie(j.image.left, j.image.top, j.image.width, j.image.pitch, j.image.rows) =
+      glyphPrepare(j.face->renderGlyph(j.key.glyphIndex, j.key.sp), j.key.blurr, j.key.sp, 0, m);
+  else
+    std::tie(j.image.left, j.image.top, j.image.width, j.image.pitch, j.image.rows) =
+      glyphPrepare(FontFace_c::GlyphSlot_c(j.key.w, j.key.h), j.key.blurr, j.key.sp, 0, m);
+
+  j.done = true;
+}
+
+void GlyphCache_c::render(std::vector<PrepareJob_c> & jobs, size_t threads)
 {
-  if (num == 0)
+  std::atomic<size_t> next(0);
+
+  auto worker = [&jobs, &next]()
+  {
+    size_t n;
+
+    while ((n = next++) < jobs.size())
+    {
+      try
+      {
+        render(jobs[n]);
+      }
+      catch (...)
+      {
+        // leave the image out, it is rendered again when it is used and the error
+        // is reported then
+      }
+    }
+  };
+
+  std::vector<std::thread> t;
+
+  for (size_t i = 1; i < std::min(threads, jobs.size()); i++)
+    t.emplace_back(worker);
+
+  worker();
+
+  for (auto & i : t)
+    i.join();
+}
+
+void GlyphCache_c::add(std::vector<PrepareJob_c> & jobs)
+{
+  for (auto & j : jobs)
   {
-    glyphCache.clear();
+    if (!j.done) continue;
+
+    // when the job holds the only reference to the face, the face is destroyed right
+    // afterwards and the image would never be used
+    if (j.face && j.face.use_count() == 1) continue;
+
+    if (j.data.size() + entryOverhead > shardBudget()) continue;
+
+    size_t s = shardIndex(j.key);
+    auto & sh = shards[s];
+    std::lock_guard<std::mutex> lock(sh.mutex);
+
+    if (sh.map.count(j.key)) continue;
+
+    insert(s, j.key, std::make_unique<PaintData_c>(j.image, j.data.data(), sh.slab, true), j.image.font, j.image.size, true);
   }
-  else if (num < glyphCache.size())
+}
+
+void GlyphCache_c::addPending(void)
+{
+  std::vector<PrepareJob_c> j;
+
   {
-    // find elements that are oldest in the cache
-    std::vector<std::unordered_map<GlyphKey_c, PaintData_c>::iterator> entries;
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    j.swap(pending);
+    hasPending = false;
+  }
+
+  add(j);
+}
+
+size_t GlyphCache_c::prepare(const TextLayout_c & l, SubPixelArrangement sp, size_t threads, bool async)
+{
+  return prepare(l, nullptr, sp, threads, async);
+}
+
+size_t GlyphCache_c::prepare(const TextLayout_c & l, const std::vector<size_t> & commands, SubPixelArrangement sp,
+                             size_t threads, bool async)
+{
+  return prepare(l, &commands, sp, threads, async);
+}
+
+size_t GlyphCache_c::prepare(const TextLayout_c & l, const std::vector<size_t> * commands, SubPixelArrangement sp,
+                             size_t threads, bool async)
+{
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  addPending();
+
+  // collect all images that are neither in the cache nor in one of the cache files
+  std::vector<PrepareJob_c> jobs;
+  std::unordered_set<GlyphKey_c> seen;
+  const GlyphCacheFile_c::Record_c * r;
+
+  auto collect = [&](const CommandData_c & i)
+  {
+    if (i.command == CommandData_c::CMD_GLYPH)
+    {
+      GlyphKey_c k(i.font, i.glyphIndex, sp, i.blurr);
+
+      if (!seen.insert(k).second || contains(k)) return;
+
+      uint64_t fontHash = persistent ? i.font->getFile()->getContentHash() : 0;
+
+      if (fontHash && findInFiles(k, fontHash, i.font->getSize(), r)) return;
+
+      jobs.emplace_back(k);
+      jobs.back().face = i.font;
+      jobs.back().image = fileKey(k, fontHash, i.font->getSize());
+    }
+    else if (i.command == CommandData_c::CMD_RECT && i.blurr != 0)
+    {
+      int ew, eh;
+      GlyphKey_c k = rectSliceKey(GlyphKey_c(i.w, i.h, sp, i.blurr), ew, eh);
+
+      if (!seen.insert(k).second || contains(k)) return;
+      if (findInFiles(k, 0, 0, r)) return;
+
+      jobs.emplace_back(k);
+      jobs.back().image = fileKey(k, 0, 0);
+    }
+  };
+
+  if (commands)
+    for (auto n : *commands)
+      collect(l.getData()[n]);
+  else
+    for (auto & i : l.getData())
+      collect(i);
+
+  size_t n = jobs.size();
+
+  if (n == 0) return 0;
+
+  if (async)
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [](const std::future<void> & t) {
+      return t.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }), tasks.end());
+
+    tasks.emplace_back(std::async(std::launch::async, [this, threads](std::vector<PrepareJob_c> j)
+    {
+      render(j, threads);
+
+      std::lock_guard<std::mutex> lock(pendingMutex);
+      std::move(j.begin(), j.end(), std::back_inserter(pending));
+      hasPending = true;
+    }, std::move(jobs)));
+  }
+  else
+  {
+    render(jobs, threads);
+    add(jobs);
+  }
+
+  return n;
+}
+
+bool GlyphCache_c::addFile(const std::string & path)
+{
+  persistent = true;
+
+  auto f = std::make_unique<GlyphCacheFile_c>();
+
+  if (!f->open(path)) return false;
+
+  files.emplace_back(std::move(f));
+  return true;
+}
+
+bool GlyphCache_c::save(const std::string & path, bool all)
+{
+  std::vector<GlyphCacheFile_c::Record_c> records;
+  std::vector<const uint8_t *> data;
+
+  // the pixels of the encoded images, cache files contain plain images
+  std::vector<std::vector<uint8_t>> decoded;
+
+  // keep the collected images while writing
+  Hold_c hold(*this);
+
+  for (auto & sh : shards)
+  {
+    std::lock_guard<std::mutex> lock(sh.mutex);
+
+    for (auto & e : sh.map)
+    {
+      // images of the cache files are added below, and glyphs whose font is not known can not be saved
+      if (!e.second.data->isOwned()) continue;
+      if (e.first.font && !e.second.fontHash) continue;
+
+      auto r = fileKey(e.first, e.second.fontHash, e.second.fontSize);
+      auto & p = *e.second.data;
+
+      r.left = p.left;
+      r.top = p.top;
+      r.rows = p.rows;
+      r.width = p.width;
+      r.pitch = p.pitch;
 
-    for (auto i = glyphCache.begin(); i != glyphCache.end(); ++i)
-      entries.push_back(i);
+      records.push_back(r);
 
-    std::sort(entries.begin(), entries.end(),
-              [] (const std::unordered_map<GlyphKey_c, PaintData_c>::iterator & a,
-                  const std::unordered_map<GlyphKey_c, PaintData_c>::iterator & b) {
-      return a->second.lastUse < b->second.lastUse;
-    });
+      if (p.isCompressed())
+      {
+        decoded.emplace_back((size_t)p.pitch*p.rows);
+
+        for (int y = 0; y < p.rows; y++)
+          p.decodeRow(y, decoded.back().data() + y*p.pitch);
+
+        data.push_back(decoded.back().data());
+      }
+      else
+      {
+        data.push_back(p.getBuffer());
+      }
+    }
+  }
+
+  if (all)
+  {
+    for (auto & f : files)
+      for (auto & r : *f)
+      {
+        records.push_back(r);
+        data.push_back(f->getData(r));
+      }
+  }
+
+  return GlyphCacheFile_c::write(path, records, data);
+}
+
+GlyphCache_c::Statistics_c GlyphCache_c::getStatistics(void)
+{
+  Statistics_c s;
+
+  for (auto & sh : shards)
+  {
+    std::lock_guard<std::mutex> lock(sh.mutex);
+
+    s.entries += sh.map.size();
+    s.bytes += sh.stats.bytes;
+    s.hits += sh.stats.hits;
+    s.misses += sh.stats.misses;
+    s.fileHits += sh.stats.fileHits;
+    s.evictions += sh.stats.evictions;
+    s.bypassed += sh.stats.bypassed;
+  }
+
+  s.budget = budget;
+  return s;
+}
+
+size_t GlyphCache_c::size(void)
+{
+  size_t n = 0;
+
+  for (auto & sh : shards)
+  {
+    std::lock_guard<std::mutex> lock(sh.mutex);
+    n += sh.map.size();
+  }
+
+  return n;
+}
+
+void GlyphCache_c::removeFont(const FontFace_c * face)
+{
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [face](const PrepareJob_c & j) {
+      return j.face.get() == face; }), pending.end());
+  }
+
+  for (size_t s = 0; s < numShards; s++)
+  {
+    auto & sh = shards[s];
+    std::lock_guard<std::mutex> lock(sh.mutex);
 
-    size_t toDel = glyphCache.size() - num;
+    for (auto i = sh.map.begin(); i != sh.map.end(); )
+    {
+      auto e = &i->second;
+      ++i;
 
-    for (size_t i = 0; i < toDel; i++)
-      glyphCache.erase(entries[i]);
+      if (e->key->font == (intptr_t)face)
+        erase(s, e);
+    }
   }
 }
 
@@ -0,0 +1,213 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+#include <stll/internal/glyphCacheFile.h>
+#include <stll/internal/blurr.h>
+
+#include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace STLL { namespace internal {
+
+static const char cacheMagic[8] = { 'S', 'T', 'L', 'L', 'G', 'C', 'F', '\0' };
+static const uint32_t cacheVersion = 2;
+static const uint32_t byteOrderMark = 0x01020304;
+
+// the header at the start of the file
+class Header_c
+{
+  public:
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t count;
+    uint64_t recordSize;
+    uint64_t length;
+    uint32_t blurrCutoff;  // the cutoff of gaussBlurrDown in 1/64 pixels, it changes the look of big blurrs
+    uint32_t reserved;
+};
+
+static uint32_t currentBlurrCutoff(void)
+{
+  return (uint32_t)std::lround(getGaussBlurrCutoff()*64);
+}
+
+static_assert(sizeof(Header_c) % 8 == 0, "records must be aligned");
+static_assert(sizeof(GlyphCacheFile_c::Record_c) == 56, "unexpected record layout");
+
+GlyphCacheFile_c::~GlyphCacheFile_c(void)
+{
+  if (base) munmap((void*)base, length);
+}
+
+bool GlyphCacheFile_c::open(const std::string & path)
+{
+  if (base) return false;
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header_c))
+  {
+    close(fd);
+    return false;
+  }
+
+  void * m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (m == MAP_FAILED) return false;
+
+  const Header_c * h = (const Header_c*)m;
+
+  bool ok = memcmp(h->magic, cacheMagic, sizeof(cacheMagic)) == 0
+         && h->version == cacheVersion
+         && h->byteOrder == byteOrderMark
+         && h->recordSize == sizeof(Record_c)
+         && h->length == (uint64_t)st.st_size
+         && h->blurrCutoff == currentBlurrCutoff()
+         && h->count <= (h->length - sizeof(Header_c)) / sizeof(Record_c);
+
+  const Record_c * r = (const Record_c*)((const uint8_t*)m + sizeof(Header_c));
+
+  // make sure that all images are within the file and that their rows fit into the pitch, so that
+  // the blitters never read outside of the mapping, even when the file is corrupt, the size is
+  // compared by dividing so that huge values can not overflow
+  for (size_t i = 0; ok && i < h->count; i++)
+  {
+    const Record_c & e = r[i];
+
+    ok = e.pitch > 0 && e.rows >= 0 && e.width >= 0 && e.width <= e.pitch
+      && e.offset <= h->length && (uint64_t)e.rows <= (h->length - e.offset) / (uint64_t)e.pitch;
+  }
+
+  if (!ok)
+  {
+    munmap(m, st.st_size);
+    return false;
+  }
+
+  base = (const uint8_t*)m;
+  length = st.st_size;
+  records = r;
+  count = h->count;
+
+  return true;
+}
+
+const GlyphCacheFile_c::Record_c * GlyphCacheFile_c::find(const Record_c & k) const
+{
+  auto i = std::lower_bound(begin(), end(), k);
+
+  if (i != end() && i->sameKey(k))
+    return i;
+
+  return nullptr;
+}
+
+bool GlyphCacheFile_c::write(const std::string & path, std::vector<Record_c> & recs, const std::vector<const uint8_t *> & data)
+{
+  // sort the records, but keep track where their images are
+  std::vector<size_t> order(recs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&recs](size_t a, size_t b) { return recs[a] < recs[b]; });
+
+  std::vector<Record_c> sorted;
+  std::vector<const uint8_t *> images;
+  sorted.reserve(recs.size());
+  images.reserve(recs.size());
+
+  for (auto i : order)
+  {
+    if (!sorted.empty() && sorted.back().sameKey(recs[i])) continue;
+
+    sorted.push_back(recs[i]);
+    images.push_back(data[i]);
+  }
+
+  // place the images behind the records, each aligned to 16 bytes
+  uint64_t pos = sizeof(Header_c) + sorted.size() * sizeof(Record_c);
+
+  for (auto & r : sorted)
+  {
+    pos = (pos + 15) & ~(uint64_t)15;
+    r.offset = pos;
+    r.reserved = 0;
+    pos += (uint64_t)r.pitch * r.rows;
+  }
+
+  Header_c h;
+  memcpy(h.magic, cacheMagic, sizeof(cacheMagic));
+  h.version = cacheVersion;
+  h.byteOrder = byteOrderMark;
+  h.count = sorted.size();
+  h.recordSize = sizeof(Record_c);
+  h.length = pos;
+  h.blurrCutoff = currentBlurrCutoff();
+  h.reserved = 0;
+
+  // write into a temporary file and then rename it, processes that have mapped the old
+  // file keep the old content
+  std::string tmp = path + ".tmp" + std::to_string(getpid());
+  FILE * f = fopen(tmp.c_str(), "wb");
+
+  if (!f) return false;
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+
+  if (ok && !sorted.empty())
+    ok = fwrite(sorted.data(), sizeof(Record_c), sorted.size(), f) == sorted.size();
+
+  static const uint8_t zeros[16] = { 0 };
+  uint64_t written = sizeof(Header_c) + sorted.size() * sizeof(Record_c);
+
+  for (size_t i = 0; ok && i < sorted.size(); i++)
+  {
+    size_t l = (size_t)sorted[i].pitch * sorted[i].rows;
+
+    ok = fwrite(zeros, 1, sorted[i].offset - written, f) == sorted[i].offset - written
+      && fwrite(images[i], 1, l, f) == l;
+
+    written = sorted[i].offset + l;
+  }
+
+  ok = (fclose(f) == 0) && ok;
+
+  if (ok && rename(tmp.c_str(), path.c_str()) == 0)
+    return true;
+
+  unlink(tmp.c_str());
+  return false;
+}
+
+} }
@@ -21,23 +21,77 @@
  */
 #include <stll/internal/rectanglePacker.h>
 
+#include <algorithm>
+#include <iterator>
+
 namespace STLL { namespace internal {
 
+// add a segment into the list behind the segment after, the index of the
+// new segment is returned
+uint32_t RectanglePacker_c::addSegment(int x, int y, uint32_t after)
+{
+  uint32_t i;
+
+  if (unused.empty())
+  {
+    i = skylines.size();
+    skylines.push_back(skyline {});
+  }
+  else
+  {
+    i = unused.back();
+    unused.pop_back();
+  }
+
+  uint32_t next = after == none ? none : skylines[after].next;
+
+  skylines[i] = skyline { x, y, after, next };
+
+  if (after != none) skylines[after].next = i;
+  if (next != none) skylines[next].prev = i;
+
+  lowest.insert(std::array<int, 3>{y, x, (int)i});
+
+  return i;
+}
+
+void RectanglePacker_c::removeSegment(uint32_t i)
+{
+  auto & s = skylines[i];
+
+  lowest.erase(std::array<int, 3>{s.y, s.x, (int)i});
+
+  if (s.prev != none) skylines[s.prev].next = s.next;
+  if (s.next != none) skylines[s.next].prev = s.prev;
+
+  unused.push_back(i);
+}
+
+void RectanglePacker_c::setHeight(uint32_t i, int y)
+{
+  auto & s = skylines[i];
+
+  lowest.erase(std::array<int, 3>{s.y, s.x, (int)i});
+  s.y = y;
+  lowest.insert(std::array<int, 3>{s.y, s.x, (int)i});
+}
+
 // try to place the rectangle at the start of section with the given
-// index, we return the resulting y-position
-int RectanglePacker_c::checkFit(size_t index, int w)
+// index, we return the resulting y-position, we stop as soon as the
+// y-position is not better than limit
+int RectanglePacker_c::checkFit(uint32_t i, int w, int limit) const
 {
-  int xend = skylines[index].x+w;
-  int y = skylines[index].y;
-  index++;
+  int xend = skylines[i].x+w;
+  int y = skylines[i].y;
+  i = skylines[i].next;
 
-  while (index < skylines.size() && skylines[index].x < xend)
+  while (i != none && skylines[i].x < xend && y < limit)
   {
-    y = std::max(y, skylines[index].y);
-    index++;
+    y = std::max(y, skylines[i].y);
+    i = skylines[i].next;
   }
 
-  return y;
+  return std::min(y, limit);
 }
 
 RectanglePacker_c::RectanglePacker_c(int width, int height) : width_(width), height_(height)
@@ -48,88 +102,109 @@ RectanglePacker_c::RectanglePacker_c(int width, int height) : width_(width), hei
 void RectanglePacker_c::clear(void)
 {
   skylines.clear();
-  skylines.push_back(skyline {1, 1});
-  skylines.push_back(skyline {width_-1, height_});
+  unused.clear();
+  lowest.clear();
+  addSegment(width_-1, height_, addSegment(1, 1, none));
 }
 
 std::experimental::optional<std::array<uint32_t, 2>> RectanglePacker_c::allocate(uint32_t w, uint32_t h)
 {
-  size_t bestI = 0;
-  uint16_t bestY = checkFit(bestI, w);
-
-  for (size_t i = 1; skylines[i].x+(int)w+1 < width_; i++)
+  // the rectangle must end at least one pixel before the bottom
+  int bestY = height_ - (int)h - 1;
+  uint32_t bestI = none;
+
+  // try the segments from the lowest upwards, a segment can not give a position
+  // higher up than itself, so once the segments are not lower than the best
+  // position found there is nothing better left
+  for (auto & l : lowest)
   {
-    uint16_t y = checkFit(i, w);
-    if (y < bestY)
+    if (l[0] > bestY || (l[0] == bestY && bestI == none)) break;
+
+    if (l[1]+(int)w+1 > width_) continue;
+
+    int y = checkFit(l[2], w, bestY+1);
+
+    // on the same height the position more to the left wins
+    if (y < bestY || (y == bestY && bestI != none && l[1] < skylines[bestI].x))
     {
       bestY = y;
-      bestI = i;
+      bestI = l[2];
     }
   }
 
-  // get the resulting x position
+  if (bestI == none)
+  {
+    // doesn't fit
+    return std::experimental::optional<std::array<uint32_t, 2>>();
+  }
+
   int bestX = skylines[bestI].x;
 
   // calculate the next y position for that section
   int nextY = bestY + h;
+  int xend = bestX + w;
+
+  // remove all the segments that are covered by the new one, remembering
+  // the height of the last one, the last segment of the list is never covered
+  int endY = skylines[bestI].y;
+  uint32_t i = skylines[bestI].next;
 
-  if (nextY+1 >= height_)
+  while (skylines[i].x < xend)
   {
-    // doesn't fit
-    return std::experimental::optional<std::array<uint32_t, 2>>();
+    uint32_t next = skylines[i].next;
+    endY = skylines[i].y;
+    removeSegment(i);
+    i = next;
   }
 
-  // update skyline, we use a 2nd vector for this
-  // first copy stuff over to this vector, then swap the data
-  skylines_shadow.clear();
-  skylines_shadow.reserve(skylines.size()+2);
-
-  // 1st copy everything up to the new skyline segment
-  size_t i = 0;
-  while (i < bestI)
+  // a segment for what is left of the last covered section, unless it has
+  // the same height as the new segment
+  if (skylines[i].x > xend && endY != nextY)
   {
-    skylines_shadow.push_back(skylines[i]);
-    i++;
+    addSegment(xend, endY, bestI);
   }
-
-  // if the new segment has a different height than
-  // the one before, add a new segment
-  if (i == 0 || nextY != skylines[i-1].y)
+  else if (skylines[i].x == xend && skylines[i].y == nextY)
   {
-    skylines_shadow.push_back(skyline{skylines[i].x, nextY});
+    removeSegment(i);
   }
 
-  uint16_t xend = skylines[bestI].x+w;
+  // the new segment, unless it just extends the one before
+  uint32_t prev = skylines[bestI].prev;
 
-  // skip all segments until we are at the segment that starts behind us
-  // (at least the last one will do so)
-  while (skylines[i].x < xend)
-    i++;
+  if (prev != none && skylines[prev].y == nextY)
+    removeSegment(bestI);
+  else
+    setHeight(bestI, nextY);
+
+  return std::array<uint32_t, 2>{(uint32_t)bestX, (uint32_t)bestY};
+}
+
+void RectanglePacker_c::grow(int width, int height)
+{
+  // the last segment of the list, it is the highest one
+  uint32_t last = lowest.rbegin()->at(2);
 
-  if (skylines[i].x > xend && skylines[i-1].y != nextY)
+  if (width > width_)
   {
-    skylines_shadow.push_back(skyline{xend, skylines[i-1].y});
-  }
+    // the last segment becomes free space, a new one closes the list
+    setHeight(last, 1);
+    addSegment(width-1, height, last);
 
-  // copy remainder
-  while (i < skylines.size())
+    if (skylines[skylines[last].prev].y == 1)
+      removeSegment(last);
+  }
+  else
   {
-    skylines_shadow.push_back(skylines[i]);
-    i++;
+    setHeight(last, height);
   }
 
-  swap(skylines, skylines_shadow);
-
-  return std::array<uint32_t, 2>{(uint32_t)bestX, (uint32_t)bestY};
+  width_ = width;
+  height_ = height;
 }
 
 void RectanglePacker_c::doubleSize(void)
 {
-  width_ *= 2;
-  height_ *= 2;
-
-  skylines.rbegin()->y = 1;
-  skylines.push_back(skyline {width_-1, height_});
+  grow(2*width_, 2*height_);
 }
 
 } }
@@ -0,0 +1,252 @@
+/*
+ * STLL Simple Text Layouting Library
+ *
+ * STLL is the legal property of its developers, whose
+ * names are listed in the COPYRIGHT file, which is included
+ * within the source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stll/internal/shadowLayers.h>
+#include <stll/internal/layoutIndex.h>
+#include <stll/internal/blitter.h>
+#include <stll/internal/blurr.h>
+#include <stll/internal/dividers.h>
+#include <stll/layouter.h>
+
+#include <algorithm>
+
+namespace STLL { namespace internal {
+
+// commands that can be part of a group
+static bool blurred(const CommandData_c & c)
+{
+  return c.blurr > 0 && (c.command == CommandData_c::CMD_GLYPH || c.command == CommandData_c::CMD_RECT);
+}
+
+// true when b can be in the same group as a
+static bool sameGroup(const CommandData_c & a, const CommandData_c & b)
+{
+  return blurred(b) && a.blurr == b.blurr && a.c == b.c;
+}
+
+std::vector<ShadowGroup_c> ShadowLayers_c::findGroups(const TextLayout_c & l, const std::vector<size_t> & cmds)
+{
+  auto & data = l.getData();
+  std::vector<ShadowGroup_c> groups;
+
+  size_t n = 0;
+
+  while (n < cmds.size())
+  {
+    auto & a = data[cmds[n]];
+
+    if (!blurred(a))
+    {
+      n++;
+      continue;
+    }
+
+    ShadowGroup_c g;
+
+    g.first = n;
+    g.last = n+1;
+    g.dataFirst = cmds[n];
+    g.dataLast = cmds[n]+1;
+    g.image = nullptr;
+
+    // extend the group towards the front within the layout
+    while (g.dataFirst > 0 && sameGroup(a, data[g.dataFirst-1]))
+      g.dataFirst--;
+
+    // extend it towards the back, following commands in cmds become part of the group when
+    // all commands of the layout up to them belong to it
+    while (g.dataLast < data.size() && sameGroup(a, data[g.dataLast]))
+    {
+      g.dataLast++;
+
+      if (g.last < cmds.size() && cmds[g.last] < g.dataLast)
+        g.last++;
+    }
+
+    if (g.dataLast - g.dataFirst >= 2)
+      groups.push_back(g);
+
+    n = g.last;
+  }
+
+  return groups;
+}
+
+// finalizer of murmur hash 3, the same as for the glyph keys
+static uint64_t mix(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+size_t ShadowLayers_c::KeyHash_c::operator()(const Key_c & k) const
+{
+  uint64_t h = mix(k.blurr);
+
+  for (auto & i : k.items)
+  {
+    h = mix(h ^ (uint64_t)i.font);
+    h = mix(h ^ ((uint64_t)i.glyph | (uint64_t)i.command << 32));
+    h = mix(h ^ ((uint64_t)(uint32_t)i.x | (uint64_t)(uint32_t)i.y << 32));
+    h = mix(h ^ ((uint64_t)(uint32_t)i.w | (uint64_t)(uint32_t)i.h << 32));
+  }
+
+  return (size_t)h;
+}
+
+const PaintData_c * ShadowLayers_c::getImage(const TextLayout_c & l, size_t dataFirst, size_t dataLast, GlyphCache_c & cache)
+{
+  auto & data = l.getData();
+  auto & a = data[dataFirst];
+
+  Key_c k;
+  k.blurr = a.blurr;
+  k.items.reserve(dataLast - dataFirst);
+
+  for (size_t n = dataFirst; n < dataLast; n++)
+  {
+    auto & i = data[n];
+
+    k.items.push_back(Item_c { (intptr_t)i.font.get(), i.glyphIndex, i.x - a.x, i.y - a.y, (int32_t)i.w, (int32_t)i.h, (uint8_t)i.command });
+  }
+
+  auto e = images.find(k);
+
+  if (e != images.end())
+  {
+    lru.splice(lru.begin(), lru, e->second.use);
+    return e->second.image.get();
+  }
+
+  // the area of the image relative to the first command in pixels, including the
+  // space for the blurr
+  int64_t x0 = std::numeric_limits<int64_t>::max();
+  int64_t y0 = std::numeric_limits<int64_t>::max();
+  int64_t x1 = std::numeric_limits<int64_t>::min();
+  int64_t y1 = std::numeric_limits<int64_t>::min();
+
+  for (size_t n = dataFirst; n < dataLast; n++)
+  {
+    auto b = commandBox(data[n]);
+
+    x0 = std::min(x0, b.x0 - a.x);
+    y0 = std::min(y0, b.y0 - a.y);
+    x1 = std::max(x1, b.x1 - a.x);
+    y1 = std::max(y1, b.y1 - a.y);
+  }
+
+  x0 = div_inf<int64_t>(x0, 64);
+  y0 = div_inf<int64_t>(y0, 64);
+  x1 = div_inf<int64_t>(x1 + 63, 64);
+  y1 = div_inf<int64_t>(y1 + 63, 64);
+
+  if ((x1-x0) * (y1-y0) > (int64_t)maxPixels) return nullptr;
+
+  int w = x1 - x0;
+  int h = y1 - y0;
+  int pitch = w + 1;
+
+  std::vector<uint8_t> mask(pitch*h, 0);
+
+  // the coverage of the commands is combined, so that overlapping glyphs don't
+  // get more coverage than each of them alone
+  auto get = [](const uint8_t * p) -> auto { return std::make_tuple(p[0], p[0], p[0]); };
+  auto put = [](uint8_t * p, uint8_t r, uint8_t, uint8_t) -> void { p[0] = r; };
+
+  for (size_t n = dataFirst; n < dataLast; n++)
+  {
+    auto & i = data[n];
+    int32_t x = i.x - a.x - x0*64;
+    int32_t y = i.y - a.y - y0*64;
+
+    if (i.command == CommandData_c::CMD_GLYPH)
+    {
+      outputGlyph_NONE(x, y, cache.getGlyph(i.font, i.glyphIndex, SUBP_NONE, 0), Color_c(255, 255, 255, 255),
+                       mask.data(), pitch, 1, w, h, get, put, blendCoverage);
+    }
+    else
+    {
+      fillCoverageRect(x, y, i.w, i.h, mask.data(), pitch, 1, w, h);
+    }
+  }
+
+  gaussBlur(mask.data(), pitch, w, h, a.blurr/64.0, 1, 1);
+
+  GlyphCacheFile_c::Record_c r;
+  r.left = x0;
+  r.top = -y0;
+  r.width = w;
+  r.rows = h;
+  r.pitch = pitch;
+
+  Entry_c n;
+  n.image = std::make_unique<PaintData_c>(r, mask.data(), slab, true);
+
+  auto ins = images.emplace(std::move(k), std::move(n)).first;
+
+  lru.push_front(&ins->first);
+  ins->second.use = lru.begin();
+  bytes += ins->second.image->memory();
+
+  return ins->second.image.get();
+}
+
+void ShadowLayers_c::trim(void)
+{
+  while (bytes > budget && !lru.empty())
+  {
+    auto e = images.find(*lru.back());
+
+    bytes -= e->second.image->memory();
+    lru.pop_back();
+    images.erase(e);
+  }
+}
+
+void ShadowLayers_c::removeFont(const FontFace_c * face)
+{
+  for (auto e = images.begin(); e != images.end(); )
+  {
+    bool found = false;
+
+    for (auto & i : e->first.items)
+      if (i.command == CommandData_c::CMD_GLYPH && i.font == (intptr_t)face)
+        found = true;
+
+    if (found)
+    {
+      bytes -= e->second.image->memory();
+      lru.erase(e->second.use);
+      e = images.erase(e);
+    }
+    else
+    {
+      ++e;
+    }
+  }
+}
+
+} }